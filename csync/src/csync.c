@@ -51,6 +51,7 @@
 
 #include "csync_update.h"
 #include "csync_reconcile.h"
+#include "csync_local_walker.h"
 
 #include "vio/csync_vio.h"
 
@@ -58,37 +59,6 @@
 #include "csync_rename.h"
 #include "c_jhash.h"
 
-static int _key_cmp(const void *key, const void *data) {
-  uint64_t a;
-  csync_file_stat_t *b;
-
-  a = *(uint64_t *) (key);
-  b = (csync_file_stat_t *) data;
-
-  if (a < b->phash) {
-    return -1;
-  } else if (a > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
-static int _data_cmp(const void *key, const void *data) {
-  csync_file_stat_t *a, *b;
-
-  a = (csync_file_stat_t *) key;
-  b = (csync_file_stat_t *) data;
-
-  if (a->phash < b->phash) {
-    return -1;
-  } else if (a->phash > b->phash) {
-    return 1;
-  }
-
-  return 0;
-}
-
 int csync_create(CSYNC **csync, const char *local, const char *remote) {
   CSYNC *ctx;
   size_t len = 0;
@@ -150,13 +120,9 @@ int csync_init(CSYNC *ctx) {
 
   ctx->remote.type = REMOTE_REPLICA;
 
-  if (c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp) < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
-    rc = -1;
-    goto out;
-  }
-
-  if (c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp) < 0) {
+  ctx->local.tree = c_htable_new(0);
+  ctx->remote.tree = c_htable_new(0);
+  if (ctx->local.tree == NULL || ctx->remote.tree == NULL) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
     rc = -1;
     goto out;
@@ -201,18 +167,40 @@ int csync_update(CSYNC *ctx) {
 
   ctx->status_code = CSYNC_STATUS_OK;
 
+  /* Answer the per file journal lookups of update and reconcile from memory */
+  if (!ctx->db_is_empty) {
+      csync_gettime(&start);
+      if (csync_statedb_load_snapshot(ctx) < 0) {
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Could not load the journal snapshot, querying the journal per file");
+      } else {
+          csync_gettime(&finish);
+          CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Loading the journal snapshot took %.2f seconds",
+                    c_secdiff(finish, start));
+      }
+  }
+
   csync_memstat_check();
 
   if (!ctx->excludes) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "No exclude file loaded or defined!");
   }
+  csync_exclude_matcher_free(ctx->exclude_matcher);
+  if (csync_exclude_compile(ctx->excludes, &ctx->exclude_matcher) < 0) {
+      ctx->status_code = CSYNC_STATUS_MEMORY_ERROR;
+      return -1;
+  }
 
   /* update detection for local replica */
   csync_gettime(&start);
   ctx->current = LOCAL_REPLICA;
   ctx->replica = ctx->local.type;
 
+  if (ctx->local_discovery_threads > 1) {
+      ctx->local.walker = csync_local_walker_create(ctx, ctx->local_discovery_threads);
+  }
   rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  csync_local_walker_destroy(ctx->local.walker);
+  ctx->local.walker = NULL;
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
         ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
@@ -224,7 +212,7 @@ int csync_update(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for local replica took %.2f seconds walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+            c_secdiff(finish, start), c_htable_size(ctx->local.tree));
   csync_memstat_check();
 
   /* update detection for remote replica */
@@ -245,7 +233,7 @@ int csync_update(CSYNC *ctx) {
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
             "Update detection for remote replica took %.2f seconds "
             "walking %zu files.",
-            c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+            c_secdiff(finish, start), c_htable_size(ctx->remote.tree));
   csync_memstat_check();
 
   ctx->status |= CSYNC_STATUS_UPDATE;
@@ -284,7 +272,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for local replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->local.tree));
+      c_secdiff(finish, start), c_htable_size(ctx->local.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -305,7 +293,7 @@ int csync_reconcile(CSYNC *ctx) {
 
   CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG,
       "Reconciliation for remote replica took %.2f seconds visiting %zu files.",
-      c_secdiff(finish, start), c_rbtree_size(ctx->remote.tree));
+      c_secdiff(finish, start), c_htable_size(ctx->remote.tree));
 
   if (rc < 0) {
       if (!CSYNC_STATUS_IS_OK(ctx->status_code)) {
@@ -330,11 +318,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
     int rc = 0;
     csync_file_stat_t *cur         = NULL;
     CSYNC *ctx                     = NULL;
-    c_rbtree_visit_func *visitor   = NULL;
+    csync_treewalk_visit_func *visitor = NULL;
     _csync_treewalk_context *twctx = NULL;
     TREE_WALK_FILE trav;
-    c_rbtree_t *other_tree = NULL;
-    c_rbnode_t *other_node = NULL;
+    c_htable_t *other_tree = NULL;
+    csync_file_stat_t *other_stat = NULL;
 
     cur = (csync_file_stat_t *) obj;
     ctx = (CSYNC *) data;
@@ -355,34 +343,34 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         break;
     }
 
-    other_node = c_rbtree_find(other_tree, &cur->phash);
+    other_stat = c_htable_find(other_tree, cur->phash);
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the renamed path as well. */
         int len;
         uint64_t h = 0;
         char *renamed_path = csync_rename_adjust_path(ctx, cur->path);
 
-        if (!c_streq(renamed_path, cur->path)) {
+        if (renamed_path) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_htable_find(other_tree, h);
+            SAFE_FREE(renamed_path);
         }
-        SAFE_FREE(renamed_path);
     }
 
-    if (!other_node) {
+    if (!other_stat) {
         /* Check the source path as well. */
         int len;
         uint64_t h = 0;
         char *renamed_path = csync_rename_adjust_path_source(ctx, cur->path);
 
-        if (!c_streq(renamed_path, cur->path)) {
+        if (renamed_path) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            other_node = c_rbtree_find(other_tree, &h);
+            other_stat = c_htable_find(other_tree, h);
+            SAFE_FREE(renamed_path);
         }
-        SAFE_FREE(renamed_path);
     }
 
     if (obj == NULL || data == NULL) {
@@ -402,7 +390,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
         return 0;
     }
 
-    visitor = (c_rbtree_visit_func*)(twctx->user_visitor);
+    visitor = twctx->user_visitor;
     if (visitor != NULL) {
       trav.path         = cur->path;
       trav.size         = cur->size;
@@ -424,8 +412,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       trav.checksum = cur->checksum;
       trav.checksumTypeId = cur->checksumTypeId;
 
-      if( other_node ) {
-          csync_file_stat_t *other_stat = (csync_file_stat_t*)other_node->data;
+      if( other_stat ) {
           trav.other.etag = other_stat->etag;
           trav.other.file_id = other_stat->file_id;
           trav.other.instruction = other_stat->instruction;
@@ -442,8 +429,7 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
       rc = (*visitor)(&trav, twctx->userdata);
       cur->instruction = trav.instruction;
       if (trav.etag != cur->etag) { // FIXME It would be nice to have this documented
-          SAFE_FREE(cur->etag);
-          cur->etag = c_strdup(trav.etag);
+          cur->etag = csync_arena_strdup(ctx, trav.etag);
       }
 
       return rc;
@@ -456,11 +442,11 @@ static int _csync_treewalk_visitor(void *obj, void *data) {
  * treewalk function, called from its wrappers below.
  *
  * it encapsulates the user visitor function, the filter and the userdata
- * into a treewalk_context structure and calls the rb treewalk function,
+ * into a treewalk_context structure and calls the hash table walk function,
  * which calls the local _csync_treewalk_visitor in this module.
  * The user visitor is called from there.
  */
-static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_func *visitor, int filter)
+static int _csync_walk_tree(CSYNC *ctx, c_htable_t *tree, csync_treewalk_visit_func *visitor, int filter)
 {
     _csync_treewalk_context tw_ctx;
     int rc = -1;
@@ -481,7 +467,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
 
     ctx->callbacks.userdata = &tw_ctx;
 
-    rc = c_rbtree_walk(tree, (void*) ctx, _csync_treewalk_visitor);
+    rc = c_htable_walk(tree, (void*) ctx, _csync_treewalk_visitor);
     if( rc < 0 ) {
       if( ctx->status_code == CSYNC_STATUS_OK )
           ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_TREE_ERROR);
@@ -496,7 +482,7 @@ static int _csync_walk_tree(CSYNC *ctx, c_rbtree_t *tree, csync_treewalk_visit_f
  */
 int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_htable_t *tree = NULL;
     int rc = -1;
 
     if(ctx != NULL) {
@@ -515,7 +501,7 @@ int csync_walk_remote_tree(CSYNC *ctx,  csync_treewalk_visit_func *visitor, int
  */
 int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int filter)
 {
-    c_rbtree_t *tree = NULL;
+    c_htable_t *tree = NULL;
     int rc = -1;
 
     if (ctx != NULL) {
@@ -529,31 +515,26 @@ int csync_walk_local_tree(CSYNC *ctx, csync_treewalk_visit_func *visitor, int fi
     return rc;  
 }
 
-static void _tree_destructor(void *data) {
-  csync_file_stat_t *freedata = NULL;
-
-  freedata = (csync_file_stat_t *) data;
-  csync_file_stat_free(freedata);
-}
-
 /* reset all the list to empty.
  * used by csync_commit and csync_destroy */
 static void _csync_clean_ctx(CSYNC *ctx)
 {
-    /* destroy the rbtrees */
-    if (c_rbtree_size(ctx->local.tree) > 0) {
-        c_rbtree_destroy(ctx->local.tree, _tree_destructor);
-    }
-
-    if (c_rbtree_size(ctx->remote.tree) > 0) {
-        c_rbtree_destroy(ctx->remote.tree, _tree_destructor);
-    }
-
     csync_rename_destroy(ctx);
-
-    /* free memory */
-    c_rbtree_free(ctx->local.tree);
-    c_rbtree_free(ctx->remote.tree);
+    csync_statedb_free_snapshot(ctx);
+    csync_exclude_matcher_free(ctx->exclude_matcher);
+    ctx->exclude_matcher = NULL;
+
+    /* free memory: the file stats in the trees all live in the arena */
+    c_htable_free(ctx->local.tree);
+    c_htable_free(ctx->remote.tree);
+    ctx->local.tree = NULL;
+    ctx->remote.tree = NULL;
+
+    if (ctx->arena) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Releasing %zu bytes of file stats", c_arena_size(ctx->arena));
+        c_arena_free(ctx->arena);
+        ctx->arena = NULL;
+    }
 
     SAFE_FREE(ctx->statedb.file);
     SAFE_FREE(ctx->remote.root_perms);
@@ -561,6 +542,8 @@ static void _csync_clean_ctx(CSYNC *ctx)
 
 int csync_commit(CSYNC *ctx) {
   int rc = 0;
+  size_t local_size = 0;
+  size_t remote_size = 0;
 
   if (ctx == NULL) {
     return -1;
@@ -575,8 +558,13 @@ int csync_commit(CSYNC *ctx) {
   }
   ctx->statedb.db = NULL;
 
+  /* the next sync most likely sees about as many files */
+  local_size = c_htable_size(ctx->local.tree);
+  remote_size = c_htable_size(ctx->remote.tree);
+
   _csync_clean_ctx(ctx);
 
+  ctx->local.read_from_db = 0;
   ctx->remote.read_from_db = 0;
   ctx->read_remote_from_db = true;
   ctx->db_is_empty = false;
@@ -584,15 +572,11 @@ int csync_commit(CSYNC *ctx) {
 
 
   /* Create new trees */
-  rc = c_rbtree_create(&ctx->local.tree, _key_cmp, _data_cmp);
-  if (rc < 0) {
-    ctx->status_code = CSYNC_STATUS_TREE_ERROR;
-    goto out;
-  }
-
-  rc = c_rbtree_create(&ctx->remote.tree, _key_cmp, _data_cmp);
-  if (rc < 0) {
+  ctx->local.tree = c_htable_new(local_size);
+  ctx->remote.tree = c_htable_new(remote_size);
+  if (ctx->local.tree == NULL || ctx->remote.tree == NULL) {
     ctx->status_code = CSYNC_STATUS_TREE_ERROR;
+    rc = -1;
     goto out;
   }
 
@@ -737,6 +721,45 @@ int  csync_abort_requested(CSYNC *ctx)
   }
 }
 
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen)
+{
+  if (ctx->arena == NULL) {
+    ctx->arena = c_arena_new(0);
+  }
+  return c_arena_alloc(ctx->arena, sizeof(csync_file_stat_t) + pathlen + 1);
+}
+
+csync_file_stat_t *csync_file_stat_copy(CSYNC *ctx, const csync_file_stat_t *st)
+{
+  csync_file_stat_t *copy = NULL;
+
+  if (st == NULL) {
+    return NULL;
+  }
+  copy = csync_file_stat_new(ctx, st->pathlen);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, st, sizeof(csync_file_stat_t) + st->pathlen + 1);
+  copy->destpath = csync_arena_strdup(ctx, st->destpath);
+  copy->etag = csync_arena_strdup(ctx, st->etag);
+  copy->directDownloadUrl = csync_arena_strdup(ctx, st->directDownloadUrl);
+  copy->directDownloadCookies = csync_arena_strdup(ctx, st->directDownloadCookies);
+  copy->checksum = csync_arena_strdup(ctx, st->checksum);
+  return copy;
+}
+
+char *csync_arena_strdup(CSYNC *ctx, const char *str)
+{
+  if (str == NULL) {
+    return NULL;
+  }
+  if (ctx->arena == NULL) {
+    ctx->arena = c_arena_new(0);
+  }
+  return c_arena_strdup(ctx->arena, str);
+}
+
 void csync_file_stat_free(csync_file_stat_t *st)
 {
   if (st) {
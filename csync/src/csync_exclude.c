@@ -23,6 +23,7 @@
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
+#include <errno.h>
 #include <stdio.h>
 
 #include <sys/types.h>
@@ -32,6 +33,7 @@
 
 #include "c_lib.h"
 #include "c_private.h"
+#include "c_jhash.h"
 
 #include "csync_private.h"
 #include "csync_exclude.h"
@@ -169,26 +171,592 @@ bool csync_is_windows_reserved_word(const char* filename) {
   return false;
 }
 
-static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const char *path, int filetype, bool check_leading_dirs) {
-    size_t i = 0;
-    const char *bname = NULL;
-    size_t blen = 0;
+#ifdef _WIN32
+/* csync_fnmatch() uses PathMatchSpec() there, which ignores the case */
+#define EXCLUDE_FOLD(c) (((c) >= 'A' && (c) <= 'Z') ? (c) - 'A' + 'a' : (c))
+#else
+#define EXCLUDE_FOLD(c) (c)
+#endif
+
+/* How a pattern of the exclude list is matched */
+enum csync_exclude_kind_e {
+  EXCLUDE_LITERAL,  /* "name" */
+  EXCLUDE_PREFIX,   /* "name*" */
+  EXCLUDE_SUFFIX,   /* "*name" */
+  EXCLUDE_CONTAINS, /* "*name*" */
+  EXCLUDE_GLOB      /* anything else, goes to csync_fnmatch() */
+};
+
+typedef struct csync_exclude_pattern_s {
+  const char *pattern; /* without the leading ']' and the trailing '/' */
+  const char *literal; /* the part without wildcards, for globs the part before the first one */
+  size_t literal_len;
+  const char *tail;    /* for globs the part after the last wildcard */
+  size_t tail_len;
+  unsigned int kind      : 3;
+  unsigned int remove    : 1; /* started with ']' */
+  unsigned int dirs_only : 1; /* ended with '/' */
+  unsigned int has_slash : 1; /* is matched against the whole path */
+  struct csync_exclude_pattern_s *next; /* in the same bucket */
+} csync_exclude_pattern_t;
+
+/* Node of a trie over the literal part of the patterns. The suffix patterns
+ * are stored reversed. */
+typedef struct csync_exclude_node_s {
+  struct csync_exclude_node_s *child;
+  struct csync_exclude_node_s *sibling;
+  csync_exclude_pattern_t *exact;   /* literal patterns ending here */
+  csync_exclude_pattern_t *partial; /* prefix or suffix patterns ending here */
+  unsigned char c;
+} csync_exclude_node_t;
+
+struct csync_exclude_matcher_s {
+  c_arena_t *arena; /* everything below lives in it */
+  csync_exclude_pattern_t *patterns; /* in the order of the list, which decides between matches */
+  size_t count;
+  csync_exclude_node_t prefixes; /* literal and prefix patterns */
+  csync_exclude_node_t suffixes; /* suffix patterns */
+  csync_exclude_pattern_t *others; /* contains and glob patterns, in list order */
+  csync_exclude_pattern_t *paths;  /* patterns with a '/', in list order */
+};
+
+static bool _csync_exclude_memeq(const char *a, const char *b, size_t n) {
+#ifdef _WIN32
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (EXCLUDE_FOLD((unsigned char) a[i]) != EXCLUDE_FOLD((unsigned char) b[i])) {
+      return false;
+    }
+  }
+  return true;
+#else
+  return memcmp(a, b, n) == 0;
+#endif
+}
+
+static bool _csync_exclude_has_prefix(const char *s, size_t len, const char *prefix, size_t prefix_len) {
+  return len >= prefix_len && _csync_exclude_memeq(s, prefix, prefix_len);
+}
+
+static bool _csync_exclude_has_suffix(const char *s, size_t len, const char *suffix, size_t suffix_len) {
+  return len >= suffix_len && _csync_exclude_memeq(s + len - suffix_len, suffix, suffix_len);
+}
+
+static bool _csync_exclude_contains(const char *s, size_t len, const char *needle, size_t needle_len) {
+  size_t i;
+
+  for (i = 0; i + needle_len <= len; i++) {
+    if (_csync_exclude_memeq(s + i, needle, needle_len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Keep the literal prefix and suffix of a glob to rule out most names without csync_fnmatch() */
+static void _csync_exclude_set_glob(csync_exclude_pattern_t *p, size_t len) {
+  size_t tail = len;
+
+  p->kind = EXCLUDE_GLOB;
+  p->literal = p->pattern;
+  p->literal_len = strcspn(p->pattern, "*?[\\");
+  while (tail > p->literal_len && !strchr("*?[]\\", p->pattern[tail - 1])) {
+    tail--;
+  }
+  p->tail = p->pattern + tail;
+  p->tail_len = len - tail;
+
+#ifdef _WIN32
+  /* PathMatchSpec() takes a list of patterns separated by ';' */
+  if (strchr(p->pattern, ';')) {
+    p->literal_len = 0;
+    p->tail_len = 0;
+  }
+#endif
+}
+
+static void _csync_exclude_classify(csync_exclude_pattern_t *p, size_t len) {
+  const char *s = p->pattern;
+  size_t first = len; /* position of the first wildcard */
+  size_t last = len;  /* position of the last wildcard */
+  int stars = 0;
+  int wildcards = 0;
+  bool special = false;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    switch (s[i]) {
+    case '*':
+      stars++;
+      /* fall through */
+    case '?':
+      wildcards++;
+      if (first == len) {
+        first = i;
+      }
+      last = i;
+      break;
+    case '[':
+    case '\\':
+#ifdef _WIN32
+    case ';':
+#endif
+      special = true;
+      break;
+    default:
+      break;
+    }
+  }
+#ifdef _WIN32
+  /* PathMatchSpec() lets "name.*" match "name" */
+  if (len >= 2 && s[len - 2] == '.' && s[len - 1] == '*') {
+    special = true;
+  }
+#endif
+
+  if (special || wildcards != stars || stars > 2) {
+    _csync_exclude_set_glob(p, len);
+  } else if (stars == 0) {
+    p->kind = EXCLUDE_LITERAL;
+    p->literal = s;
+    p->literal_len = len;
+  } else if (stars == 1 && last == len - 1) {
+    p->kind = EXCLUDE_PREFIX;
+    p->literal = s;
+    p->literal_len = len - 1;
+  } else if (stars == 1 && first == 0) {
+    p->kind = EXCLUDE_SUFFIX;
+    p->literal = s + 1;
+    p->literal_len = len - 1;
+  } else if (stars == 2 && first == 0 && last == len - 1) {
+    p->kind = EXCLUDE_CONTAINS;
+    p->literal = s + 1;
+    p->literal_len = len - 2;
+  } else {
+    _csync_exclude_set_glob(p, len);
+  }
+}
+
+static csync_exclude_node_t *_csync_exclude_child(const csync_exclude_node_t *node, unsigned char c) {
+  csync_exclude_node_t *child = NULL;
+
+  for (child = node->child; child != NULL; child = child->sibling) {
+    if (child->c == c) {
+      break;
+    }
+  }
+  return child;
+}
+
+static csync_exclude_node_t *_csync_exclude_trie_add(c_arena_t *arena, csync_exclude_node_t *node,
+    const char *s, size_t len, bool reverse) {
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    unsigned char c = EXCLUDE_FOLD((unsigned char) s[reverse ? len - 1 - i : i]);
+    csync_exclude_node_t *child = _csync_exclude_child(node, c);
+
+    if (child == NULL) {
+      child = c_arena_alloc(arena, sizeof(csync_exclude_node_t));
+      if (child == NULL) {
+        return NULL;
+      }
+      child->c = c;
+      child->sibling = node->child;
+      node->child = child;
+    }
+    node = child;
+  }
+  return node;
+}
+
+int csync_exclude_compile(c_strlist_t *excludes, csync_exclude_matcher_t **matcher) {
+  csync_exclude_matcher_t *m = NULL;
+  csync_exclude_pattern_t **others_tail = NULL;
+  csync_exclude_pattern_t **paths_tail = NULL;
+  size_t i;
+
+  if (matcher == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  *matcher = NULL;
+
+  m = c_malloc(sizeof(csync_exclude_matcher_t));
+  if (m == NULL) {
+    return -1;
+  }
+  m->arena = c_arena_new(0);
+  if (m->arena == NULL) {
+    goto err;
+  }
+  if (excludes && excludes->count > 0) {
+    m->patterns = c_arena_alloc(m->arena, excludes->count * sizeof(csync_exclude_pattern_t));
+    if (m->patterns == NULL) {
+      goto err;
+    }
+  }
+  others_tail = &m->others;
+  paths_tail = &m->paths;
+
+  for (i = 0; excludes && i < excludes->count; i++) {
+    const char *line = excludes->vector[i];
+    csync_exclude_pattern_t *p = NULL;
+    csync_exclude_node_t *node = NULL;
+    char *pattern = NULL;
+    size_t len = 0;
+
+    if (!line[0]) { /* empty pattern */
+      continue;
+    }
+    p = &m->patterns[m->count++];
+
+    /* Excludes starting with ']' means it can be cleanup */
+    if (line[0] == ']') {
+      p->remove = 1;
+      ++line;
+    }
+    pattern = c_arena_strdup(m->arena, line);
+    if (pattern == NULL) {
+      goto err;
+    }
+    len = strlen(pattern);
+    /* Check if the pattern applies to pathes only. */
+    if (len > 0 && pattern[len - 1] == '/') {
+      p->dirs_only = 1;
+      pattern[--len] = '\0';
+    }
+    p->pattern = pattern;
+    p->has_slash = strchr(pattern, '/') != NULL;
+
+    _csync_exclude_classify(p, len);
+
+    if (p->has_slash) {
+      /* a '*' doesn't match a '/' in the whole path, so only literals are special */
+      if (p->kind != EXCLUDE_LITERAL) {
+        _csync_exclude_set_glob(p, len);
+      }
+      *paths_tail = p;
+      paths_tail = &p->next;
+      continue;
+    }
+
+    switch (p->kind) {
+    case EXCLUDE_LITERAL:
+    case EXCLUDE_PREFIX:
+      node = _csync_exclude_trie_add(m->arena, &m->prefixes, p->literal, p->literal_len, false);
+      if (node == NULL) {
+        goto err;
+      }
+      if (p->kind == EXCLUDE_LITERAL) {
+        p->next = node->exact;
+        node->exact = p;
+      } else {
+        p->next = node->partial;
+        node->partial = p;
+      }
+      break;
+    case EXCLUDE_SUFFIX:
+      node = _csync_exclude_trie_add(m->arena, &m->suffixes, p->literal, p->literal_len, true);
+      if (node == NULL) {
+        goto err;
+      }
+      p->next = node->partial;
+      node->partial = p;
+      break;
+    default:
+      *others_tail = p;
+      others_tail = &p->next;
+      break;
+    }
+  }
+
+  *matcher = m;
+  return 0;
+
+err:
+  csync_exclude_matcher_free(m);
+  errno = ENOMEM;
+  return -1;
+}
+
+void csync_exclude_matcher_free(csync_exclude_matcher_t *matcher) {
+  if (matcher == NULL) {
+    return;
+  }
+  c_arena_free(matcher->arena);
+  SAFE_FREE(matcher);
+}
+
+/* The patterns are compared by their position: the first one in the list wins */
+static void _csync_exclude_pick(csync_exclude_pattern_t *bucket, bool skip_dirs_only,
+    const csync_exclude_pattern_t **best) {
+  for (; bucket != NULL; bucket = bucket->next) {
+    if (skip_dirs_only && bucket->dirs_only) {
+      continue;
+    }
+    if (*best == NULL || bucket < *best) {
+      *best = bucket;
+    }
+  }
+}
+
+static bool _csync_exclude_glob_matches(const csync_exclude_pattern_t *p, const char *name, size_t len, int flags) {
+  if (len < p->literal_len + p->tail_len
+      || !_csync_exclude_has_prefix(name, len, p->literal, p->literal_len)
+      || !_csync_exclude_has_suffix(name, len, p->tail, p->tail_len)) {
+    return false;
+  }
+  return csync_fnmatch(p->pattern, name, flags) == 0;
+}
+
+/*
+ * Match a name against the patterns without a '/'. The literal, prefix and
+ * suffix patterns are all found by walking the name once forwards and once
+ * backwards through the tries. name must be terminated at len.
+ */
+static void _csync_exclude_match_name(const csync_exclude_matcher_t *m, const char *name, size_t len,
+    bool skip_dirs_only, const csync_exclude_pattern_t **best) {
+  const csync_exclude_node_t *node = &m->prefixes;
+  csync_exclude_pattern_t *p = NULL;
+  size_t i;
+
+  for (i = 0; node != NULL; i++) {
+    _csync_exclude_pick(node->partial, skip_dirs_only, best);
+    if (i == len) {
+      _csync_exclude_pick(node->exact, skip_dirs_only, best);
+      break;
+    }
+    node = _csync_exclude_child(node, EXCLUDE_FOLD((unsigned char) name[i]));
+  }
+
+  node = &m->suffixes;
+  for (i = len; node != NULL; i--) {
+    _csync_exclude_pick(node->partial, skip_dirs_only, best);
+    if (i == 0) {
+      break;
+    }
+    node = _csync_exclude_child(node, EXCLUDE_FOLD((unsigned char) name[i - 1]));
+  }
+
+  for (p = m->others; p != NULL && (*best == NULL || p < *best); p = p->next) {
+    if (skip_dirs_only && p->dirs_only) {
+      continue;
+    }
+    if (p->kind == EXCLUDE_CONTAINS
+        ? _csync_exclude_contains(name, len, p->literal, p->literal_len)
+        : _csync_exclude_glob_matches(p, name, len, 0)) {
+      *best = p;
+    }
+  }
+}
+
+/* Match a path against the patterns with a '/'. path must be terminated at len. */
+static void _csync_exclude_match_path(const csync_exclude_matcher_t *m, const char *path, size_t len,
+    int flags, bool skip_dirs_only, const csync_exclude_pattern_t **best) {
+  csync_exclude_pattern_t *p = NULL;
+
+  for (p = m->paths; p != NULL && (*best == NULL || p < *best); p = p->next) {
+    if (skip_dirs_only && p->dirs_only) {
+      continue;
+    }
+    if (p->kind == EXCLUDE_LITERAL
+        ? (len == p->literal_len && _csync_exclude_memeq(path, p->literal, len))
+        : _csync_exclude_glob_matches(p, path, len, flags)) {
+      *best = p;
+    }
+  }
+}
+
+/*
+ * Check each component and leading directory of a path, i.e. for
+ * "/foo/bar/fi" 'fi', '/foo/bar', 'bar', '/foo' and 'foo'. Patterns for
+ * directories skip the first of them if it is a file. buf holds the path and
+ * gets modified.
+ */
+static void _csync_exclude_match_components(const csync_exclude_matcher_t *m, char *buf, size_t len,
+    int filetype, const csync_exclude_pattern_t **best) {
+    size_t end = len;
+    size_t i;
+    bool first = true;
+
+    for (i = len; ; --i) {
+        // read backwards until a path separator is found
+        if (i != 0 && buf[i-1] != '/') {
+            continue;
+        }
+
+        // check 'basename', i.e. for "/foo/bar/fi" we'd check 'fi', 'bar', 'foo'
+        if (end > i) {
+            _csync_exclude_match_name(m, buf + i, end - i, first && filetype == CSYNC_FTW_TYPE_FILE, best);
+            first = false;
+        }
+
+        if (i == 0) {
+            break;
+        }
+
+        // check 'dirname', i.e. for "/foo/bar/fi" we'd check '/foo/bar', '/foo'
+        buf[i-1] = '\0';
+        end = i - 1;
+        _csync_exclude_match_name(m, buf, end, first && filetype == CSYNC_FTW_TYPE_FILE, best);
+        _csync_exclude_match_path(m, buf, end, 0, first && filetype == CSYNC_FTW_TYPE_FILE, best);
+        first = false;
+    }
+}
+
+/* Directories the cache may hold before it starts over */
+#define EXCLUDE_CACHE_MAX_DIRS 10000
+
+typedef struct csync_exclude_dir_s {
+  const char *path;
+  size_t len;
+  const csync_exclude_pattern_t *best; /* NULL if nothing matched */
+} csync_exclude_dir_t;
+
+struct csync_exclude_cache_s {
+  c_htable_t *dirs; /* csync_exclude_dir_t by the hash of their path */
+  c_arena_t *arena; /* the entries and their paths */
+  uint64_t hits;
+  uint64_t misses;
+};
+
+csync_exclude_cache_t *csync_exclude_cache_new(void) {
+  csync_exclude_cache_t *cache = c_malloc(sizeof(csync_exclude_cache_t));
+
+  if (cache == NULL) {
+    return NULL;
+  }
+  cache->dirs = c_htable_new(0);
+  cache->arena = c_arena_new(0);
+  if (cache->dirs == NULL || cache->arena == NULL) {
+    csync_exclude_cache_free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+void csync_exclude_cache_free(csync_exclude_cache_t *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  c_htable_free(cache->dirs);
+  c_arena_free(cache->arena);
+  SAFE_FREE(cache);
+}
+
+void csync_exclude_cache_clear(csync_exclude_cache_t *cache) {
+  if (cache == NULL) {
+    return;
+  }
+  c_htable_free(cache->dirs);
+  c_arena_free(cache->arena);
+  cache->dirs = c_htable_new(0);
+  cache->arena = c_arena_new(0);
+}
+
+void csync_exclude_cache_stats(const csync_exclude_cache_t *cache, uint64_t *hits, uint64_t *misses) {
+  if (hits) {
+    *hits = cache ? cache->hits : 0;
+  }
+  if (misses) {
+    *misses = cache ? cache->misses : 0;
+  }
+}
+
+static void _csync_exclude_cache_add(csync_exclude_cache_t *cache, uint64_t h, const char *path, size_t len,
+    const csync_exclude_pattern_t *best) {
+  csync_exclude_dir_t *dir = NULL;
+  char *copy = NULL;
+
+  if (c_htable_size(cache->dirs) >= EXCLUDE_CACHE_MAX_DIRS) {
+    csync_exclude_cache_clear(cache);
+  }
+  if (cache->dirs == NULL || cache->arena == NULL) {
+    return;
+  }
+
+  dir = c_arena_alloc(cache->arena, sizeof(csync_exclude_dir_t));
+  copy = c_arena_alloc(cache->arena, len + 1);
+  if (dir == NULL || copy == NULL) {
+    return;
+  }
+  memcpy(copy, path, len);
+  dir->path = copy;
+  dir->len = len;
+  dir->best = best;
+  /* on a hash collision the first directory keeps the slot */
+  c_htable_insert(cache->dirs, h, dir);
+}
+
+/* Looks dir up without touching the cache, false if it is not cached */
+static bool _csync_exclude_dir_find(const csync_exclude_cache_t *cache, const char *buf, size_t len,
+    const csync_exclude_pattern_t **best) {
+  const csync_exclude_dir_t *dir = c_htable_find(cache->dirs, c_jhash64((const uint8_t *) buf, len, 0));
+
+  if (dir && dir->len == len && memcmp(dir->path, buf, len) == 0) {
+    *best = dir->best;
+    return true;
+  }
+  return false;
+}
+
+/*
+ * The first pattern matching the leading directories of a path below dir,
+ * i.e. dir, its name and the same for all its parents. This is what the
+ * entries of a directory have in common, so it is cached per directory and
+ * a directory only adds its own name and path to the result of its parent.
+ * dir is the first len bytes of buf, which must be writable.
+ */
+static const csync_exclude_pattern_t *_csync_exclude_dir(const csync_exclude_matcher_t *m, csync_exclude_cache_t *cache,
+    char *buf, size_t len) {
+  const csync_exclude_pattern_t *best = NULL;
+  const csync_exclude_pattern_t *parent = NULL;
+  uint64_t h = c_jhash64((uint8_t *) buf, len, 0);
+  size_t k = len;
+  char saved;
+
+  if (_csync_exclude_dir_find(cache, buf, len, &best)) {
+    cache->hits++;
+    return best;
+  }
+  cache->misses++;
+
+  saved = buf[len];
+  buf[len] = '\0';
+
+  /* the directory as a leading directory, like 'foo/bar' of 'foo/bar/fi' */
+  _csync_exclude_match_name(m, buf, len, false, &best);
+  _csync_exclude_match_path(m, buf, len, 0, false, &best);
+
+  /* its name, like 'bar' */
+  while (k > 0 && buf[k-1] != '/') {
+    k--;
+  }
+  if (len > k) {
+    _csync_exclude_match_name(m, buf + k, len - k, false, &best);
+  }
+
+  if (k > 0) {
+    parent = _csync_exclude_dir(m, cache, buf, k - 1);
+    if (parent && (best == NULL || parent < best)) {
+      best = parent;
+    }
+  }
+
+  buf[len] = saved;
+  _csync_exclude_cache_add(cache, h, buf, len, best);
+  return best;
+}
+
+/* The rules that apply whatever the exclude list says */
+static CSYNC_EXCLUDE_TYPE _csync_excluded_builtin(const char *path, const char *bname, size_t blen) {
     char *conflict = NULL;
     int rc = -1;
     CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
-    CSYNC_EXCLUDE_TYPE type  = CSYNC_NOT_EXCLUDED;
-
-    /* split up the path */
-    bname = strrchr(path, '/');
-    if (bname) {
-        bname += 1; // don't include the /
-    } else {
-        bname = path;
-    }
-    blen = strlen(bname);
 
-    rc = csync_fnmatch(".csync_journal.db*", bname, 0);
-    if (rc == 0) {
+    if (_csync_exclude_has_prefix(bname, blen, ".csync_journal.db", 17)) {
         match = CSYNC_FILE_SILENTLY_EXCLUDED;
         goto out;
     }
@@ -235,15 +803,13 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
     }
 #endif
 
-    rc = csync_fnmatch(".owncloudsync.log*", bname, 0);
-    if (rc == 0) {
+    if (_csync_exclude_has_prefix(bname, blen, ".owncloudsync.log", 17)) {
         match = CSYNC_FILE_SILENTLY_EXCLUDED;
         goto out;
     }
 
     /* Always ignore conflict files, not only via the exclude list */
-    rc = csync_fnmatch("*_conflict-*", bname, 0);
-    if (rc == 0) {
+    if (_csync_exclude_contains(bname, blen, "_conflict-", 10)) {
         match = CSYNC_FILE_SILENTLY_EXCLUDED;
         goto out;
     }
@@ -262,11 +828,115 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
         SAFE_FREE(conflict);
     }
 
-    if( ! excludes ) {
+  out:
+
+    return match;
+}
+
+/* With lookup set, the cache is only read: *lookup becomes 1 if the directory
+ * was cached and -1 if it was not, the result is meaningless then. */
+static CSYNC_EXCLUDE_TYPE _csync_excluded_common(const csync_exclude_matcher_t *matcher, csync_exclude_cache_t *cache,
+                                                 const char *path, int filetype, bool check_leading_dirs, int *lookup) {
+    const char *bname = NULL;
+    size_t blen = 0;
+    CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
+    const csync_exclude_pattern_t *best = NULL;
+
+    /* split up the path */
+    bname = strrchr(path, '/');
+    if (bname) {
+        bname += 1; // don't include the /
+    } else {
+        bname = path;
+    }
+    blen = strlen(bname);
+
+    match = _csync_excluded_builtin(path, bname, blen);
+    if (match != CSYNC_NOT_EXCLUDED) {
+        goto out;
+    }
+
+    if (matcher == NULL || matcher->count == 0) {
         goto out;
     }
 
+    /* a pattern for directories still applies to the whole path, but not if it is a file */
+    _csync_exclude_match_path(matcher, path, strlen(path), FNM_PATHNAME, filetype != CSYNC_FTW_TYPE_DIR, &best);
+
+    if (!check_leading_dirs) {
+        _csync_exclude_match_name(matcher, bname, blen, filetype == CSYNC_FTW_TYPE_FILE, &best);
+    } else {
+        /* the components are checked in a copy of the path */
+        char stack_buf[1024];
+        char *buf = stack_buf;
+        size_t len = strlen(path);
+
+        if (len >= sizeof(stack_buf)) {
+            buf = c_malloc(len + 1);
+            if (buf == NULL) {
+                goto out;
+            }
+        }
+        memcpy(buf, path, len + 1);
+
+        if (cache && cache->dirs && cache->arena && blen > 0) {
+            /* only the name is new, the rest comes from the directory */
+            _csync_exclude_match_name(matcher, bname, blen, filetype == CSYNC_FTW_TYPE_FILE, &best);
+            if (bname != path) {
+                const csync_exclude_pattern_t *dir_best = NULL;
+                if (lookup == NULL) {
+                    dir_best = _csync_exclude_dir(matcher, cache, buf, bname - path - 1);
+                } else {
+                    *lookup = _csync_exclude_dir_find(cache, buf, bname - path - 1, &dir_best) ? 1 : -1;
+                }
+                if (dir_best && (best == NULL || dir_best < best)) {
+                    best = dir_best;
+                }
+            }
+        } else {
+            _csync_exclude_match_components(matcher, buf, len, filetype, &best);
+        }
+
+        if (buf != stack_buf) {
+            SAFE_FREE(buf);
+        }
+    }
+
+    if (best != NULL) {
+        match = (best->remove && filetype == CSYNC_FTW_TYPE_FILE) ? CSYNC_FILE_EXCLUDE_AND_REMOVE
+                                                                  : CSYNC_FILE_EXCLUDE_LIST;
+    }
+
+  out:
+
+    return match;
+}
+
+/* Loops over the patterns like before csync_exclude_compile() existed: compiling
+ * the list would cost much more than a single check. */
+static CSYNC_EXCLUDE_TYPE _csync_excluded_list(c_strlist_t *excludes, const char *path, int filetype, bool check_leading_dirs) {
+    size_t i = 0;
+    const char *bname = NULL;
+    size_t blen = 0;
+    int rc = -1;
+    CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
+    CSYNC_EXCLUDE_TYPE type  = CSYNC_NOT_EXCLUDED;
     c_strlist_t *path_components = NULL;
+
+    /* split up the path */
+    bname = strrchr(path, '/');
+    if (bname) {
+        bname += 1; // don't include the /
+    } else {
+        bname = path;
+    }
+    blen = strlen(bname);
+
+    match = _csync_excluded_builtin(path, bname, blen);
+    if (match != CSYNC_NOT_EXCLUDED || !excludes) {
+        goto out;
+    }
+
     if (check_leading_dirs) {
         /* Build a list of path components to check. */
         path_components = c_strlist_new(32);
@@ -363,10 +1033,35 @@ static CSYNC_EXCLUDE_TYPE _csync_excluded_common(c_strlist_t *excludes, const ch
 }
 
 CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, false);
+  return _csync_excluded_list(excludes, path, filetype, false);
 }
 
 CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype) {
-  return _csync_excluded_common(excludes, path, filetype, true);
+  return _csync_excluded_list(excludes, path, filetype, true);
+}
+
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal_compiled(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(matcher, NULL, path, filetype, false, NULL);
+}
+
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx_compiled(const csync_exclude_matcher_t *matcher, const char *path, int filetype) {
+  return _csync_excluded_common(matcher, NULL, path, filetype, true, NULL);
+}
+
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx_cached(const csync_exclude_matcher_t *matcher, csync_exclude_cache_t *cache,
+                                                const char *path, int filetype) {
+  return _csync_excluded_common(matcher, cache, path, filetype, true, NULL);
 }
 
+int csync_excluded_no_ctx_cache_lookup(const csync_exclude_matcher_t *matcher, const csync_exclude_cache_t *cache,
+                                       const char *path, int filetype, CSYNC_EXCLUDE_TYPE *match) {
+  int lookup = 0;
+  CSYNC_EXCLUDE_TYPE type;
+
+  /* the cache is not modified with lookup set */
+  type = _csync_excluded_common(matcher, (csync_exclude_cache_t *) cache, path, filetype, true, &lookup);
+  if (lookup >= 0) {
+    *match = type;
+  }
+  return lookup;
+}
@@ -21,6 +21,8 @@
 #ifndef _CSYNC_EXCLUDE_H
 #define _CSYNC_EXCLUDE_H
 
+#include <stdint.h>
+
 enum csync_exclude_type_e {
   CSYNC_NOT_EXCLUDED   = 0,
   CSYNC_FILE_SILENTLY_EXCLUDED,
@@ -33,6 +35,16 @@ enum csync_exclude_type_e {
 };
 typedef enum csync_exclude_type_e CSYNC_EXCLUDE_TYPE;
 
+/**
+ * An exclude list prepared for matching, see csync_exclude_compile().
+ */
+typedef struct csync_exclude_matcher_s csync_exclude_matcher_t;
+
+/**
+ * Results for directories, see csync_excluded_no_ctx_cached().
+ */
+typedef struct csync_exclude_cache_s csync_exclude_cache_t;
+
 #ifdef NDEBUG
 int _csync_exclude_add(c_strlist_t **inList, const char *string);
 #endif
@@ -103,6 +115,101 @@ CSYNC_EXCLUDE_TYPE csync_excluded_traversal(c_strlist_t *excludes, const char *p
  * @return
  */
 CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx(c_strlist_t *excludes, const char *path, int filetype);
+
+/**
+ * @brief Compile an exclude list for matching many paths.
+ *
+ * The functions taking the list as c_strlist_t loop over the patterns instead,
+ * for the occasional check compiling the list would cost more.
+ * The matcher sorts the literal, prefix and suffix patterns into tries, so a
+ * path is checked against all of them in one pass, and only the remaining
+ * globs go through fnmatch. The result is the same.
+ *
+ * The matcher is a copy: later changes to the list don't affect it. It is
+ * not modified by the checks and can be used from several threads.
+ *
+ * @param excludes  The exclude list, may be NULL.
+ * @param matcher   The pointer to assign the matcher to.
+ *
+ * @return  0 on success, -1 if an error occured with errno set.
+ */
+int csync_exclude_compile(c_strlist_t *excludes, csync_exclude_matcher_t **matcher);
+
+/**
+ * @brief Free a matcher from csync_exclude_compile(), may be NULL.
+ */
+void csync_exclude_matcher_free(csync_exclude_matcher_t *matcher);
+
+/**
+ * @brief Like csync_excluded_traversal(), with a compiled list (may be NULL).
+ */
+CSYNC_EXCLUDE_TYPE csync_excluded_traversal_compiled(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
+
+/**
+ * @brief Like csync_excluded_no_ctx(), with a compiled list (may be NULL).
+ */
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx_compiled(const csync_exclude_matcher_t *matcher, const char *path, int filetype);
+
+/**
+ * @brief Like csync_excluded_no_ctx_compiled(), remembering the result for
+ *        the leading directories of the path.
+ *
+ * Checking the leading directories is most of the work, and it is the same
+ * for all entries of a directory. With the cache, a directory only adds its
+ * own name to the result of its parent and the entries only check their name.
+ *
+ * The cache belongs to one matcher: clear it when using another one. It is
+ * not thread safe.
+ *
+ * @param matcher  The compiled exclude list, may be NULL.
+ * @param cache    The cache, NULL to check without it.
+ * @param path     The path to check.
+ * @param filetype The type of the path.
+ */
+CSYNC_EXCLUDE_TYPE csync_excluded_no_ctx_cached(const csync_exclude_matcher_t *matcher, csync_exclude_cache_t *cache,
+                                                const char *path, int filetype);
+
+/**
+ * @brief Like csync_excluded_no_ctx_cached(), but only reads the cache.
+ *
+ * Several threads may look up the same cache at once, as long as none of
+ * them modifies it. The hits are not counted.
+ *
+ * @param matcher  The compiled exclude list, may be NULL.
+ * @param cache    The cache, NULL to check without it.
+ * @param path     The path to check.
+ * @param filetype The type of the path.
+ * @param match    Set to the result unless -1 is returned.
+ *
+ * @return 1 if the leading directories were found in the cache, 0 if the
+ *         cache was not needed and -1 if they were not cached: use
+ *         csync_excluded_no_ctx_cached() then.
+ */
+int csync_excluded_no_ctx_cache_lookup(const csync_exclude_matcher_t *matcher, const csync_exclude_cache_t *cache,
+                                       const char *path, int filetype, CSYNC_EXCLUDE_TYPE *match);
+
+/**
+ * @brief Create an empty cache for csync_excluded_no_ctx_cached().
+ *
+ * @return The cache, NULL if insufficient memory was available.
+ */
+csync_exclude_cache_t *csync_exclude_cache_new(void);
+
+/**
+ * @brief Forget all directories, the counters are kept.
+ */
+void csync_exclude_cache_clear(csync_exclude_cache_t *cache);
+
+/**
+ * @brief Free a cache, may be NULL.
+ */
+void csync_exclude_cache_free(csync_exclude_cache_t *cache);
+
+/**
+ * @brief Get how many directory lookups were answered from the cache (hits)
+ *        and how many had to be computed (misses).
+ */
+void csync_exclude_cache_stats(const csync_exclude_cache_t *cache, uint64_t *hits, uint64_t *misses);
 #endif /* _CSYNC_EXCLUDE_H */
 
 /**
@@ -0,0 +1,398 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+extern "C" {
+#include "csync_private.h"
+#include "csync_exclude.h"
+#include "vio/csync_vio_local.h"
+
+#define CSYNC_LOG_CATEGORY_NAME "csync.local_walker"
+#include "csync_log.h"
+}
+
+#include "csync_local_walker.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* How many finished but not yet consumed listings the workers may keep around
+ * before they stop picking up new directories. Bounds the memory used for
+ * read-ahead on huge trees. */
+static const size_t MAX_READY_LISTINGS = 4096;
+
+namespace {
+
+struct Entry {
+    csync_vio_file_stat_t *st;
+    int stat_errno; /* 0 if the stat succeeded */
+};
+
+struct Listing {
+    enum State { Queued, Running, Done };
+    State state;
+    bool orphaned; /* nobody will ever open it, the worker deletes it when done */
+    int opendir_errno;
+    std::vector<Entry> entries;
+
+    Listing() : state(Queued), orphaned(false), opendir_errno(0) {}
+    ~Listing() {
+        for (size_t i = 0; i < entries.size(); ++i) {
+            csync_vio_file_stat_destroy(entries[i].st);
+        }
+    }
+};
+
+struct Handle {
+    Listing *listing;
+    size_t index;
+    std::vector<std::string> children; /* prefetched subdirectories */
+};
+
+}
+
+struct csync_local_walker_s {
+    CSYNC *ctx;
+
+    std::mutex mutex;
+    std::condition_variable work_cond;  /* new work queued or stopping */
+    std::condition_variable done_cond;  /* a listing reached the Done state */
+
+    std::map<std::string, Listing *> listings;
+    std::vector<std::string> queue; /* used as a stack: depth first like csync_ftw */
+    size_t ready;
+    bool stopping; /* also set when the csync thread sees ctx->abort, the workers never read it */
+
+    std::vector<std::thread> threads;
+
+    /* Only touched from the csync thread */
+    csync_vio_file_stat_t *last_entry;
+    int last_stat_errno;
+
+    /* csync logging is thread local, forward it to the workers */
+    int log_level;
+    csync_log_callback log_callback;
+    void *log_userdata;
+
+    csync_local_walker_s() : ctx(0), ready(0), stopping(false), last_entry(0), last_stat_errno(0),
+        log_level(0), log_callback(0), log_userdata(0) {}
+
+    /* Read a whole directory and stat every entry. Runs without the lock held. */
+    static void readDirectory(const std::string &path, Listing *listing) {
+        csync_vio_handle_t *dh = csync_vio_local_opendir(path.c_str());
+        if (!dh) {
+            listing->opendir_errno = errno ? errno : EIO;
+            return;
+        }
+
+        csync_vio_file_stat_t *dirent = NULL;
+        errno = 0;
+        while ((dirent = csync_vio_local_readdir(dh))) {
+            const char *d_name = dirent->name;
+            Entry entry = { dirent, 0 };
+
+            if (d_name == NULL) {
+                /* conversion error, csync_ftw() reports it */
+                listing->entries.push_back(entry);
+                continue;
+            }
+            if ((d_name[0] == '.' && d_name[1] == '\0')
+                    || (d_name[0] == '.' && d_name[1] == '.' && d_name[2] == '\0')) {
+                csync_vio_file_stat_destroy(dirent);
+                continue;
+            }
+
+            std::string filename = path + '/' + d_name;
+            if (csync_vio_local_stat_dirent(dh, filename.c_str(), dirent) < 0) {
+                entry.stat_errno = errno ? errno : EIO;
+            }
+            listing->entries.push_back(entry);
+        }
+        csync_vio_local_closedir(dh);
+    }
+
+    void workerMain() {
+        csync_set_log_level(log_level);
+        csync_set_log_callback(log_callback);
+        csync_set_log_userdata(log_userdata);
+
+        processQueue();
+
+#ifdef WITH_ICONV
+        /* the conversion descriptors are thread local too */
+        c_close_iconv();
+#endif
+    }
+
+    void processQueue() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            while (!stopping && (queue.empty() || ready >= MAX_READY_LISTINGS)) {
+                work_cond.wait(lock);
+            }
+            if (stopping) {
+                return;
+            }
+
+            std::string path = queue.back();
+            queue.pop_back();
+            std::map<std::string, Listing *>::iterator it = listings.find(path);
+            if (it == listings.end() || it->second->state != Listing::Queued) {
+                continue;
+            }
+            Listing *listing = it->second;
+            listing->state = Listing::Running;
+
+            lock.unlock();
+            readDirectory(path, listing);
+            lock.lock();
+
+            listing->state = Listing::Done;
+            if (listing->orphaned) {
+                listings.erase(path);
+                delete listing;
+            } else {
+                ++ready;
+                done_cond.notify_all();
+            }
+        }
+    }
+
+    /* Queue the subdirectories of a listing that csync_ftw() will descend into.
+     * Called from the csync thread without the lock held: the exclude matching and
+     * the discovery hook run while the workers keep reading. */
+    void queueChildren(const std::string &path, Handle *handle) {
+        const char *relative = path.c_str();
+        size_t uriLen = ctx->local.uri ? strlen(ctx->local.uri) : 0;
+        if (uriLen && path.compare(0, uriLen, ctx->local.uri) == 0) {
+            relative += uriLen;
+            if (*relative == '/') {
+                ++relative;
+            }
+        }
+
+        /* in reverse order so the workers start with the entry csync_ftw() needs first */
+        std::vector<std::string> children;
+        for (size_t i = handle->listing->entries.size(); i > 0; --i) {
+            const Entry &entry = handle->listing->entries[i - 1];
+            if (entry.stat_errno != 0 || !entry.st->name
+                    || entry.st->type != CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+                continue;
+            }
+            if (ctx->ignore_hidden_files && entry.st->name[0] == '.') {
+                continue;
+            }
+            std::string childRelative = *relative ? std::string(relative) + '/' + entry.st->name
+                                                  : std::string(entry.st->name);
+            if (csync_excluded_traversal_compiled(ctx->exclude_matcher, childRelative.c_str(), CSYNC_FTW_TYPE_DIR) != CSYNC_NOT_EXCLUDED) {
+                /* csync_ftw() will not descend, don't waste I/O on it */
+                continue;
+            }
+            if (ctx->callbacks.checkLocalDiscoveryHook
+                    && !ctx->callbacks.checkLocalDiscoveryHook(ctx->callbacks.update_callback_userdata, childRelative.c_str())) {
+                /* most likely restored from the db */
+                continue;
+            }
+
+            children.push_back(path + '/' + entry.st->name);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ctx->abort) {
+            stopping = true;
+        }
+        if (!stopping) {
+            for (size_t i = 0; i < children.size(); ++i) {
+                if (listings.count(children[i])) {
+                    continue;
+                }
+                listings[children[i]] = new Listing;
+                queue.push_back(children[i]);
+                handle->children.push_back(children[i]);
+            }
+        }
+        work_cond.notify_all();
+    }
+
+    /* Drop read-ahead for subdirectories csync_ftw() decided not to enter.
+     * Called with the lock held. */
+    void dropChildren(Handle *handle) {
+        for (size_t i = 0; i < handle->children.size(); ++i) {
+            std::map<std::string, Listing *>::iterator it = listings.find(handle->children[i]);
+            if (it == listings.end()) {
+                continue; /* was opened */
+            }
+            Listing *listing = it->second;
+            switch (listing->state) {
+            case Listing::Running:
+                listing->orphaned = true;
+                break;
+            case Listing::Done:
+                --ready;
+                work_cond.notify_all();
+                /* fall through */
+            case Listing::Queued:
+                /* the stale queue entry is skipped by the workers */
+                listings.erase(it);
+                delete listing;
+                break;
+            }
+        }
+    }
+};
+
+extern "C" {
+
+csync_local_walker_t *csync_local_walker_create(CSYNC *ctx, int threads)
+{
+    csync_local_walker_t *walker = new csync_local_walker_s;
+    walker->ctx = ctx;
+    walker->log_level = csync_get_log_level();
+    walker->log_callback = csync_get_log_callback();
+    walker->log_userdata = csync_get_log_userdata();
+
+    for (int i = 0; i < threads; ++i) {
+        walker->threads.push_back(std::thread(&csync_local_walker_s::workerMain, walker));
+    }
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Local discovery uses %d threads", threads);
+    return walker;
+}
+
+void csync_local_walker_destroy(csync_local_walker_t *walker)
+{
+    if (!walker) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(walker->mutex);
+        walker->stopping = true;
+        walker->work_cond.notify_all();
+    }
+    for (size_t i = 0; i < walker->threads.size(); ++i) {
+        walker->threads[i].join();
+    }
+    for (std::map<std::string, Listing *>::iterator it = walker->listings.begin();
+            it != walker->listings.end(); ++it) {
+        delete it->second;
+    }
+    delete walker;
+}
+
+csync_vio_handle_t *csync_local_walker_opendir(csync_local_walker_t *walker, const char *name)
+{
+    const std::string path(name);
+    Listing *listing = 0;
+
+    std::unique_lock<std::mutex> lock(walker->mutex);
+    std::map<std::string, Listing *>::iterator it = walker->listings.find(path);
+    if (it == walker->listings.end() || it->second->state == Listing::Queued) {
+        /* Nobody is working on it yet: do it ourselves instead of waiting */
+        if (it == walker->listings.end()) {
+            listing = new Listing;
+            walker->listings[path] = listing;
+        } else {
+            listing = it->second;
+        }
+        listing->state = Listing::Running;
+        lock.unlock();
+        csync_local_walker_s::readDirectory(path, listing);
+        lock.lock();
+        listing->state = Listing::Done;
+    } else {
+        listing = it->second;
+        while (listing->state != Listing::Done) {
+            walker->done_cond.wait(lock);
+        }
+        --walker->ready;
+        walker->work_cond.notify_all();
+    }
+    walker->listings.erase(path);
+    lock.unlock();
+
+    if (listing->opendir_errno != 0) {
+        int err = listing->opendir_errno;
+        delete listing;
+        errno = err;
+        return NULL;
+    }
+
+    Handle *handle = new Handle;
+    handle->listing = listing;
+    handle->index = 0;
+    walker->queueChildren(path, handle);
+
+    return reinterpret_cast<csync_vio_handle_t *>(handle);
+}
+
+csync_vio_file_stat_t *csync_local_walker_readdir(csync_local_walker_t *walker, csync_vio_handle_t *dhandle)
+{
+    Handle *handle = reinterpret_cast<Handle *>(dhandle);
+    if (handle->index >= handle->listing->entries.size()) {
+        walker->last_entry = 0;
+        return NULL;
+    }
+
+    /* ownership goes to the caller, who destroys it like a csync_vio_local_readdir() result */
+    Entry &entry = handle->listing->entries[handle->index++];
+    csync_vio_file_stat_t *st = entry.st;
+    entry.st = 0;
+
+    walker->last_entry = st;
+    walker->last_stat_errno = entry.stat_errno;
+    return st;
+}
+
+int csync_local_walker_closedir(csync_local_walker_t *walker, csync_vio_handle_t *dhandle)
+{
+    Handle *handle = reinterpret_cast<Handle *>(dhandle);
+    if (!handle) {
+        errno = EBADF;
+        return -1;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(walker->mutex);
+        walker->dropChildren(handle);
+    }
+    walker->last_entry = 0;
+    delete handle->listing;
+    delete handle;
+    return 0;
+}
+
+int csync_local_walker_stat(csync_local_walker_t *walker, const char *uri, csync_vio_file_stat_t *buf)
+{
+    if (!buf || buf != walker->last_entry) {
+        return csync_vio_local_stat(uri, buf);
+    }
+    if (walker->last_stat_errno != 0) {
+        errno = walker->last_stat_errno;
+        return -1;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,60 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include "csync.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Parallel local directory reader used by csync_ftw().
+ *
+ * The update phase itself stays single threaded: csync_ftw() visits the
+ * directories in the same depth-first order and calls _csync_detect_update()
+ * exactly as without the walker, so the resulting tree is identical.
+ * What runs in the worker pool is the I/O: opendir/readdir and one stat()
+ * per entry. Whenever a directory listing is handed to csync_ftw(), its
+ * subdirectories are queued so the workers can list them ahead of time.
+ *
+ * A directory that is requested but not yet picked up by a worker is read
+ * by the calling thread itself, so csync_ftw() only ever waits on listings
+ * that are already in progress.
+ */
+typedef struct csync_local_walker_s csync_local_walker_t;
+
+/* Create a walker with the given number of worker threads (must be > 1). */
+csync_local_walker_t *csync_local_walker_create(CSYNC *ctx, int threads);
+void csync_local_walker_destroy(csync_local_walker_t *walker);
+
+csync_vio_handle_t *csync_local_walker_opendir(csync_local_walker_t *walker, const char *name);
+csync_vio_file_stat_t *csync_local_walker_readdir(csync_local_walker_t *walker, csync_vio_handle_t *dhandle);
+int csync_local_walker_closedir(csync_local_walker_t *walker, csync_vio_handle_t *dhandle);
+
+/* Returns the result of the stat() done by the worker for the entry last
+ * returned by csync_local_walker_readdir(). Falls back to a real stat for
+ * anything else. */
+int csync_local_walker_stat(csync_local_walker_t *walker, const char *uri, csync_vio_file_stat_t *buf);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,65 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+extern "C" {
+#include "csync_private.h"
+#include "csync_log.h"
+}
+
+#include "csync_parallel.h"
+
+#include <thread>
+#include <vector>
+
+static void _runThread(int log_level, csync_log_callback log_callback, void *log_userdata,
+                       csync_parallel_func func, void *data, int index)
+{
+    /* csync logging is thread local */
+    csync_set_log_level(log_level);
+    csync_set_log_callback(log_callback);
+    csync_set_log_userdata(log_userdata);
+
+    func(data, index);
+
+#ifdef WITH_ICONV
+    /* the conversion descriptors are thread local too */
+    c_close_iconv();
+#endif
+}
+
+extern "C" {
+
+void csync_parallel_run(int count, csync_parallel_func func, void *data)
+{
+    std::vector<std::thread> threads;
+
+    for (int i = 1; i < count; ++i) {
+        threads.push_back(std::thread(_runThread, csync_get_log_level(), csync_get_log_callback(),
+                                      csync_get_log_userdata(), func, data, i));
+    }
+    if (count > 0) {
+        func(data, 0);
+    }
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*csync_parallel_func)(void *data, int index);
+
+/*
+ * Call func(data, index) for every index from 0 to count - 1, each in its own
+ * thread, and return once all of them are done. Index 0 runs in the calling
+ * thread. The other threads log with the settings of the calling thread.
+ */
+void csync_parallel_run(int count, csync_parallel_func func, void *data);
+
+#ifdef __cplusplus
+}
+#endif
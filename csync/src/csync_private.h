@@ -76,6 +76,9 @@ enum csync_replica_e {
 };
 
 typedef struct csync_file_stat_s csync_file_stat_t;
+typedef struct csync_statedb_snapshot_s csync_statedb_snapshot_t;
+struct csync_local_walker_s;
+struct csync_exclude_matcher_s;
 
 /**
  * @brief csync public structure
@@ -91,6 +94,12 @@ struct csync_s {
       int (*checkSelectiveSyncBlackListHook)(void*, const char*);
       int (*checkSelectiveSyncNewFolderHook)(void*, const char*);
 
+      /* hook telling whether a local directory needs to be read from the file system.
+       * If it returns 0 for a directory that is unchanged in the db, its content is
+       * restored from the db instead. If not set, the whole local tree is read.
+       * (uses the update_callback_userdata) */
+      int (*checkLocalDiscoveryHook)(void*, const char*);
+
 
       csync_vio_opendir_hook remote_opendir_hook;
       csync_vio_readdir_hook remote_readdir_hook;
@@ -103,6 +112,7 @@ struct csync_s {
 
   } callbacks;
   c_strlist_t *excludes;
+  struct csync_exclude_matcher_s *exclude_matcher; /* excludes compiled for the update phase */
 
   // needed for SSL client certificate support
   struct csync_client_certs_s *clientCerts;
@@ -116,23 +126,33 @@ struct csync_s {
     sqlite3_stmt* by_fileid_stmt;
     sqlite3_stmt* by_inode_stmt;
 
+    /* in-memory copy of the metadata table for the update and reconcile phase */
+    csync_statedb_snapshot_t *snapshot;
+
     int lastReturnValue;
+    int query_count; /* statements run, for the performance report of the SyncEngine */
   } statedb;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_htable_t *tree; /* file stats by phash */
     enum csync_replica_e type;
+    int  read_from_db;
+    struct csync_local_walker_s *walker; /* only set during the local update phase */
   } local;
 
   struct {
     char *uri;
-    c_rbtree_t *tree;
+    c_htable_t *tree; /* file stats by phash */
     enum csync_replica_e type;
     int  read_from_db;
     const char *root_perms; /* Permission of the root folder. (Since the root folder is not in the db tree, we need to keep a separate entry.) */
   } remote;
 
+  /* Memory of the file stats in the trees and of their strings. It is released
+   * all at once with the trees, see csync_file_stat_new(). */
+  c_arena_t *arena;
+
 
 #if defined(HAVE_ICONV) && defined(WITH_ICONV)
   struct {
@@ -171,6 +191,24 @@ struct csync_s {
   bool db_is_empty;
 
   bool ignore_hidden_files;
+
+  /**
+   * Number of threads used to read the local tree in the update phase.
+   * 0 or 1 reads it from the csync thread only (default).
+   */
+  int local_discovery_threads;
+
+  /**
+   * Number of threads used to reconcile big trees, 0 or 1 reconciles them in
+   * the csync thread only (default).
+   */
+  int reconcile_threads;
+
+  /**
+   * If true, a new local file whose size and content checksum match a file that
+   * disappeared locally is moved on the server instead of uploaded.
+   */
+  bool checksum_move_detection;
 };
 
 
@@ -189,6 +227,8 @@ struct csync_file_stat_s {
   unsigned int should_update_metadata : 1; /*specify that the etag, or the remote perm or fileid has
                                 changed and need to be updated on the db even for INSTRUCTION_NONE */
   unsigned int has_ignored_files      : 1; /* specify that a directory, or child directory contains ignored files */
+  unsigned int content_from_db        : 1; /* local directory whose content was restored from the db
+                                              instead of being read from the file system */
 
   char *destpath;   /* for renames */
   const char *etag;
@@ -213,6 +253,19 @@ __attribute__ ((packed))
 #endif
 ;
 
+/*
+ * Allocate a zeroed file stat with room for a path of pathlen bytes for the trees.
+ * It lives in ctx->arena until csync_commit(): never free it, and only store
+ * strings from csync_arena_strdup() in it.
+ */
+csync_file_stat_t *csync_file_stat_new(CSYNC *ctx, size_t pathlen);
+
+/* Copy a file stat returned by a statedb lookup, including its strings, into the arena */
+csync_file_stat_t *csync_file_stat_copy(CSYNC *ctx, const csync_file_stat_t *st);
+
+char *csync_arena_strdup(CSYNC *ctx, const char *str);
+
+/* Free a file stat that was allocated with c_malloc, e.g. by a statedb lookup */
 void csync_file_stat_free(csync_file_stat_t *st);
 
 /*
@@ -25,18 +25,77 @@
 #include "csync_util.h"
 #include "csync_statedb.h"
 #include "csync_rename.h"
+#include "csync_parallel.h"
 #include "c_jhash.h"
+#include "vio/csync_vio_local.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.reconciler"
 #include "csync_log.h"
 
 #include "inttypes.h"
+#include <errno.h>
+#include <stdio.h>
+
+/* Check if a local directory whose content was restored from the db in the
+ * update phase contains anything that is not part of the local tree, ie. ignored
+ * files or changes that were not reported. Those must not be deleted with it.
+ * Errors count as untracked content so the directory is kept. */
+static bool _csync_local_dir_has_untracked_files(CSYNC *ctx, const char *path) {
+    char *uri = NULL;
+    csync_vio_handle_t *dh = NULL;
+    csync_vio_file_stat_t *dirent = NULL;
+    bool untracked = false;
+
+    if (asprintf(&uri, "%s/%s", ctx->local.uri, path) < 0) {
+        return true;
+    }
+    dh = csync_vio_local_opendir(uri);
+    SAFE_FREE(uri);
+    if (dh == NULL) {
+        return errno != ENOENT;
+    }
+
+    while (!untracked && (dirent = csync_vio_local_readdir(dh)) != NULL) {
+        const char *name = dirent->name;
+        char *child = NULL;
+        csync_file_stat_t *st = NULL;
+        uint64_t h = 0;
+
+        if (name == NULL) {
+            untracked = true;
+        } else if (c_streq(name, ".") || c_streq(name, "..")) {
+            /* skip */
+        } else if (asprintf(&child, "%s/%s", path, name) < 0) {
+            untracked = true;
+        } else {
+            h = c_jhash64((uint8_t *) child, strlen(child), 0);
+            st = c_htable_find(ctx->local.tree, h);
+            if (st == NULL) {
+                untracked = true;
+            } else {
+                untracked = st->instruction == CSYNC_INSTRUCTION_IGNORE
+                        || (st->type == CSYNC_FTW_TYPE_DIR
+                            && _csync_local_dir_has_untracked_files(ctx, child));
+            }
+            SAFE_FREE(child);
+        }
+        csync_vio_file_stat_destroy(dirent);
+    }
+    csync_vio_local_closedir(dh);
+
+    if (untracked) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "%s has untracked files", path);
+    }
+    return untracked;
+}
 
 /* Check if a file is ignored because one parent is ignored.
- * return the node of the ignored directoy if it's the case, or NULL if it is not ignored */
-static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int pathlen) {
+ * return the file stat of the ignored directoy if it's the case, or NULL if it is not ignored
+ * ignored: the ignored entries of tree, if other threads may change the instructions in tree */
+static csync_file_stat_t *_csync_check_ignored(c_htable_t *tree, c_htable_t *ignored,
+                                               const char *path, int pathlen) {
     uint64_t h = 0;
-    c_rbnode_t *node = NULL;
+    csync_file_stat_t *n = NULL;
 
     /* compute the size of the parent directory */
     int parentlen = pathlen - 1;
@@ -48,20 +107,63 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
     }
 
     h = c_jhash64((uint8_t *) path, parentlen, 0);
-    node = c_rbtree_find(tree, &h);
-    if (node) {
-        csync_file_stat_t *n = (csync_file_stat_t*)node->data;
+    n = c_htable_find(tree, h);
+    if (n && ignored) {
+        return c_htable_find(ignored, h);
+    } else if (n) {
         if (n->instruction == CSYNC_INSTRUCTION_IGNORE) {
             /* Yes, we are ignored */
-            return node;
+            return n;
         } else {
             /* Not ignored */
             return NULL;
         }
     } else {
         /* Try if the parent itself is ignored */
-        return _csync_check_ignored(tree, path, parentlen);
+        return _csync_check_ignored(tree, ignored, path, parentlen);
+    }
+}
+
+/*
+ * Find the path hash of the file that cur was renamed from: the journal entry
+ * with the same inode (local) or file id (remote). Returns false if there is none.
+ */
+static bool _csync_rename_origin(CSYNC *ctx, csync_file_stat_t *cur, uint64_t *phash) {
+    csync_file_stat_t *tmp = NULL;
+    int rc = -1;
+    size_t len;
+
+    if (ctx->current == LOCAL_REPLICA) {
+        /* use the old name to find the "other" node */
+        rc = csync_statedb_get_phash_by_inode(ctx, cur->inode, phash);
+        if (rc < 0) {
+            tmp = csync_statedb_get_stat_by_inode(ctx, cur->inode);
+        }
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Finding opposite temp through inode %" PRIu64 ": %s",
+                  cur->inode, (rc > 0 || tmp) ? "true":"false");
+    } else if (ctx->current == REMOTE_REPLICA) {
+        rc = csync_statedb_get_phash_by_file_id(ctx, cur->file_id, phash);
+        if (rc < 0) {
+            tmp = csync_statedb_get_stat_by_file_id(ctx, cur->file_id);
+        }
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Finding opposite temp through file ID %s: %s",
+                  cur->file_id, (rc > 0 || tmp) ? "true":"false");
+    } else {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Unknown replica...");
+    }
+
+    if (rc >= 0) {
+        return rc > 0;
+    }
+
+    /* No journal snapshot, the entry came from the database */
+    if (tmp == NULL) {
+        return false;
     }
+    len = strlen(tmp->path);
+    *phash = len > 0 ? c_jhash64((uint8_t *) tmp->path, len, 0) : 0;
+    csync_file_stat_free(tmp);
+    return true;
 }
 
 /*
@@ -76,20 +178,17 @@ static c_rbnode_t *_csync_check_ignored(c_rbtree_t *tree, const char *path, int
  * file with the the source file. If the destination file is newer
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
+ *
+ * ignored is only given when the merge runs in several threads, see
+ * _csync_check_ignored().
  */
-static int _csync_merge_algorithm_visitor(void *obj, void *data) {
-    csync_file_stat_t *cur = NULL;
+static int _csync_merge_file(CSYNC *ctx, csync_file_stat_t *cur, c_htable_t *ignored) {
     csync_file_stat_t *other = NULL;
-    csync_file_stat_t *tmp = NULL;
     uint64_t h = 0;
     int len = 0;
 
-    CSYNC *ctx = NULL;
-    c_rbtree_t *tree = NULL;
-    c_rbnode_t *node = NULL;
-
-    cur = (csync_file_stat_t *) obj;
-    ctx = (CSYNC *) data;
+    c_htable_t *tree = NULL;
+    csync_file_stat_t *node = NULL;
 
     /* we need the opposite tree! */
     switch (ctx->current) {
@@ -103,21 +202,21 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         break;
     }
 
-    node = c_rbtree_find(tree, &cur->phash);
+    node = c_htable_find(tree, cur->phash);
 
     if (!node) {
         /* Check the renamed path as well. */
         char *renamed_path = csync_rename_adjust_path(ctx, cur->path);
-        if (!c_streq(renamed_path, cur->path)) {
+        if (renamed_path) {
             len = strlen( renamed_path );
             h = c_jhash64((uint8_t *) renamed_path, len, 0);
-            node = c_rbtree_find(tree, &h);
+            node = c_htable_find(tree, h);
+            SAFE_FREE(renamed_path);
         }
-        SAFE_FREE(renamed_path);
     }
     if (!node) {
         /* Check if it is ignored */
-        node = _csync_check_ignored(tree, cur->path, cur->pathlen);
+        node = _csync_check_ignored(tree, ignored, cur->path, cur->pathlen);
         /* If it is ignored, other->instruction will be  IGNORE so this one will also be ignored */
     }
 
@@ -130,6 +229,10 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
             break;
             /* file has been removed on the opposite replica */
         case CSYNC_INSTRUCTION_NONE:
+            if (cur->content_from_db && !cur->has_ignored_files
+                    && _csync_local_dir_has_untracked_files(ctx, cur->path)) {
+                cur->has_ignored_files = true;
+            }
             if (cur->has_ignored_files) {
                 /* Do not remove a directory that has ignored files */
                 break;
@@ -142,34 +245,19 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
             cur->instruction = CSYNC_INSTRUCTION_REMOVE;
             break;
         case CSYNC_INSTRUCTION_EVAL_RENAME:
-            if(ctx->current == LOCAL_REPLICA ) {
-                /* use the old name to find the "other" node */
-                tmp = csync_statedb_get_stat_by_inode(ctx, cur->inode);
-                CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Finding opposite temp through inode %" PRIu64 ": %s",
-                          cur->inode, tmp ? "true":"false");
-            } else if( ctx->current == REMOTE_REPLICA ) {
-                tmp = csync_statedb_get_stat_by_file_id(ctx, cur->file_id);
-                CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Finding opposite temp through file ID %s: %s",
-                          cur->file_id, tmp ? "true":"false");
-            } else {
-                CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Unknown replica...");
-            }
-
-            if( tmp ) {
-                len = strlen( tmp->path );
-                if( len > 0 ) {
-                    h = c_jhash64((uint8_t *) tmp->path, len, 0);
+            if (_csync_rename_origin(ctx, cur, &h)) {
+                if( h != 0 ) {
                     /* First, check that the file is NOT in our tree (another file with the same name was added) */
-                    node = c_rbtree_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, &h);
+                    node = c_htable_find(ctx->current == REMOTE_REPLICA ? ctx->remote.tree : ctx->local.tree, h);
                     if (node) {
-                        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Origin found in our tree : %s", tmp->path);
+                        CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Origin found in our tree : %s", node->path);
                     } else {
                         /* Find the temporar file in the other tree. */
-                        node = c_rbtree_find(tree, &h);
+                        node = c_htable_find(tree, h);
                         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "PHash of temporary opposite (%s): %" PRIu64 " %s",
-                                tmp->path , h, node ? "found": "not found" );
+                                node ? node->path : "", h, node ? "found": "not found" );
                         if (node) {
-                            other = (csync_file_stat_t*)node->data;
+                            other = node;
                         } else {
                             /* the renamed file could not be found in the opposite tree. That is because it
                             * is not longer existing there, maybe because it was renamed or deleted.
@@ -190,7 +278,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                 } else if (other->instruction == CSYNC_INSTRUCTION_NONE
                            || cur->type == CSYNC_FTW_TYPE_DIR) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = csync_arena_strdup( ctx, cur->path );
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
                     }
@@ -199,7 +287,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                     cur->instruction = CSYNC_INSTRUCTION_NONE;
                 } else if (other->instruction == CSYNC_INSTRUCTION_REMOVE) {
                     other->instruction = CSYNC_INSTRUCTION_RENAME;
-                    other->destpath = c_strdup( cur->path );
+                    other->destpath = csync_arena_strdup( ctx, cur->path );
 
                     if( !c_streq(cur->file_id, "") ) {
                         csync_vio_set_file_id( other->file_id, cur->file_id );
@@ -214,7 +302,6 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
                     cur->instruction = CSYNC_INSTRUCTION_NONE;
                     other->instruction = CSYNC_INSTRUCTION_SYNC;
                 }
-                csync_file_stat_free(tmp);
            }
 
             break;
@@ -226,7 +313,7 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
         /*
      * file found on the other replica
      */
-        other = (csync_file_stat_t *) node->data;
+        other = node;
 
         switch (cur->instruction) {
         case CSYNC_INSTRUCTION_EVAL_RENAME:
@@ -341,22 +428,250 @@ static int _csync_merge_algorithm_visitor(void *obj, void *data) {
     return 0;
 }
 
+static int _csync_merge_algorithm_visitor(void *obj, void *data) {
+    return _csync_merge_file((CSYNC *) data, (csync_file_stat_t *) obj, NULL);
+}
+
+/*
+ * Find the file that the new local file cur was moved from by its content: a
+ * journal entry of the same size and checksum whose file is gone locally and
+ * unchanged on the server. This catches the moves that did not keep the inode,
+ * like the ones across file systems or by tools that copy and delete.
+ */
+static csync_file_stat_t *_csync_checksum_move_origin(CSYNC *ctx, csync_file_stat_t *cur) {
+    const csync_statedb_checksum_row_t *rows = NULL;
+    csync_file_stat_t *origin = NULL;
+    char *checksum = NULL;
+    uint32_t checksumTypeId = 0;
+    int count;
+    int i;
+
+    count = csync_statedb_get_checksums_by_size(ctx, cur->size, &rows);
+    for (i = 0; i < count && origin == NULL; i++) {
+        csync_file_stat_t *other = c_htable_find(ctx->remote.tree, rows[i].phash);
+        if (other == NULL || other->instruction != CSYNC_INSTRUCTION_NONE
+                || other->type != CSYNC_FTW_TYPE_FILE
+                || c_htable_find(ctx->local.tree, rows[i].phash) != NULL) {
+            continue;
+        }
+
+        /* only compute the checksum if there is a candidate, and only once per type */
+        if (checksum == NULL || checksumTypeId != rows[i].checksumTypeId) {
+            char *uri = NULL;
+            SAFE_FREE(checksum);
+            checksumTypeId = rows[i].checksumTypeId;
+            if (asprintf(&uri, "%s/%s", ctx->local.uri, cur->path) < 0) {
+                break;
+            }
+            checksum = (char *) ctx->callbacks.checksum_hook(uri, checksumTypeId,
+                                                              ctx->callbacks.checksum_userdata);
+            SAFE_FREE(uri);
+            if (checksum == NULL) {
+                break;
+            }
+        }
+        if (c_streq(checksum, rows[i].checksum)) {
+            CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Move detected by checksum: %s -> %s", other->path, cur->path);
+            origin = other;
+        }
+    }
+
+    SAFE_FREE(checksum);
+    return origin;
+}
+
+/* Whether a parent directory of path was renamed, without building the new path */
+static bool _csync_in_renamed_dir(CSYNC *ctx, const char *path) {
+    const csync_rename_trie_t *renames = csync_rename_trie_renamed_to(ctx);
+    size_t prefixlen = 0;
+
+    return renames != NULL && csync_rename_trie_find(renames, path, &prefixlen) != NULL;
+}
+
+/*
+ * Second pass over the local tree: turn the new files that are left after the
+ * merge into moves of the file they were copied from, if any. This runs after
+ * the inode based renames have claimed their origin.
+ */
+static int _csync_checksum_move_visitor(void *obj, void *data) {
+    csync_file_stat_t *cur = (csync_file_stat_t *) obj;
+    CSYNC *ctx = (CSYNC *) data;
+    csync_file_stat_t *other = NULL;
+
+    if (cur->instruction != CSYNC_INSTRUCTION_NEW || cur->type != CSYNC_FTW_TYPE_FILE
+            || cur->size <= 0 || c_htable_find(ctx->remote.tree, cur->phash) != NULL) {
+        return 0;
+    }
+    /* files in renamed directories are matched by their path */
+    if (_csync_in_renamed_dir(ctx, cur->path)) {
+        return 0;
+    }
+
+    other = _csync_checksum_move_origin(ctx, cur);
+    if (other) {
+        other->instruction = CSYNC_INSTRUCTION_RENAME;
+        other->destpath = csync_arena_strdup( ctx, cur->path );
+        other->inode = cur->inode;
+        other->should_update_metadata = true;
+        cur->instruction = CSYNC_INSTRUCTION_NONE;
+    }
+    return 0;
+}
+
+/* Below this many files per thread the threads cost more than they save */
+#define RECONCILE_MIN_FILES_PER_THREAD 5000
+
+/*
+ * The merge of most files only changes the file and the node with the same path
+ * in the other tree, so these can be merged in parallel. The files that look up
+ * other paths, the database or allocate in the arena are merged afterwards by
+ * the calling thread: renames, files in renamed directories and directories
+ * that were restored from the db, which check the state of their children.
+ *
+ * A file that is only in one tree also reads the instruction of its parent in
+ * the other tree, which the thread merging the parent may change. These reads
+ * go to the ignored entries of the other tree, collected before the threads start.
+ */
+static bool _csync_merge_needs_serial(CSYNC *ctx, csync_file_stat_t *cur) {
+    return cur->instruction == CSYNC_INSTRUCTION_EVAL_RENAME || cur->content_from_db
+            || _csync_in_renamed_dir(ctx, cur->path);
+}
+
+struct _csync_reconcile_work_s {
+    CSYNC *ctx;
+    csync_file_stat_t **files;
+    size_t count;
+    size_t parallel_count; /* files[0 .. parallel_count) are merged in parallel */
+    size_t serial_begin;   /* files[serial_begin .. count) by the calling thread */
+    int threads;
+    int *rc;               /* result of each thread */
+    c_htable_t *ignored;   /* the entries of the other tree that are ignored */
+};
+
+static int _csync_reconcile_collect_visitor(void *obj, void *data) {
+    csync_file_stat_t *cur = (csync_file_stat_t *) obj;
+    struct _csync_reconcile_work_s *work = (struct _csync_reconcile_work_s *) data;
+
+    if (_csync_merge_needs_serial(work->ctx, cur)) {
+        work->files[--work->serial_begin] = cur;
+    } else {
+        work->files[work->parallel_count++] = cur;
+    }
+    return 0;
+}
+
+static int _csync_reconcile_ignored_visitor(void *obj, void *data) {
+    csync_file_stat_t *st = (csync_file_stat_t *) obj;
+
+    if (st->instruction == CSYNC_INSTRUCTION_IGNORE) {
+        return c_htable_insert((c_htable_t *) data, st->phash, st) < 0 ? -1 : 0;
+    }
+    return 0;
+}
+
+static void _csync_reconcile_thread(void *data, int index) {
+    struct _csync_reconcile_work_s *work = (struct _csync_reconcile_work_s *) data;
+    size_t begin = work->parallel_count * index / work->threads;
+    size_t end = work->parallel_count * (index + 1) / work->threads;
+    size_t i;
+
+    work->rc[index] = 0;
+    for (i = begin; i < end; i++) {
+        if (_csync_merge_file(work->ctx, work->files[i], work->ignored) < 0) {
+            work->rc[index] = -1;
+            return;
+        }
+    }
+}
+
+/*
+ * Merge the files of tree with several threads, each one taking a range of
+ * the files, then merge the files that need it in the calling thread.
+ */
+static int _csync_reconcile_parallel(CSYNC *ctx, c_htable_t *tree, c_htable_t *other_tree, int threads) {
+    struct _csync_reconcile_work_s work;
+    size_t i;
+    int rc = 0;
+
+    ZERO_STRUCT(work);
+    work.ctx = ctx;
+    work.count = c_htable_size(tree);
+    work.serial_begin = work.count;
+    work.threads = threads;
+    work.files = c_malloc(work.count * sizeof(csync_file_stat_t *));
+    work.rc = c_malloc(threads * sizeof(int));
+    work.ignored = c_htable_new(0);
+    if (work.files == NULL || work.rc == NULL || work.ignored == NULL) {
+        rc = -1;
+        goto out;
+    }
+
+    rc = c_htable_walk(tree, &work, _csync_reconcile_collect_visitor);
+    if (rc < 0) {
+        goto out;
+    }
+    rc = c_htable_walk(other_tree, work.ignored, _csync_reconcile_ignored_visitor);
+    if (rc < 0) {
+        goto out;
+    }
+
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Reconciling %zu files with %d threads, %zu afterwards",
+              work.parallel_count, threads, work.count - work.serial_begin);
+    csync_parallel_run(threads, _csync_reconcile_thread, &work);
+    for (i = 0; i < (size_t) threads; i++) {
+        if (work.rc[i] < 0) {
+            rc = -1;
+            goto out;
+        }
+    }
+
+    for (i = work.serial_begin; i < work.count; i++) {
+        rc = _csync_merge_algorithm_visitor(work.files[i], ctx);
+        if (rc < 0) {
+            goto out;
+        }
+    }
+
+out:
+    SAFE_FREE(work.files);
+    SAFE_FREE(work.rc);
+    c_htable_free(work.ignored);
+    return rc;
+}
+
 int csync_reconcile_updates(CSYNC *ctx) {
   int rc;
-  c_rbtree_t *tree = NULL;
+  int threads;
+  c_htable_t *tree = NULL;
+  c_htable_t *other_tree = NULL;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
       tree = ctx->local.tree;
+      other_tree = ctx->remote.tree;
       break;
     case REMOTE_REPLICA:
       tree = ctx->remote.tree;
+      other_tree = ctx->local.tree;
       break;
     default:
       break;
   }
 
-  rc = c_rbtree_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  threads = ctx->reconcile_threads;
+  if (threads > 1 && c_htable_size(tree) / threads < RECONCILE_MIN_FILES_PER_THREAD) {
+    threads = c_htable_size(tree) / RECONCILE_MIN_FILES_PER_THREAD;
+  }
+
+  if (threads > 1) {
+    rc = _csync_reconcile_parallel(ctx, tree, other_tree, threads);
+  } else {
+    rc = c_htable_walk(tree, (void *) ctx, _csync_merge_algorithm_visitor);
+  }
+  if (rc == 0 && ctx->current == LOCAL_REPLICA
+      && ctx->checksum_move_detection && ctx->callbacks.checksum_hook) {
+    rc = c_htable_walk(tree, (void *) ctx, _csync_checksum_move_visitor);
+  }
   if( rc < 0 ) {
     ctx->status_code = CSYNC_STATUS_RECONCILE_ERROR;
   }
@@ -20,18 +20,157 @@
 
 extern "C" {
 #include "csync_private.h"
+#include "csync_rename.h"
 }
 
-#include <map>
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <string.h>
 
-static std::string _parentDir(const std::string &path) {
-    int len = path.length();
-    while(len > 0 && path[len-1]!='/') len--;
-    while(len > 0 && path[len-1]=='/') len--;
-    return path.substr(0, len);
+/*
+ * Directories by path components, to find the renamed parent of a path in one
+ * walk down its components without building the parent paths.
+ */
+struct csync_rename_trie_s {
+    struct Node;
+    typedef std::pair<std::string, Node *> Child;
+
+    struct Node {
+        Node() : hasTarget(false) {}
+        ~Node() {
+            for (size_t i = 0; i < children.size(); ++i) {
+                delete children[i].second;
+            }
+        }
+
+        std::vector<Child> children; // sorted by name
+        std::string target;
+        bool hasTarget;
+
+        struct Less {
+            bool operator()(const Child &child, const std::pair<const char *, size_t> &name) const {
+                return child.first.compare(0, std::string::npos, name.first, name.second) < 0;
+            }
+        };
+
+        Node *child(const char *name, size_t len) const {
+            std::vector<Child>::const_iterator it = std::lower_bound(children.begin(), children.end(),
+                std::make_pair(name, len), Less());
+            if (it != children.end() && it->first.compare(0, std::string::npos, name, len) == 0) {
+                return it->second;
+            }
+            return 0;
+        }
+
+        Node *addChild(const char *name, size_t len) {
+            std::vector<Child>::iterator it = std::lower_bound(children.begin(), children.end(),
+                std::make_pair(name, len), Less());
+            if (it != children.end() && it->first.compare(0, std::string::npos, name, len) == 0) {
+                return it->second;
+            }
+            return children.insert(it, Child(std::string(name, len), new Node))->second;
+        }
+    };
+
+    Node root;
+    size_t size;
+
+    csync_rename_trie_s() : size(0) {}
+};
+
+/* The length of the path component at path, which is not a '/' */
+static size_t _componentLength(const char *path) {
+    const char *end = strchr(path, '/');
+    return end ? end - path : strlen(path);
+}
+
+extern "C" {
+csync_rename_trie_t *csync_rename_trie_new(void)
+{
+    return new csync_rename_trie_s;
+}
+
+void csync_rename_trie_free(csync_rename_trie_t *trie)
+{
+    delete trie;
+}
+
+int csync_rename_trie_is_empty(const csync_rename_trie_t *trie)
+{
+    return trie->size == 0;
+}
+
+void csync_rename_trie_insert(csync_rename_trie_t *trie, const char *from, const char *to)
+{
+    csync_rename_trie_s::Node *node = &trie->root;
+    const char *p = from;
+    while (*p) {
+        if (*p == '/') {
+            ++p;
+            continue;
+        }
+        size_t len = _componentLength(p);
+        node = node->addChild(p, len);
+        p += len;
+    }
+    if (node == &trie->root) {
+        return; // the root is never renamed
+    }
+    if (!node->hasTarget) {
+        trie->size++;
+    }
+    node->target = to;
+    node->hasTarget = true;
+}
+
+const char *csync_rename_trie_find(const csync_rename_trie_t *trie, const char *path, size_t *prefixlen)
+{
+    const csync_rename_trie_s::Node *node = &trie->root;
+    const char *found = NULL;
+    const char *p = path;
+
+    if (trie->size == 0) {
+        return NULL;
+    }
+    while (*p) {
+        if (*p == '/') {
+            ++p;
+            continue;
+        }
+        size_t len = _componentLength(p);
+        if (p[len] == '\0') {
+            break; // only the parents of path count
+        }
+        node = node->child(p, len);
+        if (!node) {
+            break;
+        }
+        p += len;
+        if (node->hasTarget) {
+            found = node->target.c_str();
+            *prefixlen = p - path;
+        }
+    }
+    return found;
+}
+}
+
+static char *_adjustPath(const csync_rename_trie_t *trie, const char *path)
+{
+    size_t prefixlen = 0;
+    const char *target = csync_rename_trie_find(trie, path, &prefixlen);
+    if (!target) {
+        return NULL;
+    }
+    size_t targetlen = strlen(target);
+    size_t restlen = strlen(path + prefixlen);
+    char *adjusted = (char *) c_malloc(targetlen + restlen + 1);
+    if (adjusted) {
+        memcpy(adjusted, target, targetlen);
+        memcpy(adjusted + targetlen, path + prefixlen, restlen + 1);
+    }
+    return adjusted;
 }
 
 struct csync_rename_s {
@@ -42,16 +181,8 @@ struct csync_rename_s {
         return reinterpret_cast<csync_rename_s *>(ctx->rename_info);
     }
 
-    std::map<std::string, std::string> folder_renamed_to; // map from->to
-    std::map<std::string, std::string> folder_renamed_from; // map to->from
-
-    struct renameop {
-        csync_file_stat_t *st;
-        bool operator<(const renameop &other) const {
-            return strlen(st->destpath) < strlen(other.st->destpath);
-        }
-    };
-    std::vector<renameop> todo;
+    csync_rename_trie_s folder_renamed_to; // from->to
+    csync_rename_trie_s folder_renamed_from; // to->from
 };
 
 extern "C" {
@@ -63,34 +194,32 @@ void csync_rename_destroy(CSYNC* ctx)
 
 void csync_rename_record(CSYNC* ctx, const char* from, const char* to)
 {
-    csync_rename_s::get(ctx)->folder_renamed_to[from] = to;
-    csync_rename_s::get(ctx)->folder_renamed_from[to] = from;
+    csync_rename_trie_insert(&csync_rename_s::get(ctx)->folder_renamed_to, from, to);
+    csync_rename_trie_insert(&csync_rename_s::get(ctx)->folder_renamed_from, to, from);
 }
 
 char* csync_rename_adjust_path(CSYNC* ctx, const char* path)
 {
-    csync_rename_s* d = csync_rename_s::get(ctx);
-    for (std::string p = _parentDir(path); !p.empty(); p = _parentDir(p)) {
-        std::map< std::string, std::string >::iterator it = d->folder_renamed_to.find(p);
-        if (it != d->folder_renamed_to.end()) {
-            std::string rep = it->second + (path + p.length());
-            return c_strdup(rep.c_str());
-        }
+    if (!ctx->rename_info) {
+        return NULL;
     }
-    return c_strdup(path);
+    return _adjustPath(&csync_rename_s::get(ctx)->folder_renamed_to, path);
+}
+
+const csync_rename_trie_t *csync_rename_trie_renamed_to(CSYNC *ctx)
+{
+    if (!ctx->rename_info) {
+        return NULL;
+    }
+    return &csync_rename_s::get(ctx)->folder_renamed_to;
 }
 
 char* csync_rename_adjust_path_source(CSYNC* ctx, const char* path)
 {
-    csync_rename_s* d = csync_rename_s::get(ctx);
-    for (std::string p = _parentDir(path); !p.empty(); p = _parentDir(p)) {
-        std::map< std::string, std::string >::iterator it = d->folder_renamed_from.find(p);
-        if (it != d->folder_renamed_from.end()) {
-            std::string rep = it->second + (path + p.length());
-            return c_strdup(rep.c_str());
-        }
+    if (!ctx->rename_info) {
+        return NULL;
     }
-    return c_strdup(path);
+    return _adjustPath(&csync_rename_s::get(ctx)->folder_renamed_from, path);
 }
 
 
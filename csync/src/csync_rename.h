@@ -26,13 +26,34 @@
 extern "C" {
 #endif
 
-/* Return the final destination path of a given patch in case of renames */
+/* Return the final destination path of a given patch in case of renames,
+ * or NULL if none of its parent directories was renamed */
 char *csync_rename_adjust_path(CSYNC *ctx, const char *path);
-/* Return the source of a given path in case of renames */
+/* Return the source of a given path in case of renames, or NULL */
 char *csync_rename_adjust_path_source(CSYNC *ctx, const char *path);
 void csync_rename_destroy(CSYNC *ctx);
 void csync_rename_record(CSYNC *ctx, const char *from, const char *to);
 
+/*
+ * Renamed directories by path component, also used by the SyncEngine.
+ * The paths are relative and may be of any encoding that keeps '/'.
+ */
+typedef struct csync_rename_trie_s csync_rename_trie_t;
+
+csync_rename_trie_t *csync_rename_trie_new(void);
+void csync_rename_trie_free(csync_rename_trie_t *trie);
+int csync_rename_trie_is_empty(const csync_rename_trie_t *trie);
+/* Record that the directory from is renamed to to, replacing a previous target */
+void csync_rename_trie_insert(csync_rename_trie_t *trie, const char *from, const char *to);
+/*
+ * Find the deepest renamed parent directory of path. Returns its new name and
+ * sets prefixlen to its length in path, the new path is the new name followed by
+ * path + prefixlen. Returns NULL if no parent was renamed. Does not allocate.
+ */
+const char *csync_rename_trie_find(const csync_rename_trie_t *trie, const char *path, size_t *prefixlen);
+/* The directories renamed by csync_rename_record(), NULL if there are none */
+const csync_rename_trie_t *csync_rename_trie_renamed_to(CSYNC *ctx);
+
 #ifdef __cplusplus
 }
 #endif
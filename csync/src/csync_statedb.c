@@ -33,6 +33,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "c_lib.h"
 #include "csync_private.h"
@@ -149,6 +150,9 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb) {
     goto out;
   }
 
+  /* the integrity check, the emptiness check, the version and the two pragmas below */
+  ctx->statedb.query_count += 5;
+
   if (_csync_check_db_integrity(db) != 0) {
       const char *errmsg= sqlite3_errmsg(db);
       CSYNC_LOG(CSYNC_LOG_PRIORITY_NOTICE, "ERR: sqlite3 integrity check failed - bail out: %s.",
@@ -229,10 +233,11 @@ int csync_statedb_close(CSYNC *ctx) {
 #define METADATA_COLUMNS "phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId"
 
 // This funciton parses a line from the metadata table into the given csync_file_stat
-// structure which it is also allocating.
+// structure which it is also allocating: in the arena of arena_ctx if that is given,
+// with c_malloc otherwise.
 // Note that this function calls laso sqlite3_step to actually get the info from db and
 // returns the sqlite return type.
-static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt )
+static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3_stmt *stmt, CSYNC *arena_ctx )
 {
     int rc = SQLITE_ERROR;
     int column_count;
@@ -253,7 +258,11 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
 
             /* phash, pathlen, path, inode, uid, gid, mode, modtime */
             len = sqlite3_column_int(stmt, 1);
-            *st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+            if (arena_ctx) {
+                *st = csync_file_stat_new(arena_ctx, len);
+            } else {
+                *st = c_malloc(sizeof(csync_file_stat_t) + len + 1);
+            }
             /* clear the whole structure */
             ZERO_STRUCTP(*st);
 
@@ -272,7 +281,8 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
             }
 
             if(column_count > 9 && sqlite3_column_text(stmt, 9)) {
-                (*st)->etag = c_strdup( (char*) sqlite3_column_text(stmt, 9) );
+                const char *etag = (const char*) sqlite3_column_text(stmt, 9);
+                (*st)->etag = arena_ctx ? csync_arena_strdup(arena_ctx, etag) : c_strdup(etag);
             }
             if(column_count > 10 && sqlite3_column_text(stmt,10)) {
                 csync_vio_set_file_id((*st)->file_id, (char*) sqlite3_column_text(stmt, 10));
@@ -289,7 +299,8 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
                 (*st)->has_ignored_files = sqlite3_column_int(stmt, 13);
             }
             if(column_count > 15 && sqlite3_column_int(stmt, 15)) {
-                (*st)->checksum = c_strdup( (char*) sqlite3_column_text(stmt, 14));
+                const char *checksum = (const char*) sqlite3_column_text(stmt, 14);
+                (*st)->checksum = arena_ctx ? csync_arena_strdup(arena_ctx, checksum) : c_strdup(checksum);
                 (*st)->checksumTypeId = sqlite3_column_int(stmt, 15);
             }
 
@@ -302,6 +313,574 @@ static int _csync_file_stat_from_metadata_table( csync_file_stat_t **st, sqlite3
     return rc;
 }
 
+/*
+ * In-memory snapshot of the metadata table.
+ *
+ * The update phase looks up every local file by its phash, so instead of one
+ * SQL query per file the whole table is read once into a flat array. Strings
+ * live in a single pool and are referenced by offset. A sorted index array
+ * allows binary searching by phash, and two hash indexes find the entries by
+ * inode and file id for the rename detection.
+ * The lookups return freshly allocated copies, just like the SQL based ones.
+ */
+typedef struct {
+  uint64_t phash;
+  uint64_t inode;
+  int64_t  size;
+  time_t   modtime;
+  uint32_t mode;
+  uint32_t checksumTypeId;
+  uint32_t pathlen;
+  /* offsets into the string pool, 0 means NULL */
+  uint32_t path;
+  uint32_t etag;
+  uint32_t file_id;
+  uint32_t remotePerm;
+  uint32_t checksum;
+  uint8_t  type;
+  uint8_t  has_ignored_files;
+} csync_statedb_snapshot_entry_t;
+
+struct csync_statedb_snapshot_s {
+  csync_statedb_snapshot_entry_t *entries;
+  size_t count;
+  size_t alloc;
+
+  char *pool;
+  size_t pool_len;
+  size_t pool_alloc;
+
+  uint32_t *by_phash;
+
+  /* Open addressing tables of entry number + 1, 0 is a free slot. Among
+   * entries with the same key only the first row is in there. */
+  uint32_t *by_inode;
+  uint32_t *by_file_id;
+  unsigned int index_bits; /* both have 2^index_bits slots */
+
+  /* files with a content checksum sorted by size, built on first use */
+  csync_statedb_checksum_row_t *by_size;
+  size_t by_size_count;
+  bool by_size_built;
+};
+
+/* Used by the qsort() comparators which have no userdata argument */
+static CSYNC_THREAD const csync_statedb_snapshot_t *_sort_snapshot = NULL;
+
+static int _snapshot_pool_add(csync_statedb_snapshot_t *snap, const char *str, size_t len, uint32_t *offset) {
+  if (str == NULL) {
+    *offset = 0;
+    return 0;
+  }
+  if (snap->pool_len + len + 1 > UINT32_MAX) {
+    return -1;
+  }
+  if (snap->pool_len + len + 1 > snap->pool_alloc) {
+    size_t alloc = snap->pool_alloc * 2;
+    char *pool;
+    while (alloc < snap->pool_len + len + 1) {
+      alloc *= 2;
+    }
+    pool = c_realloc(snap->pool, alloc);
+    if (pool == NULL) {
+      return -1;
+    }
+    snap->pool = pool;
+    snap->pool_alloc = alloc;
+  }
+  memcpy(snap->pool + snap->pool_len, str, len);
+  snap->pool[snap->pool_len + len] = '\0';
+  *offset = snap->pool_len;
+  snap->pool_len += len + 1;
+  return 0;
+}
+
+static int _snapshot_add_row(csync_statedb_snapshot_t *snap, sqlite3_stmt *stmt) {
+  csync_statedb_snapshot_entry_t *e;
+  const char *text;
+  int len;
+
+  if (snap->count == snap->alloc) {
+    size_t alloc = snap->alloc * 2;
+    csync_statedb_snapshot_entry_t *entries = c_realloc(snap->entries, alloc * sizeof(csync_statedb_snapshot_entry_t));
+    if (entries == NULL) {
+      return -1;
+    }
+    snap->entries = entries;
+    snap->alloc = alloc;
+  }
+  e = &snap->entries[snap->count];
+  ZERO_STRUCTP(e);
+
+  /* same mapping as in _csync_file_stat_from_metadata_table() */
+  e->phash = sqlite3_column_int64(stmt, 0);
+  e->pathlen = sqlite3_column_int(stmt, 1);
+  text = (const char*) sqlite3_column_text(stmt, 2);
+  len = sqlite3_column_bytes(stmt, 2);
+  if (len > (int) e->pathlen) {
+    len = e->pathlen;
+  }
+  e->pathlen = len;
+  if (_snapshot_pool_add(snap, text ? text : "", len, &e->path) < 0) {
+    return -1;
+  }
+  e->inode = sqlite3_column_int64(stmt, 3);
+  e->mode = sqlite3_column_int(stmt, 6);
+  text = (const char*) sqlite3_column_text(stmt, 7);
+  e->modtime = text ? strtoul(text, NULL, 10) : 0;
+  e->type = sqlite3_column_int(stmt, 8);
+
+  text = (const char*) sqlite3_column_text(stmt, 9);
+  if (text && _snapshot_pool_add(snap, text, strlen(text), &e->etag) < 0) {
+    return -1;
+  }
+  text = (const char*) sqlite3_column_text(stmt, 10);
+  if (text && _snapshot_pool_add(snap, text, strlen(text), &e->file_id) < 0) {
+    return -1;
+  }
+  text = (const char*) sqlite3_column_text(stmt, 11);
+  if (text && _snapshot_pool_add(snap, text, strlen(text), &e->remotePerm) < 0) {
+    return -1;
+  }
+  e->size = sqlite3_column_int64(stmt, 12);
+  e->has_ignored_files = sqlite3_column_int(stmt, 13);
+  e->checksumTypeId = sqlite3_column_int(stmt, 15);
+  text = (const char*) sqlite3_column_text(stmt, 14);
+  if (e->checksumTypeId && text && _snapshot_pool_add(snap, text, strlen(text), &e->checksum) < 0) {
+    return -1;
+  }
+
+  snap->count++;
+  return 0;
+}
+
+static int _snapshot_cmp_row(const void *a, const void *b) {
+  uint32_t ia = *(const uint32_t *) a;
+  uint32_t ib = *(const uint32_t *) b;
+  return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
+
+/* The comparators fall back to the row order so that among equal keys the
+ * first row wins, as with the indexed SQL queries. */
+static int _snapshot_cmp_phash(const void *a, const void *b) {
+  const csync_statedb_snapshot_entry_t *ea = &_sort_snapshot->entries[*(const uint32_t *) a];
+  const csync_statedb_snapshot_entry_t *eb = &_sort_snapshot->entries[*(const uint32_t *) b];
+  if (ea->phash != eb->phash) {
+    return ea->phash < eb->phash ? -1 : 1;
+  }
+  return _snapshot_cmp_row(a, b);
+}
+
+/* Fibonacci hashing, like c_htable */
+static inline size_t _snapshot_index_slot(uint64_t key, unsigned int bits) {
+  return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits));
+}
+
+static inline uint64_t _snapshot_file_id_key(const char *file_id) {
+  return c_jhash64((uint8_t *) file_id, strlen(file_id), 0);
+}
+
+/* Returns the slot holding the entry with this inode, or the free slot ending the probe */
+static size_t _snapshot_inode_slot(const csync_statedb_snapshot_t *snap, uint64_t inode) {
+  size_t mask = ((size_t) 1 << snap->index_bits) - 1;
+  size_t i = _snapshot_index_slot(inode, snap->index_bits);
+  while (snap->by_inode[i] && snap->entries[snap->by_inode[i] - 1].inode != inode) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static size_t _snapshot_file_id_slot(const csync_statedb_snapshot_t *snap, const char *file_id) {
+  size_t mask = ((size_t) 1 << snap->index_bits) - 1;
+  size_t i = _snapshot_index_slot(_snapshot_file_id_key(file_id), snap->index_bits);
+  while (snap->by_file_id[i]
+         && !c_streq(snap->pool + snap->entries[snap->by_file_id[i] - 1].file_id, file_id)) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static void _snapshot_free(csync_statedb_snapshot_t *snap) {
+  if (snap == NULL) {
+    return;
+  }
+  SAFE_FREE(snap->entries);
+  SAFE_FREE(snap->pool);
+  SAFE_FREE(snap->by_phash);
+  SAFE_FREE(snap->by_inode);
+  SAFE_FREE(snap->by_file_id);
+  SAFE_FREE(snap->by_size);
+  SAFE_FREE(snap);
+}
+
+static int _snapshot_build_indexes(csync_statedb_snapshot_t *snap) {
+  size_t i;
+
+  if (snap->count >= UINT32_MAX) {
+    return -1;
+  }
+
+  /* at most half of the slots are used */
+  snap->index_bits = 4;
+  while (((size_t) 1 << snap->index_bits) < snap->count * 2) {
+    snap->index_bits++;
+  }
+
+  snap->by_phash = c_malloc((snap->count + 1) * sizeof(uint32_t));
+  snap->by_inode = c_malloc(((size_t) 1 << snap->index_bits) * sizeof(uint32_t));
+  snap->by_file_id = c_malloc(((size_t) 1 << snap->index_bits) * sizeof(uint32_t));
+  if (!snap->by_phash || !snap->by_inode || !snap->by_file_id) {
+    return -1;
+  }
+
+  /* c_malloc() clears the memory, so all slots are free */
+  for (i = 0; i < snap->count; i++) {
+    const csync_statedb_snapshot_entry_t *e = &snap->entries[i];
+    snap->by_phash[i] = i;
+    if (e->inode) {
+      size_t slot = _snapshot_inode_slot(snap, e->inode);
+      if (!snap->by_inode[slot]) {
+        snap->by_inode[slot] = i + 1;
+      }
+    }
+    if (e->file_id && snap->pool[e->file_id]) {
+      size_t slot = _snapshot_file_id_slot(snap, snap->pool + e->file_id);
+      if (!snap->by_file_id[slot]) {
+        snap->by_file_id[slot] = i + 1;
+      }
+    }
+  }
+
+  _sort_snapshot = snap;
+  qsort(snap->by_phash, snap->count, sizeof(uint32_t), _snapshot_cmp_phash);
+  _sort_snapshot = NULL;
+
+  return 0;
+}
+
+int csync_statedb_load_snapshot(CSYNC *ctx) {
+  csync_statedb_snapshot_t *snap = NULL;
+  sqlite3_stmt *stmt = NULL;
+  int rc;
+
+  if (!ctx || ctx->db_is_empty || !ctx->statedb.db) {
+    return -1;
+  }
+
+  csync_statedb_free_snapshot(ctx);
+
+  const char *query = "SELECT " METADATA_COLUMNS " FROM metadata";
+  SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, query, -1, &stmt, NULL));
+  ctx->statedb.lastReturnValue = rc;
+  if (rc != SQLITE_OK || stmt == NULL) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for the snapshot query.");
+    return -1;
+  }
+
+  snap = c_malloc(sizeof(csync_statedb_snapshot_t));
+  if (snap == NULL) {
+    sqlite3_finalize(stmt);
+    return -1;
+  }
+  ZERO_STRUCTP(snap);
+  snap->alloc = 1024;
+  snap->entries = c_malloc(snap->alloc * sizeof(csync_statedb_snapshot_entry_t));
+  snap->pool_alloc = 64 * 1024;
+  snap->pool = c_malloc(snap->pool_alloc);
+  if (snap->entries == NULL || snap->pool == NULL) {
+    goto fail;
+  }
+  /* offset 0 is reserved for NULL */
+  snap->pool[0] = '\0';
+  snap->pool_len = 1;
+
+  ctx->statedb.query_count++;
+  do {
+    SQLITE_BUSY_HANDLED(sqlite3_step(stmt));
+    if (rc == SQLITE_ROW && _snapshot_add_row(snap, stmt) < 0) {
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Out of memory while loading the journal snapshot");
+      goto fail;
+    }
+  } while (rc == SQLITE_ROW);
+
+  ctx->statedb.lastReturnValue = rc;
+  if (rc != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not read the journal snapshot: %d!", rc);
+    goto fail;
+  }
+  sqlite3_finalize(stmt);
+
+  if (_snapshot_build_indexes(snap) < 0) {
+    _snapshot_free(snap);
+    return -1;
+  }
+
+  CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Journal snapshot holds %zu entries (%zu bytes of strings)",
+            snap->count, snap->pool_len);
+  ctx->statedb.snapshot = snap;
+  return 0;
+
+fail:
+  sqlite3_finalize(stmt);
+  _snapshot_free(snap);
+  return -1;
+}
+
+void csync_statedb_free_snapshot(CSYNC *ctx) {
+  if (!ctx) {
+    return;
+  }
+  _snapshot_free(ctx->statedb.snapshot);
+  ctx->statedb.snapshot = NULL;
+}
+
+static csync_file_stat_t *_snapshot_entry_to_stat(const csync_statedb_snapshot_t *snap, uint32_t idx) {
+  const csync_statedb_snapshot_entry_t *e = &snap->entries[idx];
+  csync_file_stat_t *st = c_malloc(sizeof(csync_file_stat_t) + e->pathlen + 1);
+  if (st == NULL) {
+    return NULL;
+  }
+  ZERO_STRUCTP(st);
+
+  st->phash = e->phash;
+  st->pathlen = e->pathlen;
+  memcpy(st->path, snap->pool + e->path, e->pathlen + 1);
+  st->inode = e->inode;
+  st->mode = e->mode;
+  st->modtime = e->modtime;
+  st->type = e->type;
+  if (e->etag) {
+    st->etag = c_strdup(snap->pool + e->etag);
+  }
+  if (e->file_id) {
+    csync_vio_set_file_id(st->file_id, snap->pool + e->file_id);
+  }
+  if (e->remotePerm) {
+    strncpy(st->remotePerm, snap->pool + e->remotePerm, REMOTE_PERM_BUF_SIZE);
+  }
+  st->size = e->size;
+  st->has_ignored_files = e->has_ignored_files;
+  if (e->checksumTypeId && e->checksum) {
+    st->checksum = c_strdup(snap->pool + e->checksum);
+    st->checksumTypeId = e->checksumTypeId;
+  }
+  return st;
+}
+
+/* Returns the position of the first index entry not less than the key */
+static size_t _snapshot_lower_bound_u64(const csync_statedb_snapshot_t *snap, const uint32_t *index,
+                                        size_t count, uint64_t key) {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const csync_statedb_snapshot_entry_t *e = &snap->entries[index[mid]];
+    if (e->phash < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static csync_file_stat_t *_snapshot_get_by_hash(const csync_statedb_snapshot_t *snap, uint64_t phash) {
+  size_t pos = _snapshot_lower_bound_u64(snap, snap->by_phash, snap->count, phash);
+  if (pos < snap->count && snap->entries[snap->by_phash[pos]].phash == phash) {
+    return _snapshot_entry_to_stat(snap, snap->by_phash[pos]);
+  }
+  return NULL;
+}
+
+/* Returns the entry number, or -1 */
+static int64_t _snapshot_find_by_inode(const csync_statedb_snapshot_t *snap, uint64_t inode) {
+  uint32_t n = snap->by_inode[_snapshot_inode_slot(snap, inode)];
+  return n ? (int64_t) n - 1 : -1;
+}
+
+static int64_t _snapshot_find_by_file_id(const csync_statedb_snapshot_t *snap, const char *file_id) {
+  uint32_t n = snap->by_file_id[_snapshot_file_id_slot(snap, file_id)];
+  return n ? (int64_t) n - 1 : -1;
+}
+
+static csync_file_stat_t *_snapshot_get_by_inode(const csync_statedb_snapshot_t *snap, uint64_t inode) {
+  int64_t idx = _snapshot_find_by_inode(snap, inode);
+  return idx < 0 ? NULL : _snapshot_entry_to_stat(snap, idx);
+}
+
+static csync_file_stat_t *_snapshot_get_by_file_id(const csync_statedb_snapshot_t *snap, const char *file_id) {
+  int64_t idx = _snapshot_find_by_file_id(snap, file_id);
+  return idx < 0 ? NULL : _snapshot_entry_to_stat(snap, idx);
+}
+
+int csync_statedb_get_phash_by_inode(CSYNC *ctx, uint64_t inode, uint64_t *phash) {
+  int64_t idx;
+
+  if (!ctx || !ctx->statedb.snapshot) {
+    return -1;
+  }
+  if (!inode || ctx->db_is_empty) {
+    return 0;
+  }
+  idx = _snapshot_find_by_inode(ctx->statedb.snapshot, inode);
+  if (idx < 0) {
+    return 0;
+  }
+  *phash = ctx->statedb.snapshot->entries[idx].phash;
+  return 1;
+}
+
+int csync_statedb_get_phash_by_file_id(CSYNC *ctx, const char *file_id, uint64_t *phash) {
+  int64_t idx;
+
+  if (!ctx || !ctx->statedb.snapshot) {
+    return -1;
+  }
+  if (!file_id || c_streq(file_id, "") || ctx->db_is_empty) {
+    return 0;
+  }
+  idx = _snapshot_find_by_file_id(ctx->statedb.snapshot, file_id);
+  if (idx < 0) {
+    return 0;
+  }
+  *phash = ctx->statedb.snapshot->entries[idx].phash;
+  return 1;
+}
+
+static int _snapshot_cmp_size(const void *a, const void *b) {
+  const csync_statedb_checksum_row_t *ra = (const csync_statedb_checksum_row_t *) a;
+  const csync_statedb_checksum_row_t *rb = (const csync_statedb_checksum_row_t *) b;
+  if (ra->size != rb->size) {
+    return ra->size < rb->size ? -1 : 1;
+  }
+  if (ra->phash != rb->phash) {
+    return ra->phash < rb->phash ? -1 : 1;
+  }
+  return 0;
+}
+
+static int _snapshot_build_by_size(csync_statedb_snapshot_t *snap) {
+  size_t count = 0;
+  size_t i;
+
+  for (i = 0; i < snap->count; i++) {
+    const csync_statedb_snapshot_entry_t *e = &snap->entries[i];
+    if (e->type == CSYNC_FTW_TYPE_FILE && e->checksumTypeId && e->checksum) {
+      count++;
+    }
+  }
+  if (count > 0) {
+    snap->by_size = c_malloc(count * sizeof(csync_statedb_checksum_row_t));
+    if (snap->by_size == NULL) {
+      return -1;
+    }
+  }
+  for (i = 0; i < snap->count; i++) {
+    const csync_statedb_snapshot_entry_t *e = &snap->entries[i];
+    if (e->type == CSYNC_FTW_TYPE_FILE && e->checksumTypeId && e->checksum) {
+      csync_statedb_checksum_row_t *row = &snap->by_size[snap->by_size_count++];
+      row->size = e->size;
+      row->phash = e->phash;
+      row->checksumTypeId = e->checksumTypeId;
+      row->checksum = snap->pool + e->checksum;
+    }
+  }
+  qsort(snap->by_size, snap->by_size_count, sizeof(csync_statedb_checksum_row_t), _snapshot_cmp_size);
+  snap->by_size_built = true;
+  return 0;
+}
+
+int csync_statedb_get_checksums_by_size(CSYNC *ctx, int64_t size, const csync_statedb_checksum_row_t **rows) {
+  csync_statedb_snapshot_t *snap;
+  size_t lo = 0;
+  size_t hi;
+  size_t end;
+
+  if (!ctx || !ctx->statedb.snapshot) {
+    return -1;
+  }
+  snap = ctx->statedb.snapshot;
+  if (!snap->by_size_built && _snapshot_build_by_size(snap) < 0) {
+    return -1;
+  }
+
+  hi = snap->by_size_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (snap->by_size[mid].size < size) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  end = lo;
+  while (end < snap->by_size_count && snap->by_size[end].size == size) {
+    end++;
+  }
+  if (end - lo > INT_MAX) {
+    end = lo + INT_MAX;
+  }
+  *rows = snap->by_size + lo;
+  return end - lo;
+}
+
+static int _csync_statedb_in_trees(CSYNC *ctx, uint64_t phash) {
+  return c_htable_find(ctx->local.tree, phash) != NULL
+      || c_htable_find(ctx->remote.tree, phash) != NULL;
+}
+
+int csync_statedb_walk_superfluous(CSYNC *ctx, csync_statedb_superfluous_visit_func *visitor, void *userdata) {
+  const char *query = "SELECT phash, path FROM metadata";
+  sqlite3_stmt *stmt = NULL;
+  int rc;
+
+  if (!ctx || !visitor) {
+    return -1;
+  }
+
+  if (ctx->statedb.snapshot) {
+    const csync_statedb_snapshot_t *snap = ctx->statedb.snapshot;
+    size_t i;
+
+    for (i = 0; i < snap->count; i++) {
+      const csync_statedb_snapshot_entry_t *e = &snap->entries[i];
+      if (!_csync_statedb_in_trees(ctx, e->phash)
+          && (*visitor)(e->phash, snap->pool + e->path, userdata) < 0) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
+  SQLITE_BUSY_HANDLED(sqlite3_prepare_v2(ctx->statedb.db, query, -1, &stmt, NULL));
+  ctx->statedb.lastReturnValue = rc;
+  if (rc != SQLITE_OK) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Unable to create stmt for the superfluous entries query.");
+    return -1;
+  }
+
+  ctx->statedb.query_count++;
+  do {
+    SQLITE_BUSY_HANDLED(sqlite3_step(stmt));
+    if (rc == SQLITE_ROW) {
+      uint64_t phash = (uint64_t) sqlite3_column_int64(stmt, 0);
+      const char *path = (const char *) sqlite3_column_text(stmt, 1);
+      if (!_csync_statedb_in_trees(ctx, phash)
+          && (*visitor)(phash, path ? path : "", userdata) < 0) {
+        sqlite3_finalize(stmt);
+        return -1;
+      }
+    }
+  } while (rc == SQLITE_ROW);
+  sqlite3_finalize(stmt);
+
+  if (rc != SQLITE_DONE) {
+    CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not read the superfluous entries: %d!", rc);
+    return -1;
+  }
+  return 0;
+}
+
 /* caller must free the memory */
 csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
                                                   uint64_t phash)
@@ -313,6 +892,10 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
       return NULL;
   }
 
+  if( ctx->statedb.snapshot ) {
+      return _snapshot_get_by_hash(ctx->statedb.snapshot, phash);
+  }
+
   if( ctx->statedb.by_hash_stmt == NULL ) {
       const char *hash_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE phash=?1";
 
@@ -330,7 +913,8 @@ csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_hash_stmt, 1, (long long signed int)phash);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt);
+  ctx->statedb.query_count++;
+  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_hash_stmt, NULL);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) )  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -356,6 +940,10 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
         return NULL;
     }
 
+    if( ctx->statedb.snapshot ) {
+        return _snapshot_get_by_file_id(ctx->statedb.snapshot, file_id);
+    }
+
     if( ctx->statedb.by_fileid_stmt == NULL ) {
         const char *query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE fileid=?1";
 
@@ -370,7 +958,8 @@ csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx,
     /* bind the query value */
     sqlite3_bind_text(ctx->statedb.by_fileid_stmt, 1, file_id, -1, SQLITE_STATIC);
 
-    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt);
+    ctx->statedb.query_count++;
+    rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_fileid_stmt, NULL);
     ctx->statedb.lastReturnValue = rc;
     if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata: %d!", rc);
@@ -396,6 +985,10 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
       return NULL;
   }
 
+  if( ctx->statedb.snapshot ) {
+      return _snapshot_get_by_inode(ctx->statedb.snapshot, inode);
+  }
+
   if( ctx->statedb.by_inode_stmt == NULL ) {
       const char *inode_query = "SELECT " METADATA_COLUMNS " FROM metadata WHERE inode=?1";
 
@@ -413,7 +1006,8 @@ csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx,
 
   sqlite3_bind_int64(ctx->statedb.by_inode_stmt, 1, (long long signed int)inode);
 
-  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt);
+  ctx->statedb.query_count++;
+  rc = _csync_file_stat_from_metadata_table(&st, ctx->statedb.by_inode_stmt, NULL);
   ctx->statedb.lastReturnValue = rc;
   if( !(rc == SQLITE_ROW || rc == SQLITE_DONE) ) {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "WRN: Could not get line from metadata by inode: %d!", rc);
@@ -458,30 +1052,41 @@ int csync_statedb_get_below_path( CSYNC *ctx, const char *path ) {
     cnt = 0;
 
     ctx->statedb.lastReturnValue = rc;
+    ctx->statedb.query_count++;
     do {
         csync_file_stat_t *st = NULL;
 
-        rc = _csync_file_stat_from_metadata_table( &st, stmt);
+        /* the entries go into the tree: allocate them in the arena */
+        rc = _csync_file_stat_from_metadata_table( &st, stmt, ctx);
         if( st ) {
             /* Check for exclusion from the tree.
              * Note that this is only a safety net in case the ignore list changes
              * without a full remote discovery being triggered. */
-            CSYNC_EXCLUDE_TYPE excluded = csync_excluded_traversal(ctx->excludes, st->path, st->type);
+            CSYNC_EXCLUDE_TYPE excluded = csync_excluded_traversal_compiled(ctx->exclude_matcher, st->path, st->type);
             if (excluded != CSYNC_NOT_EXCLUDED) {
                 CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "%s excluded (%d)", st->path, excluded);
 
                 if (excluded == CSYNC_FILE_EXCLUDE_AND_REMOVE
                         || excluded == CSYNC_FILE_SILENTLY_EXCLUDED) {
-                    SAFE_FREE(st);
                     continue;
                 }
 
                 st->instruction = CSYNC_INSTRUCTION_IGNORE;
             }
 
+            if (ctx->current == LOCAL_REPLICA) {
+                /* Only keep what a walk of the file system would have found */
+                st->etag = NULL;
+                st->checksum = NULL;
+                st->checksumTypeId = 0;
+                st->file_id[0] = '\0';
+                st->remotePerm[0] = '\0';
+                st->has_ignored_files = 0;
+                st->content_from_db = (st->type == CSYNC_FTW_TYPE_DIR);
+            }
+
             /* store into result list. */
-            if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-                SAFE_FREE(st);
+            if (c_htable_insert(ctx->current == LOCAL_REPLICA ? ctx->local.tree : ctx->remote.tree, st->phash, st) < 0) {
                 ctx->status_code = CSYNC_STATUS_TREE_ERROR;
                 break;
             }
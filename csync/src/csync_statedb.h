@@ -60,12 +60,73 @@ int csync_statedb_load(CSYNC *ctx, const char *statedb, sqlite3 **pdb);
 
 int csync_statedb_close(CSYNC *ctx);
 
+/**
+ * @brief Read the whole metadata table into memory.
+ *
+ * While the snapshot exists, csync_statedb_get_stat_by_hash(), _by_inode() and
+ * _by_file_id() are answered from it instead of querying the database.
+ * It stays valid until csync_statedb_free_snapshot() is called, also across
+ * closing and reopening the statedb between update and reconcile.
+ *
+ * @param ctx      The csync context.
+ *
+ * @return 0 on success, less than 0 if the snapshot could not be created.
+ */
+int csync_statedb_load_snapshot(CSYNC *ctx);
+
+void csync_statedb_free_snapshot(CSYNC *ctx);
+
 csync_file_stat_t *csync_statedb_get_stat_by_hash(CSYNC *ctx, uint64_t phash);
 
 csync_file_stat_t *csync_statedb_get_stat_by_inode(CSYNC *ctx, uint64_t inode);
 
 csync_file_stat_t *csync_statedb_get_stat_by_file_id(CSYNC *ctx, const char *file_id);
 
+/**
+ * @brief Find the path hash of the journal entry with this inode or file id.
+ *
+ * Unlike csync_statedb_get_stat_by_inode() and _by_file_id() nothing is copied,
+ * which makes them cheap enough for the rename detection of every moved file.
+ * They are answered from the snapshot only.
+ *
+ * @return 1 if found, 0 if not, less than 0 if there is no snapshot.
+ */
+int csync_statedb_get_phash_by_inode(CSYNC *ctx, uint64_t inode, uint64_t *phash);
+
+int csync_statedb_get_phash_by_file_id(CSYNC *ctx, const char *file_id, uint64_t *phash);
+
+typedef struct csync_statedb_checksum_row_s {
+  int64_t size;
+  uint64_t phash;
+  uint32_t checksumTypeId;
+  const char *checksum; /* owned by the snapshot */
+} csync_statedb_checksum_row_t;
+
+/**
+ * @brief Find the journal entries of the files of this size that have a content checksum.
+ *
+ * Used to detect moves that did not keep the inode. The index is built from
+ * the snapshot on the first call, and rows stay valid as long as the snapshot.
+ *
+ * @return The number of entries, the first one in rows, or less than 0 if
+ *         there is no snapshot.
+ */
+int csync_statedb_get_checksums_by_size(CSYNC *ctx, int64_t size, const csync_statedb_checksum_row_t **rows);
+
+typedef int (csync_statedb_superfluous_visit_func)(uint64_t phash, const char *path, void *userdata);
+
+/**
+ * @brief Call visitor for every journal entry that is in neither tree.
+ *
+ * These files are gone on both sides, so their entries can be removed from the
+ * journal once the sync is done. Call it after the reconcile phase, while the
+ * trees are still there. Answered from the snapshot, or with a single query of
+ * the journal if there is none.
+ *
+ * @return 0 on success, less than 0 on error or if the visitor failed.
+ */
+int csync_statedb_walk_superfluous(CSYNC *ctx, csync_statedb_superfluous_visit_func *visitor, void *userdata);
+
 char *csync_statedb_get_etag(CSYNC *ctx, uint64_t jHash);
 
 /**
@@ -83,6 +144,8 @@ char *csync_statedb_get_etag(CSYNC *ctx, uint64_t jHash);
  * parameter path is /home/kf/test, we have /home/kf/test/file.txt in
  * the result but also /home/kf/test/homework/another_file.txt
  *
+ * The entries are inserted into the tree of the replica currently walked.
+ *
  * @return   A stringlist containing a multiple of 9 entries.
  */
 int csync_statedb_get_below_path(CSYNC *ctx, const char *path);
@@ -127,7 +127,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     const csync_vio_file_stat_t *fs, const int type) {
   uint64_t h = 0;
   size_t len = 0;
-  size_t size = 0;
   const char *path = NULL;
   csync_file_stat_t *st = NULL;
   csync_file_stat_t *tmp = NULL;
@@ -167,7 +166,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
       excluded =CSYNC_FILE_EXCLUDE_STAT_FAILED;
   } else {
     /* Check if file is excluded */
-    excluded = csync_excluded_traversal(ctx->excludes, path, type);
+    excluded = csync_excluded_traversal_compiled(ctx->exclude_matcher, path, type);
   }
 
   if( excluded == CSYNC_NOT_EXCLUDED ) {
@@ -200,9 +199,7 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
   if( h == 0 ) {
     return -1;
   }
-  size = sizeof(csync_file_stat_t) + len + 1;
-
-  st = c_malloc(size);
+  st = csync_file_stat_new(ctx, len);
 
   /* Set instruction by default to none */
   st->instruction = CSYNC_INSTRUCTION_NONE;
@@ -218,7 +215,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
       tmp = csync_statedb_get_stat_by_hash(ctx, h);
       if(_last_db_return_error(ctx)) {
-          SAFE_FREE(st);
           SAFE_FREE(tmp);
           ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
           return -1;
@@ -228,10 +224,10 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - not found in db, IGNORE!", path);
         st->instruction = CSYNC_INSTRUCTION_IGNORE;
       } else {
-        SAFE_FREE(st);
-        st = tmp;
+        st = csync_file_stat_copy(ctx, tmp);
         st->instruction = CSYNC_INSTRUCTION_NONE;
         CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "file: %s - tmp non zero, mtime %lu", path, st->modtime );
+        csync_file_stat_free(tmp);
         tmp = NULL;
       }
       goto fastout; /* Skip copying of the etag. That's an important difference to upstream
@@ -257,7 +253,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     tmp = csync_statedb_get_stat_by_hash(ctx, h);
 
     if(_last_db_return_error(ctx)) {
-        SAFE_FREE(st);
         ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
         return -1;
     }
@@ -281,9 +276,11 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
             if (fs->size == tmp->size && tmp->checksumTypeId) {
                 if (ctx->callbacks.checksum_hook) {
-                    st->checksum = ctx->callbacks.checksum_hook(
+                    char *checksum = (char *) ctx->callbacks.checksum_hook(
                                 file, tmp->checksumTypeId,
                                 ctx->callbacks.checksum_userdata);
+                    st->checksum = csync_arena_strdup(ctx, checksum);
+                    SAFE_FREE(checksum);
                 }
                 bool checksumIdentical = false;
                 if (st->checksum) {
@@ -312,6 +309,17 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading from database: %s", path);
             ctx->remote.read_from_db = true;
         }
+        if (type == CSYNC_FTW_TYPE_DIR && ctx->current == LOCAL_REPLICA
+                && !metadata_differ && ctx->callbacks.checkLocalDiscoveryHook
+                && !ctx->callbacks.checkLocalDiscoveryHook(ctx->callbacks.update_callback_userdata, path)) {
+            /* Same inode and modification time, and nothing was reported to have
+             * changed in or below this directory: restore its content from the
+             * database instead of reading it from the disk.
+             */
+            CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Reading local from database: %s", path);
+            ctx->local.read_from_db = true;
+            st->content_from_db = true;
+        }
         if (metadata_differ) {
             /* file id or permissions has changed. Which means we need to update them in the DB. */
             CSYNC_LOG(CSYNC_LOG_PRIORITY_TRACE, "Need to update metadata for: %s", path);
@@ -337,7 +345,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             tmp = csync_statedb_get_stat_by_inode(ctx, fs->inode);
 
             if(_last_db_return_error(ctx)) {
-                SAFE_FREE(st);
                 ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
                 return -1;
             }
@@ -374,7 +381,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
             tmp = csync_statedb_get_stat_by_file_id(ctx, fs->file_id);
 
             if(_last_db_return_error(ctx)) {
-                SAFE_FREE(st);
                 ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
                 return -1;
             }
@@ -404,7 +410,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
 
                 if (fs->type == CSYNC_VIO_FILE_TYPE_DIRECTORY && ctx->current == REMOTE_REPLICA && ctx->callbacks.checkSelectiveSyncNewFolderHook) {
                     if (ctx->callbacks.checkSelectiveSyncNewFolderHook(ctx->callbacks.update_callback_userdata, path)) {
-                        SAFE_FREE(st);
                         return 1;
                     }
                 }
@@ -414,7 +419,6 @@ static int _csync_detect_update(CSYNC *ctx, const char *file,
     }
   } else  {
       CSYNC_LOG(CSYNC_LOG_PRIORITY_DEBUG, "Unable to open statedb" );
-      SAFE_FREE(st);
       ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
       return -1;
   }
@@ -451,19 +455,13 @@ out:
   st->size  = fs->size;
   st->modtime = fs->mtime;
   st->type  = type;
-  st->etag   = NULL;
-  if( fs->etag ) {
-      SAFE_FREE(st->etag);
-      st->etag  = c_strdup(fs->etag);
-  }
+  st->etag   = csync_arena_strdup(ctx, fs->etag);
   csync_vio_set_file_id(st->file_id, fs->file_id);
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL) {
-      SAFE_FREE(st->directDownloadUrl);
-      st->directDownloadUrl = c_strdup(fs->directDownloadUrl);
+      st->directDownloadUrl = csync_arena_strdup(ctx, fs->directDownloadUrl);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES) {
-      SAFE_FREE(st->directDownloadCookies);
-      st->directDownloadCookies = c_strdup(fs->directDownloadCookies);
+      st->directDownloadCookies = csync_arena_strdup(ctx, fs->directDownloadCookies);
   }
   if (fs->fields & CSYNC_VIO_FILE_STAT_FIELDS_PERM) {
       strncpy(st->remotePerm, fs->remotePerm, REMOTE_PERM_BUF_SIZE);
@@ -476,15 +474,13 @@ fastout:  /* target if the file information is read from database into st */
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      if (c_rbtree_insert(ctx->local.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
+      if (c_htable_insert(ctx->local.tree, st->phash, st) < 0) {
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
       }
       break;
     case REMOTE_REPLICA:
-      if (c_rbtree_insert(ctx->remote.tree, (void *) st) < 0) {
-        SAFE_FREE(st);
+      if (c_htable_insert(ctx->remote.tree, st->phash, st) < 0) {
         ctx->status_code = CSYNC_STATUS_TREE_ERROR;
         return -1;
       }
@@ -564,13 +560,14 @@ int csync_walker(CSYNC *ctx, const char *file, const csync_vio_file_stat_t *fs,
 static bool fill_tree_from_db(CSYNC *ctx, const char *uri)
 {
     const char *path = NULL;
+    const char *replica_uri = ctx->current == LOCAL_REPLICA ? ctx->local.uri : ctx->remote.uri;
 
-    if( strlen(uri) < strlen(ctx->remote.uri)+1) {
-        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain remote uri!");
+    if( strlen(uri) < strlen(replica_uri)+1) {
+        CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "name does not contain replica uri!");
         return false;
     }
 
-    path = uri + strlen(ctx->remote.uri)+1;
+    path = uri + strlen(replica_uri)+1;
 
     if( csync_statedb_get_below_path(ctx, path) < 0 ) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "StateDB could not be read!");
@@ -612,7 +609,9 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
   int rc = 0;
   int res = 0;
 
-  bool do_read_from_db = (ctx->current == REMOTE_REPLICA && ctx->remote.read_from_db);
+  int *read_from_db_flag = ctx->current == LOCAL_REPLICA ? &ctx->local.read_from_db
+                                                         : &ctx->remote.read_from_db;
+  bool do_read_from_db = *read_from_db_flag;
 
   if (uri[0] == '\0') {
     errno = ENOENT;
@@ -620,10 +619,10 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     goto error;
   }
 
-  read_from_db = ctx->remote.read_from_db;
+  read_from_db = *read_from_db_flag;
 
-  // if the etag of this dir is still the same, its content is restored from the
-  // database.
+  // if the etag (remote) or the inode and mtime (local, without reported changes)
+  // of this dir is still the same, its content is restored from the database.
   if( do_read_from_db ) {
       if( ! fill_tree_from_db(ctx, uri) ) {
         errno = ENOENT;
@@ -761,7 +760,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
 
     /* Only for the local replica we have to stat(), for the remote one we have all data already */
     if (ctx->replica == LOCAL_REPLICA) {
-        res = csync_vio_stat(ctx, filename, dirent);
+        res = csync_vio_stat_dirent(ctx, dh, filename, dirent);
     } else {
         res = 0;
     }
@@ -847,7 +846,7 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     }
 
     ctx->current_fs = previous_fs;
-    ctx->remote.read_from_db = read_from_db;
+    *read_from_db_flag = read_from_db;
     SAFE_FREE(filename);
     csync_vio_file_stat_destroy(dirent);
     dirent = NULL;
@@ -861,7 +860,7 @@ done:
   SAFE_FREE(filename);
   return rc;
 error:
-  ctx->remote.read_from_db = read_from_db;
+  *read_from_db_flag = read_from_db;
   if (dh != NULL) {
     csync_vio_closedir(ctx, dh);
   }
@@ -0,0 +1,144 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_arena.h"
+
+#define C_ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+#define C_ARENA_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+struct c_arena_block_s {
+  struct c_arena_block_s *next;
+  size_t size;
+  size_t used;
+};
+
+/* the data of a block follows its header */
+#define C_ARENA_BLOCK_DATA(b) ((char *) (b) + C_ARENA_ALIGN(sizeof(struct c_arena_block_s)))
+
+struct c_arena_s {
+  struct c_arena_block_s *blocks; /* the first one is the one we allocate from */
+  size_t block_size;
+  size_t total;
+};
+
+static struct c_arena_block_s *_c_arena_block_new(c_arena_t *arena, size_t size) {
+  struct c_arena_block_s *block = NULL;
+
+  /* c_malloc() clears the memory, so the allocations don't need to */
+  block = c_malloc(C_ARENA_ALIGN(sizeof(struct c_arena_block_s)) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->size = size;
+  arena->total += size;
+  return block;
+}
+
+c_arena_t *c_arena_new(size_t block_size) {
+  c_arena_t *arena = NULL;
+
+  arena = c_malloc(sizeof(c_arena_t));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->block_size = block_size ? C_ARENA_ALIGN(block_size) : C_ARENA_DEFAULT_BLOCK_SIZE;
+  return arena;
+}
+
+void *c_arena_alloc(c_arena_t *arena, size_t size) {
+  struct c_arena_block_s *block = NULL;
+  void *ptr = NULL;
+
+  if (arena == NULL || size == 0) {
+    return NULL;
+  }
+  size = C_ARENA_ALIGN(size);
+
+  block = arena->blocks;
+  if (block && block->size - block->used >= size) {
+    ptr = C_ARENA_BLOCK_DATA(block) + block->used;
+    block->used += size;
+    return ptr;
+  }
+
+  if (size > arena->block_size / 4) {
+    /* Big allocations get a block of their own. It goes after the current
+     * block, which may still have room for small ones. */
+    block = _c_arena_block_new(arena, size);
+    if (block == NULL) {
+      return NULL;
+    }
+    if (arena->blocks) {
+      block->next = arena->blocks->next;
+      arena->blocks->next = block;
+    } else {
+      arena->blocks = block;
+    }
+  } else {
+    block = _c_arena_block_new(arena, arena->block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  block->used = size;
+  return C_ARENA_BLOCK_DATA(block);
+}
+
+char *c_arena_strdup(c_arena_t *arena, const char *str) {
+  char *ret = NULL;
+  size_t len = 0;
+
+  if (str == NULL) {
+    return NULL;
+  }
+  len = strlen(str);
+  ret = c_arena_alloc(arena, len + 1);
+  if (ret == NULL) {
+    return NULL;
+  }
+  memcpy(ret, str, len + 1);
+  return ret;
+}
+
+size_t c_arena_size(const c_arena_t *arena) {
+  return arena ? arena->total : 0;
+}
+
+void c_arena_free(c_arena_t *arena) {
+  struct c_arena_block_s *block = NULL;
+
+  if (arena == NULL) {
+    return;
+  }
+  block = arena->blocks;
+  while (block) {
+    struct c_arena_block_s *next = block->next;
+    SAFE_FREE(block);
+    block = next;
+  }
+  SAFE_FREE(arena);
+}
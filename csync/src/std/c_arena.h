@@ -0,0 +1,92 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_arena.h
+ *
+ * @brief Interface of the cynapses libc arena allocator
+ *
+ * An arena hands out memory from big blocks and releases all of it at once.
+ * It is meant for many small objects sharing the same lifetime, e.g. the file
+ * stats of one sync run. Single allocations can't be freed.
+ *
+ * @defgroup cynArenaInternals cynapses libc arena functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_ARENA_H
+#define _C_ARENA_H
+
+#include <stdlib.h>
+
+typedef struct c_arena_s c_arena_t;
+
+/**
+ * @brief Create a new arena.
+ *
+ * @param block_size  Size of the blocks the memory is taken from, 0 for the
+ *                    default of 64 KiB. Bigger allocations get their own block.
+ *
+ * @return The new arena, NULL if insufficient memory was available.
+ */
+c_arena_t *c_arena_new(size_t block_size);
+
+/**
+ * @brief Allocate memory from the arena.
+ *
+ * The memory is set to zero and aligned to 8 bytes. It stays valid until the
+ * arena is freed.
+ *
+ * @param arena   The arena to allocate from.
+ * @param size    Size in bytes to allocate.
+ *
+ * @return A pointer to the memory, NULL if size is 0 or insufficient memory
+ *         was available.
+ */
+void *c_arena_alloc(c_arena_t *arena, size_t size);
+
+/**
+ * @brief Duplicate a string into the arena.
+ *
+ * @param arena   The arena to allocate from.
+ * @param str     String to duplicate, may be NULL.
+ *
+ * @return The copy, NULL if str is NULL or insufficient memory was available.
+ */
+char *c_arena_strdup(c_arena_t *arena, const char *str);
+
+/**
+ * @brief Get the number of bytes the arena took from the system.
+ */
+size_t c_arena_size(const c_arena_t *arena);
+
+/**
+ * @brief Free the arena and all memory allocated from it.
+ *
+ * @param arena   The arena to free, may be NULL.
+ */
+void c_arena_free(c_arena_t *arena);
+
+/**
+ * }@
+ */
+#endif /* _C_ARENA_H */
@@ -0,0 +1,191 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "c_macro.h"
+#include "c_alloc.h"
+#include "c_htable.h"
+
+#define C_HTABLE_MIN_BITS 4
+
+/* an entry is free if its data is NULL */
+struct c_htable_entry_s {
+  uint64_t key;
+  void *data;
+};
+
+struct c_htable_s {
+  struct c_htable_entry_s *entries;
+  unsigned int bits;  /* the table has 2^bits entries */
+  size_t size;
+};
+
+/* Fibonacci hashing: take the top bits of the key times 2^64 / phi. Cheap,
+ * and spreads keys that are not proper hashes, like sequential numbers. */
+static inline size_t _c_htable_slot(uint64_t key, unsigned int bits) {
+  return (size_t) ((key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits));
+}
+
+/* grow when more than 2/3 of the entries are used */
+static inline int _c_htable_full(size_t size, unsigned int bits) {
+  return size * 3 >= ((size_t) 1 << bits) * 2;
+}
+
+static void _c_htable_put(struct c_htable_entry_s *entries, unsigned int bits,
+    uint64_t key, void *data) {
+  size_t mask = ((size_t) 1 << bits) - 1;
+  size_t i = _c_htable_slot(key, bits);
+
+  while (entries[i].data != NULL) {
+    i = (i + 1) & mask;
+  }
+  entries[i].key = key;
+  entries[i].data = data;
+}
+
+static int _c_htable_resize(c_htable_t *table, unsigned int bits) {
+  struct c_htable_entry_s *entries = NULL;
+  size_t n = (size_t) 1 << table->bits;
+  size_t i;
+
+  entries = c_malloc(((size_t) 1 << bits) * sizeof(struct c_htable_entry_s));
+  if (entries == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (table->entries[i].data != NULL) {
+      _c_htable_put(entries, bits, table->entries[i].key, table->entries[i].data);
+    }
+  }
+
+  SAFE_FREE(table->entries);
+  table->entries = entries;
+  table->bits = bits;
+  return 0;
+}
+
+c_htable_t *c_htable_new(size_t size_hint) {
+  c_htable_t *table = NULL;
+  unsigned int bits = C_HTABLE_MIN_BITS;
+
+  while (_c_htable_full(size_hint, bits)) {
+    bits++;
+  }
+
+  table = c_malloc(sizeof(c_htable_t));
+  if (table == NULL) {
+    return NULL;
+  }
+
+  /* c_malloc() clears the memory, so all entries are free */
+  table->entries = c_malloc(((size_t) 1 << bits) * sizeof(struct c_htable_entry_s));
+  if (table->entries == NULL) {
+    SAFE_FREE(table);
+    return NULL;
+  }
+  table->bits = bits;
+
+  return table;
+}
+
+void c_htable_free(c_htable_t *table) {
+  if (table == NULL) {
+    return;
+  }
+  SAFE_FREE(table->entries);
+  SAFE_FREE(table);
+}
+
+int c_htable_insert(c_htable_t *table, uint64_t key, void *data) {
+  size_t mask;
+  size_t i;
+
+  if (table == NULL || data == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  mask = ((size_t) 1 << table->bits) - 1;
+  for (i = _c_htable_slot(key, table->bits); table->entries[i].data != NULL; i = (i + 1) & mask) {
+    if (table->entries[i].key == key) {
+      return 1;
+    }
+  }
+
+  if (_c_htable_full(table->size + 1, table->bits)) {
+    if (_c_htable_resize(table, table->bits + 1) < 0) {
+      return -1;
+    }
+    _c_htable_put(table->entries, table->bits, key, data);
+  } else {
+    table->entries[i].key = key;
+    table->entries[i].data = data;
+  }
+  table->size++;
+
+  return 0;
+}
+
+void *c_htable_find(const c_htable_t *table, uint64_t key) {
+  size_t mask;
+  size_t i;
+
+  if (table == NULL) {
+    return NULL;
+  }
+
+  mask = ((size_t) 1 << table->bits) - 1;
+  for (i = _c_htable_slot(key, table->bits); table->entries[i].data != NULL; i = (i + 1) & mask) {
+    if (table->entries[i].key == key) {
+      return table->entries[i].data;
+    }
+  }
+
+  return NULL;
+}
+
+size_t c_htable_size(const c_htable_t *table) {
+  return table ? table->size : 0;
+}
+
+int c_htable_walk(c_htable_t *table, void *data, c_htable_visit_func *visitor) {
+  size_t n;
+  size_t i;
+
+  if (table == NULL || visitor == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  n = (size_t) 1 << table->bits;
+  for (i = 0; i < n; i++) {
+    if (table->entries[i].data != NULL) {
+      if ((*visitor)(table->entries[i].data, data) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
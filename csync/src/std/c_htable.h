@@ -0,0 +1,121 @@
+/*
+ * cynapses libc functions
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/**
+ * @file c_htable.h
+ *
+ * @brief Interface of the cynapses libc hash table
+ *
+ * A hash table mapping 64-bit keys to data pointers. It uses open addressing
+ * with linear probing: the keys are stored next to the data pointers in one
+ * array, so a lookup usually touches a single cache line and never follows a
+ * pointer until the entry is found. There is no per entry allocation.
+ *
+ * The keys are expected to be hashes already (e.g. from c_jhash64()), they
+ * are only mixed a little before use. Entries can't be removed.
+ *
+ * @defgroup cynHTableInternals cynapses libc hash table functions
+ * @ingroup cynLibraryAPI
+ *
+ * @{
+ */
+
+#ifndef _C_HTABLE_H
+#define _C_HTABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct c_htable_s c_htable_t;
+
+/**
+ * @brief Visit function for the c_htable_walk() functions.
+ *
+ * @param obj    The data of the entry.
+ * @param data   Generic data pointer passed to the walk function.
+ *
+ * @return 0 on success, < 0 to stop the walk. You should set errno.
+ */
+typedef int c_htable_visit_func(void *obj, void *data);
+
+/**
+ * @brief Create a new hash table.
+ *
+ * @param size_hint  Number of entries to make room for, 0 for a small table.
+ *                   The table grows as needed.
+ *
+ * @return The new table, NULL if insufficient memory was available.
+ */
+c_htable_t *c_htable_new(size_t size_hint);
+
+/**
+ * @brief Free the hash table.
+ *
+ * The data of the entries is not freed.
+ *
+ * @param table  The table to free, may be NULL.
+ */
+void c_htable_free(c_htable_t *table);
+
+/**
+ * @brief Insert data into the hash table.
+ *
+ * @param table  The table to insert into.
+ * @param key    The key of the data.
+ * @param data   The data to insert, must not be NULL.
+ *
+ * @return  0 on success, 1 if an entry with this key already exists (it is
+ *          kept), < 0 if an error occured with errno set.
+ */
+int c_htable_insert(c_htable_t *table, uint64_t key, void *data);
+
+/**
+ * @brief Find the data of a key.
+ *
+ * @param table  The table to search, may be NULL.
+ * @param key    The key to look for.
+ *
+ * @return  The data, NULL if the key was not found.
+ */
+void *c_htable_find(const c_htable_t *table, uint64_t key);
+
+/**
+ * @brief Get the number of entries in the hash table.
+ */
+size_t c_htable_size(const c_htable_t *table);
+
+/**
+ * @brief Walk over the hash table in no particular order.
+ *
+ * The visitor may modify the data, but must not insert into the table.
+ *
+ * @param table    Table to walk.
+ * @param data     Data which should be passed to the visitor function.
+ * @param visitor  Visitor function. This will be called for each entry.
+ *
+ * @return   0 on success, less than 0 if an error occured or the visitor
+ *           returned a value less than 0.
+ */
+int c_htable_walk(c_htable_t *table, void *data, c_htable_visit_func *visitor);
+
+/**
+ * }@
+ */
+#endif /* _C_HTABLE_H */
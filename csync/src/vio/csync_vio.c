@@ -31,6 +31,7 @@
 #include "vio/csync_vio.h"
 #include "vio/csync_vio_local.h"
 #include "csync_statedb.h"
+#include "csync_local_walker.h"
 #include "std/c_jhash.h"
 
 #define CSYNC_LOG_CATEGORY_NAME "csync.vio.main"
@@ -49,6 +50,9 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 	if( ctx->callbacks.update_callback ) {
         ctx->callbacks.update_callback(ctx->replica, name, ctx->callbacks.update_callback_userdata);
 	}
+      if (ctx->local.walker) {
+        return csync_local_walker_opendir(ctx->local.walker, name);
+      }
       return csync_vio_local_opendir(name);
       break;
     default:
@@ -75,6 +79,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       rc = 0;
       break;
   case LOCAL_REPLICA:
+      if (ctx->local.walker) {
+        rc = csync_local_walker_closedir(ctx->local.walker, dhandle);
+        break;
+      }
       rc = csync_vio_local_closedir(dhandle);
       break;
   default:
@@ -93,6 +101,9 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
+      if (ctx->local.walker) {
+        return csync_local_walker_readdir(ctx->local.walker, dhandle);
+      }
       return csync_vio_local_readdir(dhandle);
       break;
     default:
@@ -105,6 +116,10 @@ csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle
 
 
 int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
+  return csync_vio_stat_dirent(ctx, NULL, uri, buf);
+}
+
+int csync_vio_stat_dirent(CSYNC *ctx, csync_vio_handle_t *dhandle, const char *uri, csync_vio_file_stat_t *buf) {
   int rc = -1;
 
   switch(ctx->replica) {
@@ -113,7 +128,11 @@ int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf) {
       assert(ctx->replica != REMOTE_REPLICA);
       break;
     case LOCAL_REPLICA:
-      rc = csync_vio_local_stat(uri, buf);
+      if (ctx->local.walker) {
+        rc = csync_local_walker_stat(ctx->local.walker, uri, buf);
+      } else {
+        rc = csync_vio_local_stat_dirent(dhandle, uri, buf);
+      }
       if (rc < 0) {
         CSYNC_LOG(CSYNC_LOG_PRIORITY_ERROR, "Local stat failed, errno %d", errno);
       }
@@ -37,6 +37,8 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle);
 csync_vio_file_stat_t *csync_vio_readdir(CSYNC *ctx, csync_vio_handle_t *dhandle);
 
 int csync_vio_stat(CSYNC *ctx, const char *uri, csync_vio_file_stat_t *buf);
+/* Like csync_vio_stat() for the entry just returned by csync_vio_readdir() on dhandle */
+int csync_vio_stat_dirent(CSYNC *ctx, csync_vio_handle_t *dhandle, const char *uri, csync_vio_file_stat_t *buf);
 
 char *csync_vio_get_status_string(CSYNC *ctx);
 
@@ -29,4 +29,8 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle);
 
 int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf);
 
+/* Stat the entry last returned by csync_vio_local_readdir() on dhandle. Where
+ * possible this works relative to the open directory instead of resolving uri. */
+int csync_vio_local_stat_dirent(csync_vio_handle_t *dhandle, const char *uri, csync_vio_file_stat_t *buf);
+
 #endif /* _CSYNC_VIO_LOCAL_H */
@@ -25,6 +25,11 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "c_private.h"
 #include "c_lib.h"
@@ -39,10 +44,165 @@
  * directory functions
  */
 
+#if defined(__linux__) && defined(SYS_getdents64)
+/*
+ * On Linux the directory is read with getdents64() into a large buffer and
+ * the entries are stat'ed relative to the directory fd with fstatat(). That
+ * saves syscalls on big directories and avoids resolving the full path again
+ * for every entry.
+ */
+#define CSYNC_VIO_LOCAL_GETDENTS 1
+
+/* Enough for a few hundred entries per syscall */
+#define DIRENT_BUFFER_SIZE (64 * 1024)
+
+/* The kernel layout, glibc does not export it */
+struct csync_linux_dirent64 {
+  uint64_t       d_ino;
+  int64_t        d_off;
+  unsigned short d_reclen;
+  unsigned char  d_type;
+  char           d_name[];
+};
+
+typedef struct dhandle_s {
+  int fd;
+  char *path;
+  char *buf;
+  long buf_len;
+  long buf_pos;
+  const char *last_name; /* locale name of the entry returned last, points into buf */
+} dhandle_t;
+#else
 typedef struct dhandle_s {
   DIR *dh;
   char *path;
 } dhandle_t;
+#endif
+
+static void _csync_vio_local_set_dirent_type(csync_vio_file_stat_t *file_stat, unsigned char d_type) {
+  switch (d_type) {
+    case DT_FIFO:
+    case DT_SOCK:
+    case DT_CHR:
+    case DT_BLK:
+      break;
+    case DT_DIR:
+    case DT_REG:
+      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+      if (d_type == DT_DIR) {
+        file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+      } else {
+        file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+      }
+      break;
+    case DT_UNKNOWN:
+      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+      file_stat->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
+    default:
+      break;
+  }
+}
+
+/* Fills the name of a new file stat, returns -1 if out of memory */
+static int _csync_vio_local_set_dirent_name(csync_vio_file_stat_t *file_stat,
+                                            const dhandle_t *handle, const char *d_name) {
+  file_stat->name = c_utf8_from_locale(d_name);
+  if (file_stat->name == NULL) {
+      if (asprintf(&file_stat->original_name, "%s/%s", handle->path, d_name) < 0) {
+          return -1;
+      }
+      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
+                d_name, handle->path);
+  }
+  return 0;
+}
+
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+
+csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
+  dhandle_t *handle = NULL;
+  mbchar_t *dirname = NULL;
+
+  handle = c_malloc(sizeof(dhandle_t));
+
+  dirname = c_utf8_path_to_locale(name);
+
+  handle->fd = open(dirname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (handle->fd < 0) {
+    c_free_locale_string(dirname);
+    SAFE_FREE(handle);
+    return NULL;
+  }
+
+  handle->path = c_strdup(name);
+  handle->buf = c_malloc(DIRENT_BUFFER_SIZE);
+  handle->buf_len = 0;
+  handle->buf_pos = 0;
+  handle->last_name = NULL;
+  c_free_locale_string(dirname);
+
+  return (csync_vio_handle_t *) handle;
+}
+
+int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
+  dhandle_t *handle = NULL;
+  int rc = -1;
+
+  if (dhandle == NULL) {
+    errno = EBADF;
+    return -1;
+  }
+
+  handle = (dhandle_t *) dhandle;
+  rc = close(handle->fd);
+
+  SAFE_FREE(handle->buf);
+  SAFE_FREE(handle->path);
+  SAFE_FREE(handle);
+
+  return rc;
+}
+
+csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
+
+  dhandle_t *handle = NULL;
+  csync_vio_file_stat_t *file_stat = NULL;
+  struct csync_linux_dirent64 *dirent = NULL;
+
+  handle = (dhandle_t *) dhandle;
+  handle->last_name = NULL;
+
+  errno = 0;
+  if (handle->buf_pos >= handle->buf_len) {
+    long n = syscall(SYS_getdents64, handle->fd, handle->buf, DIRENT_BUFFER_SIZE);
+    if (n <= 0) {
+      /* 0 is the end of the directory, errno is set on error */
+      return NULL;
+    }
+    handle->buf_len = n;
+    handle->buf_pos = 0;
+  }
+  dirent = (struct csync_linux_dirent64 *) (handle->buf + handle->buf_pos);
+  handle->buf_pos += dirent->d_reclen;
+
+  file_stat = csync_vio_file_stat_new();
+  if (file_stat == NULL) {
+    return NULL;
+  }
+  file_stat->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
+
+  if (_csync_vio_local_set_dirent_name(file_stat, handle, dirent->d_name) < 0) {
+    SAFE_FREE(file_stat);
+    return NULL;
+  }
+  _csync_vio_local_set_dirent_type(file_stat, dirent->d_type);
+  handle->last_name = dirent->d_name;
+
+  return file_stat;
+}
+
+#else
 
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
@@ -103,39 +263,13 @@ csync_vio_file_stat_t *csync_vio_local_readdir(csync_vio_handle_t *dhandle) {
   if (dirent == NULL) {
       goto err;
   }
-  file_stat->name = c_utf8_from_locale(dirent->d_name);
-  if (file_stat->name == NULL) {
-      //file_stat->original_name = c_strdup(dirent->d_name);
-      if (asprintf(&file_stat->original_name, "%s/%s", handle->path, dirent->d_name) < 0) {
-          goto err;
-      }
-      CSYNC_LOG(CSYNC_LOG_PRIORITY_WARN, "Invalid characters in file/directory name, please rename: \"%s\" (%s)",
-                dirent->d_name, handle->path);
+  if (_csync_vio_local_set_dirent_name(file_stat, handle, dirent->d_name) < 0) {
+      goto err;
   }
 
   /* Check for availability of d_type, see manpage. */
 #if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
-  switch (dirent->d_type) {
-    case DT_FIFO:
-    case DT_SOCK:
-    case DT_CHR:
-    case DT_BLK:
-      break;
-    case DT_DIR:
-    case DT_REG:
-      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      if (dirent->d_type == DT_DIR) {
-        file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-      } else {
-        file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-      }
-      break;
-    case DT_UNKNOWN:
-      file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-      file_stat->type = CSYNC_VIO_FILE_TYPE_UNKNOWN;
-    default:
-      break;
-  }
+  _csync_vio_local_set_dirent_type(file_stat, dirent->d_type);
 #endif
 
   return file_stat;
@@ -146,20 +280,12 @@ err:
   return NULL;
 }
 
+#endif /* CSYNC_VIO_LOCAL_GETDENTS */
 
-int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
-  csync_stat_t sb;
-
-  mbchar_t *wuri = c_utf8_path_to_locale( uri );
-
-  if( _tstat(wuri, &sb) < 0) {
-    c_free_locale_string(wuri);
-    return -1;
-  }
-
+static void _csync_vio_local_fill_stat(const csync_stat_t *st, csync_vio_file_stat_t *buf) {
   buf->fields = CSYNC_VIO_FILE_STAT_FIELDS_NONE;
 
-  switch(sb.st_mode & S_IFMT) {
+  switch(st->st_mode & S_IFMT) {
     case S_IFBLK:
       buf->type = CSYNC_VIO_FILE_TYPE_BLOCK_DEVICE;
       break;
@@ -187,7 +313,7 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
   }
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
 
-  buf->mode = sb.st_mode;
+  buf->mode = st->st_mode;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MODE;
 
   if (buf->type == CSYNC_VIO_FILE_TYPE_SYMBOLIC_LINK) {
@@ -197,27 +323,59 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
     buf->flags = CSYNC_VIO_FILE_FLAGS_NONE;
   }
 #ifdef __APPLE__
-  if (sb.st_flags & UF_HIDDEN) {
+  if (st->st_flags & UF_HIDDEN) {
       buf->flags |= CSYNC_VIO_FILE_FLAGS_HIDDEN;
   }
 #endif
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_FLAGS;
 
-  buf->inode = sb.st_ino;
+  buf->inode = st->st_ino;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_INODE;
 
-  buf->atime = sb.st_atime;
+  buf->atime = st->st_atime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ATIME;
 
-  buf->mtime = sb.st_mtime;
+  buf->mtime = st->st_mtime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
 
-  buf->ctime = sb.st_ctime;
+  buf->ctime = st->st_ctime;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_CTIME;
 
-  buf->size = sb.st_size;
+  buf->size = st->st_size;
   buf->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+}
+
+int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
+  csync_stat_t sb;
+
+  mbchar_t *wuri = c_utf8_path_to_locale( uri );
+
+  if( _tstat(wuri, &sb) < 0) {
+    c_free_locale_string(wuri);
+    return -1;
+  }
+
+  _csync_vio_local_fill_stat(&sb, buf);
 
   c_free_locale_string(wuri);
   return 0;
 }
+
+int csync_vio_local_stat_dirent(csync_vio_handle_t *dhandle, const char *uri, csync_vio_file_stat_t *buf) {
+#ifdef CSYNC_VIO_LOCAL_GETDENTS
+  dhandle_t *handle = (dhandle_t *) dhandle;
+  csync_stat_t sb;
+
+  if (handle != NULL && handle->last_name != NULL) {
+    /* same as the lstat() in csync_vio_local_stat(), but relative to the open directory */
+    if (fstatat(handle->fd, handle->last_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+      return -1;
+    }
+    _csync_vio_local_fill_stat(&sb, buf);
+    return 0;
+  }
+#else
+  (void) dhandle;
+#endif
+  return csync_vio_local_stat(uri, buf);
+}
@@ -254,3 +254,8 @@ int csync_vio_local_stat(const char *uri, csync_vio_file_stat_t *buf) {
     CloseHandle(h);
     return 0;
 }
+
+int csync_vio_local_stat_dirent(csync_vio_handle_t *dhandle, const char *uri, csync_vio_file_stat_t *buf) {
+    (void) dhandle;
+    return csync_vio_local_stat(uri, buf);
+}
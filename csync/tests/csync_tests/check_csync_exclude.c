@@ -263,6 +263,207 @@ static void check_csync_pathes(void **state)
     assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
 }
 
+static void check_csync_excluded_compiled(void **state)
+{
+    CSYNC *csync = *state;
+    csync_exclude_matcher_t *matcher = NULL;
+    int rc;
+
+    /* the first matching pattern decides */
+    _csync_exclude_add(&csync->excludes, "]*.bak");
+    _csync_exclude_add(&csync->excludes, "*.bak");
+    _csync_exclude_add(&csync->excludes, "a?c*.tmp");
+    _csync_exclude_add(&csync->excludes, "*cache*/");
+
+    rc = csync_exclude_compile(csync->excludes, &matcher);
+    assert_int_equal(rc, 0);
+
+    rc = csync_excluded_traversal_compiled(matcher, "dir/file.bak", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    rc = csync_excluded_traversal_compiled(matcher, "dir/file.bak", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_traversal_compiled(matcher, "abcde.tmp", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_traversal_compiled(matcher, "acde.tmp", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_traversal_compiled(matcher, "x/my_cache_dir", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_traversal_compiled(matcher, "x/my_cache_dir", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+
+    rc = csync_excluded_no_ctx_compiled(matcher, "x/my_cache_dir/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_compiled(matcher, ".kde/share/config/kwin.eventsrc", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx_compiled(matcher, "mozilla/.htaccess", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_compiled(matcher, "unicode/пятницы.txt", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+
+    /* the matcher does not see later changes of the list */
+    _csync_exclude_add(&csync->excludes, "later");
+    rc = csync_excluded_traversal_compiled(matcher, "later", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_traversal(csync->excludes, "later", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+
+    /* same results as the loop over the list */
+    {
+        const char *paths[] = { "dir/file.bak", "abcde.tmp", "acde.tmp", "x/my_cache_dir", "x/my_cache_dir/file",
+                                "mozilla/.htaccess", "a/b/c.txt", "later", "x/later/y", "dir/.csync_journal.db" };
+        const int types[] = { CSYNC_FTW_TYPE_FILE, CSYNC_FTW_TYPE_DIR };
+        size_t i, j;
+
+        csync_exclude_matcher_free(matcher);
+        rc = csync_exclude_compile(csync->excludes, &matcher);
+        assert_int_equal(rc, 0);
+        for (i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+            for (j = 0; j < 2; j++) {
+                assert_int_equal(csync_excluded_traversal_compiled(matcher, paths[i], types[j]),
+                                 csync_excluded_traversal(csync->excludes, paths[i], types[j]));
+                assert_int_equal(csync_excluded_no_ctx_compiled(matcher, paths[i], types[j]),
+                                 csync_excluded_no_ctx(csync->excludes, paths[i], types[j]));
+            }
+        }
+    }
+
+    csync_exclude_matcher_free(matcher);
+
+    /* without a list only the built in rules apply */
+    rc = csync_excluded_traversal_compiled(NULL, "dir/.csync_journal.db", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_SILENTLY_EXCLUDED);
+    rc = csync_excluded_traversal_compiled(NULL, "dir/file.bak", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+}
+
+static void check_csync_excluded_cached(void **state)
+{
+    CSYNC *csync = *state;
+    csync_exclude_matcher_t *matcher = NULL;
+    csync_exclude_cache_t *cache = NULL;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    int rc;
+
+    _csync_exclude_add(&csync->excludes, "*cache*/");
+    _csync_exclude_add(&csync->excludes, "/excludepath/withsubdir");
+    rc = csync_exclude_compile(csync->excludes, &matcher);
+    assert_int_equal(rc, 0);
+    cache = csync_exclude_cache_new();
+    assert_non_null(cache);
+
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/c/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    csync_exclude_cache_stats(cache, &hits, &misses);
+    assert_int_equal(hits, 0);
+    assert_int_equal(misses, 3);
+
+    /* the entries of a directory only check their name */
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/c/Thumbs.db", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/c/d", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/other", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    csync_exclude_cache_stats(cache, &hits, &misses);
+    assert_int_equal(hits, 3);
+    assert_int_equal(misses, 3);
+
+    /* the decision of a directory is inherited */
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "x/my_cache_dir/sub/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "x/my_cache_dir/sub/other", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "/excludepath/withsubdir/foo", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "/excludepath/foo", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+
+    /* the same results as without the cache */
+    rc = csync_excluded_no_ctx_cached(matcher, cache, ".kde/share/config/kwin.eventsrc", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, csync_excluded_no_ctx_compiled(matcher, ".kde/share/config/kwin.eventsrc", CSYNC_FTW_TYPE_FILE));
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "mozilla/.htaccess", CSYNC_FTW_TYPE_DIR);
+    assert_int_equal(rc, csync_excluded_no_ctx_compiled(matcher, "mozilla/.htaccess", CSYNC_FTW_TYPE_DIR));
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "/a/.snapshot/b", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, csync_excluded_no_ctx_compiled(matcher, "/a/.snapshot/b", CSYNC_FTW_TYPE_FILE));
+
+    /* clearing forgets the directories, but keeps counting */
+    csync_exclude_cache_stats(cache, &hits, &misses);
+    csync_exclude_cache_clear(cache);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/c/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    {
+        uint64_t hits2 = 0;
+        uint64_t misses2 = 0;
+        csync_exclude_cache_stats(cache, &hits2, &misses2);
+        assert_int_equal(hits2, hits);
+        assert_int_equal(misses2, misses + 3);
+    }
+
+    csync_exclude_cache_free(cache);
+    csync_exclude_matcher_free(matcher);
+}
+
+static void check_csync_excluded_cache_lookup(void **state)
+{
+    CSYNC *csync = *state;
+    csync_exclude_matcher_t *matcher = NULL;
+    csync_exclude_cache_t *cache = NULL;
+    CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    int rc;
+
+    _csync_exclude_add(&csync->excludes, "*cache*/");
+    rc = csync_exclude_compile(csync->excludes, &matcher);
+    assert_int_equal(rc, 0);
+    cache = csync_exclude_cache_new();
+    assert_non_null(cache);
+
+    /* nothing is cached yet, and the lookup doesn't add anything */
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "x/my_cache_dir/file", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, -1);
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "x/my_cache_dir/file", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, -1);
+    csync_exclude_cache_stats(cache, &hits, &misses);
+    assert_int_equal(hits, 0);
+    assert_int_equal(misses, 0);
+
+    /* a path without directory doesn't need the cache */
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "Thumbs.db", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, 0);
+    assert_int_equal(match, CSYNC_FILE_EXCLUDE_AND_REMOVE);
+
+    /* once cached, the lookup gives the same results and doesn't count */
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "x/my_cache_dir/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_cached(matcher, cache, "a/b/file", CSYNC_FTW_TYPE_FILE);
+    assert_int_equal(rc, CSYNC_NOT_EXCLUDED);
+    csync_exclude_cache_stats(cache, &hits, &misses);
+
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "x/my_cache_dir/other", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, 1);
+    assert_int_equal(match, CSYNC_FILE_EXCLUDE_LIST);
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "a/b/Thumbs.db", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, 1);
+    assert_int_equal(match, CSYNC_FILE_EXCLUDE_AND_REMOVE);
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "a/b/other", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, 1);
+    assert_int_equal(match, CSYNC_NOT_EXCLUDED);
+    rc = csync_excluded_no_ctx_cache_lookup(matcher, cache, "a/c/other", CSYNC_FTW_TYPE_FILE, &match);
+    assert_int_equal(rc, -1);
+    {
+        uint64_t hits2 = 0;
+        uint64_t misses2 = 0;
+        csync_exclude_cache_stats(cache, &hits2, &misses2);
+        assert_int_equal(hits2, hits);
+        assert_int_equal(misses2, misses);
+    }
+
+    csync_exclude_cache_free(cache);
+    csync_exclude_matcher_free(matcher);
+}
+
 static void check_csync_is_windows_reserved_word() {
     assert_true(csync_is_windows_reserved_word("CON"));
     assert_true(csync_is_windows_reserved_word("con"));
@@ -324,6 +525,50 @@ static void check_csync_excluded_performance(void **state)
         const double perCallMs = total / 2 / N * 1000;
         printf("csync_excluded_traversal: %f ms per call\n", perCallMs);
     }
+
+    {
+        struct timeval before, after;
+        csync_exclude_matcher_t *matcher = NULL;
+        gettimeofday(&before, 0);
+
+        assert_int_equal(csync_exclude_compile(csync->excludes, &matcher), 0);
+        for (int i = 0; i < N; ++i) {
+            totalRc += csync_excluded_traversal_compiled(matcher, "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
+            totalRc += csync_excluded_traversal_compiled(matcher, "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
+        }
+        csync_exclude_matcher_free(matcher);
+        assert_int_equal(totalRc, CSYNC_NOT_EXCLUDED); // mainly to avoid optimization
+
+        gettimeofday(&after, 0);
+
+        const double total = (after.tv_sec - before.tv_sec)
+                + (after.tv_usec - before.tv_usec) / 1.0e6;
+        const double perCallMs = total / 2 / N * 1000;
+        printf("csync_excluded_traversal_compiled: %f ms per call\n", perCallMs);
+    }
+
+    {
+        struct timeval before, after;
+        csync_exclude_matcher_t *matcher = NULL;
+        csync_exclude_cache_t *cache = csync_exclude_cache_new();
+        gettimeofday(&before, 0);
+
+        assert_int_equal(csync_exclude_compile(csync->excludes, &matcher), 0);
+        for (int i = 0; i < N; ++i) {
+            totalRc += csync_excluded_no_ctx_cached(matcher, cache, "/this/is/quite/a/long/path/with/many/components", CSYNC_FTW_TYPE_DIR);
+            totalRc += csync_excluded_no_ctx_cached(matcher, cache, "/1/2/3/4/5/6/7/8/9/10/11/12/13/14/15/16/17/18/19/20/21/22/23/24/25/26/27/29", CSYNC_FTW_TYPE_FILE);
+        }
+        csync_exclude_cache_free(cache);
+        csync_exclude_matcher_free(matcher);
+        assert_int_equal(totalRc, CSYNC_NOT_EXCLUDED); // mainly to avoid optimization
+
+        gettimeofday(&after, 0);
+
+        const double total = (after.tv_sec - before.tv_sec)
+                + (after.tv_usec - before.tv_usec) / 1.0e6;
+        const double perCallMs = total / 2 / N * 1000;
+        printf("csync_excluded_no_ctx_cached: %f ms per call\n", perCallMs);
+    }
 }
 
 int torture_run_tests(void)
@@ -334,6 +579,9 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_excluded, setup_init, teardown),
         unit_test_setup_teardown(check_csync_excluded_traversal, setup_init, teardown),
         unit_test_setup_teardown(check_csync_pathes, setup_init, teardown),
+        unit_test_setup_teardown(check_csync_excluded_compiled, setup_init, teardown),
+        unit_test_setup_teardown(check_csync_excluded_cached, setup_init, teardown),
+        unit_test_setup_teardown(check_csync_excluded_cache_lookup, setup_init, teardown),
         unit_test_setup_teardown(check_csync_is_windows_reserved_word, setup_init, teardown),
         unit_test_setup_teardown(check_csync_excluded_performance, setup_init, teardown),
     };
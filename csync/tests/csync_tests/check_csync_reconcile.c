@@ -0,0 +1,337 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include "csync_reconcile.c"
+
+#define TESTDB "/tmp/check_csync1/test.db"
+
+static void setup(void **state)
+{
+    CSYNC *csync;
+    int rc;
+
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    *state = csync;
+}
+
+/* The journal knows 'old.txt': 12 bytes with the checksum SHA1:aa */
+static void setup_db(void **state)
+{
+    CSYNC *csync;
+    sqlite3 *db = NULL;
+    char *errmsg = NULL;
+    int rc;
+
+    const char *sql = "CREATE TABLE IF NOT EXISTS metadata ("
+        "phash INTEGER(8),"
+        "pathlen INTEGER,"
+        "path VARCHAR(4096),"
+        "inode INTEGER,"
+        "uid INTEGER,"
+        "gid INTEGER,"
+        "mode INTEGER,"
+        "modtime INTEGER(8),"
+        "type INTEGER,"
+        "md5 VARCHAR(32),"
+        "fileid VARCHAR(128),"
+        "remotePerm VARCHAR(128),"
+        "filesize BIGINT,"
+        "ignoredChildrenRemote INT,"
+        "contentChecksum TEXT,"
+        "contentChecksumTypeId INTEGER,"
+        "PRIMARY KEY(phash)"
+        ");";
+    char insert[512];
+
+    setup(state);
+    csync = *state;
+
+    snprintf(insert, sizeof(insert), "INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) VALUES"
+        "(%" PRId64 ", 7, 'old.txt', 23, 42, 43, 55, 66, 0, 'etag1', '00000001oc', 'WDNVCK', 12, 0, 'SHA1:aa', 1);",
+        (int64_t) c_jhash64((uint8_t *) "old.txt", 7, 0));
+
+    rc = sqlite3_open_v2(TESTDB, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_exec(db, insert, NULL, NULL, &errmsg);
+    assert_int_equal(rc, SQLITE_OK);
+    sqlite3_close(db);
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+}
+
+static void teardown(void **state)
+{
+    CSYNC *csync = *state;
+    int rc;
+
+    csync_statedb_free_snapshot(csync);
+    rc = csync_destroy(csync);
+    assert_int_equal(rc, 0);
+    rc = system("rm -rf /tmp/check_csync1");
+    assert_int_equal(rc, 0);
+
+    *state = NULL;
+}
+
+static csync_file_stat_t *add_file(CSYNC *csync, c_htable_t *tree, const char *path, int type,
+                                   enum csync_instructions_e instruction, int64_t size)
+{
+    size_t len = strlen(path);
+    csync_file_stat_t *st = csync_file_stat_new(csync, len);
+    int rc;
+
+    assert_non_null(st);
+    memcpy(st->path, path, len + 1);
+    st->pathlen = len;
+    st->phash = c_jhash64((uint8_t *) path, len, 0);
+    st->type = type;
+    st->instruction = instruction;
+    st->size = size;
+    st->modtime = 1000;
+    rc = c_htable_insert(tree, st->phash, st);
+    assert_int_equal(rc, 0);
+    return st;
+}
+
+static csync_file_stat_t *find_file(c_htable_t *tree, const char *path)
+{
+    csync_file_stat_t *st = c_htable_find(tree, c_jhash64((uint8_t *) path, strlen(path), 0));
+    assert_non_null(st);
+    return st;
+}
+
+/* Every new file has the content of 'old.txt' */
+static const char *checksum_hook(const char *path, uint32_t checksumTypeId, void *userdata)
+{
+    (void) path;
+    (void) userdata;
+    assert_int_equal(checksumTypeId, 1);
+    return c_strdup("SHA1:aa");
+}
+
+static int reconcile_local(CSYNC *csync)
+{
+    csync->checksum_move_detection = true;
+    csync->callbacks.checksum_hook = checksum_hook;
+    csync->current = LOCAL_REPLICA;
+    return csync_reconcile_updates(csync);
+}
+
+static void check_csync_reconcile_checksum_move(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *moved;
+    csync_file_stat_t *origin;
+    int rc;
+
+    moved = add_file(csync, csync->local.tree, "new.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 12);
+    origin = add_file(csync, csync->remote.tree, "old.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 12);
+    add_file(csync, csync->local.tree, "other.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 13);
+
+    rc = reconcile_local(csync);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(moved->instruction, CSYNC_INSTRUCTION_NONE);
+    assert_int_equal(origin->instruction, CSYNC_INSTRUCTION_RENAME);
+    assert_string_equal(origin->destpath, "new.txt");
+    assert_true(origin->should_update_metadata);
+    /* no journal entry of that size */
+    assert_int_equal(find_file(csync->local.tree, "other.txt")->instruction, CSYNC_INSTRUCTION_NEW);
+}
+
+static void check_csync_reconcile_checksum_copy(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *copy;
+    csync_file_stat_t *origin;
+    int rc;
+
+    /* 'old.txt' is still there locally, so 'new.txt' is a copy */
+    copy = add_file(csync, csync->local.tree, "new.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 12);
+    add_file(csync, csync->local.tree, "old.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 12);
+    origin = add_file(csync, csync->remote.tree, "old.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 12);
+
+    rc = reconcile_local(csync);
+    assert_int_equal(rc, 0);
+
+    assert_int_equal(copy->instruction, CSYNC_INSTRUCTION_NEW);
+    assert_int_equal(origin->instruction, CSYNC_INSTRUCTION_NONE);
+}
+
+static void check_csync_reconcile_checksum_move_once(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *first;
+    csync_file_stat_t *second;
+    csync_file_stat_t *origin;
+    int rc;
+
+    first = add_file(csync, csync->local.tree, "new1.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 12);
+    second = add_file(csync, csync->local.tree, "new2.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_EVAL, 12);
+    origin = add_file(csync, csync->remote.tree, "old.txt", CSYNC_FTW_TYPE_FILE, CSYNC_INSTRUCTION_NONE, 12);
+
+    rc = reconcile_local(csync);
+    assert_int_equal(rc, 0);
+
+    /* one of them is the move, the other one a new file */
+    assert_int_equal(origin->instruction, CSYNC_INSTRUCTION_RENAME);
+    if (c_streq(origin->destpath, "new1.txt")) {
+        assert_int_equal(first->instruction, CSYNC_INSTRUCTION_NONE);
+        assert_int_equal(second->instruction, CSYNC_INSTRUCTION_NEW);
+    } else {
+        assert_string_equal(origin->destpath, "new2.txt");
+        assert_int_equal(first->instruction, CSYNC_INSTRUCTION_NEW);
+        assert_int_equal(second->instruction, CSYNC_INSTRUCTION_NONE);
+    }
+}
+
+/*
+ * A big tree with directories that are new on both sides, ignored on the server
+ * or missing there, and files in all the states.
+ */
+static void fill_trees(CSYNC *csync)
+{
+    char path[32];
+    int d, f;
+
+    for (d = 0; d < 100; ++d) {
+        snprintf(path, sizeof(path), "d%03d", d);
+        add_file(csync, csync->local.tree, path, CSYNC_FTW_TYPE_DIR,
+                 d % 3 == 0 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE, 0);
+        if (d % 5 != 1) {
+            add_file(csync, csync->remote.tree, path, CSYNC_FTW_TYPE_DIR,
+                     d % 5 == 0 ? CSYNC_INSTRUCTION_IGNORE
+                                : d % 5 == 2 ? CSYNC_INSTRUCTION_EVAL : CSYNC_INSTRUCTION_NONE, 0);
+        }
+
+        for (f = 0; f < 250; ++f) {
+            snprintf(path, sizeof(path), "d%03d/f%03d", d, f);
+            if (f % 7 != 0) {
+                csync_file_stat_t *st = add_file(csync, csync->local.tree, path, CSYNC_FTW_TYPE_FILE,
+                                                 f % 4 == 0 ? CSYNC_INSTRUCTION_NONE : CSYNC_INSTRUCTION_EVAL, f);
+                st->modtime += f % 3 == 0;
+            }
+            if (f % 5 != 0) {
+                add_file(csync, csync->remote.tree, path, CSYNC_FTW_TYPE_FILE,
+                         f % 3 == 0 ? CSYNC_INSTRUCTION_NONE : CSYNC_INSTRUCTION_EVAL, f);
+            }
+        }
+    }
+}
+
+static void reconcile_trees(CSYNC *csync, int threads)
+{
+    int rc;
+
+    csync->reconcile_threads = threads;
+    csync->current = LOCAL_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+    csync->current = REMOTE_REPLICA;
+    rc = csync_reconcile_updates(csync);
+    assert_int_equal(rc, 0);
+}
+
+struct compare_s {
+    c_htable_t *tree;
+    int differences;
+    int ignored;
+};
+
+static int compare_visitor(void *obj, void *data)
+{
+    csync_file_stat_t *st = obj;
+    struct compare_s *compare = data;
+    csync_file_stat_t *other = c_htable_find(compare->tree, st->phash);
+
+    assert_non_null(other);
+    if (st->instruction != other->instruction) {
+        printf("%s: %s != %s\n", st->path, csync_instruction_str(st->instruction),
+               csync_instruction_str(other->instruction));
+        compare->differences++;
+    }
+    if (st->instruction == CSYNC_INSTRUCTION_IGNORE) {
+        compare->ignored++;
+    }
+    return 0;
+}
+
+static void check_csync_reconcile_parallel(void **state)
+{
+    CSYNC *serial = *state;
+    CSYNC *parallel = NULL;
+    struct compare_s compare;
+    int rc;
+
+    rc = csync_create(&parallel, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_init(parallel);
+    assert_int_equal(rc, 0);
+
+    fill_trees(serial);
+    fill_trees(parallel);
+    /* both trees are big enough for four threads */
+    assert_true(c_htable_size(parallel->local.tree) / 4 >= RECONCILE_MIN_FILES_PER_THREAD);
+    assert_true(c_htable_size(parallel->remote.tree) / 4 >= RECONCILE_MIN_FILES_PER_THREAD);
+
+    reconcile_trees(serial, 1);
+    reconcile_trees(parallel, 4);
+
+    ZERO_STRUCT(compare);
+    compare.tree = parallel->local.tree;
+    rc = c_htable_walk(serial->local.tree, &compare, compare_visitor);
+    assert_int_equal(rc, 0);
+    compare.tree = parallel->remote.tree;
+    rc = c_htable_walk(serial->remote.tree, &compare, compare_visitor);
+    assert_int_equal(rc, 0);
+    assert_int_equal(compare.differences, 0);
+    /* the files in the directories that are ignored on the server */
+    assert_true(compare.ignored > 0);
+
+    rc = csync_destroy(parallel);
+    assert_int_equal(rc, 0);
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_reconcile_checksum_move, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_checksum_copy, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_checksum_move_once, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_reconcile_parallel, setup, teardown),
+    };
+
+    return run_tests(tests);
+}
@@ -0,0 +1,119 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include "csync_private.h"
+#include "csync_rename.h"
+#include <string.h>
+
+static void setup(void **state)
+{
+    csync_rename_trie_t *trie = csync_rename_trie_new();
+
+    assert_non_null(trie);
+    assert_true(csync_rename_trie_is_empty(trie));
+
+    csync_rename_trie_insert(trie, "A", "X");
+    csync_rename_trie_insert(trie, "A/B/C", "Y/Z");
+    csync_rename_trie_insert(trie, "AB", "W");
+
+    *state = trie;
+}
+
+static void teardown(void **state)
+{
+    csync_rename_trie_free(*state);
+    *state = NULL;
+}
+
+static void check_csync_rename_trie_find(void **state)
+{
+    csync_rename_trie_t *trie = *state;
+    size_t prefixlen = 0;
+    const char *target;
+
+    assert_false(csync_rename_trie_is_empty(trie));
+
+    target = csync_rename_trie_find(trie, "A/file", &prefixlen);
+    assert_string_equal(target, "X");
+    assert_string_equal("A/file" + prefixlen, "/file");
+
+    /* the deepest renamed parent wins */
+    target = csync_rename_trie_find(trie, "A/B/C/D/file", &prefixlen);
+    assert_string_equal(target, "Y/Z");
+    assert_string_equal("A/B/C/D/file" + prefixlen, "/D/file");
+
+    target = csync_rename_trie_find(trie, "A/B/file", &prefixlen);
+    assert_string_equal(target, "X");
+    assert_string_equal("A/B/file" + prefixlen, "/B/file");
+
+    target = csync_rename_trie_find(trie, "AB/file", &prefixlen);
+    assert_string_equal(target, "W");
+}
+
+static void check_csync_rename_trie_find_none(void **state)
+{
+    csync_rename_trie_t *trie = *state;
+    size_t prefixlen = 0;
+
+    /* only the parents of a path are renamed */
+    assert_null(csync_rename_trie_find(trie, "A", &prefixlen));
+    assert_null(csync_rename_trie_find(trie, "AB", &prefixlen));
+    assert_null(csync_rename_trie_find(trie, "ABC/file", &prefixlen));
+    assert_null(csync_rename_trie_find(trie, "B/A/file", &prefixlen));
+    assert_null(csync_rename_trie_find(trie, "", &prefixlen));
+}
+
+static void check_csync_rename_trie_renamed_to(void **state)
+{
+    CSYNC ctx;
+    const csync_rename_trie_t *trie = NULL;
+    size_t prefixlen = 0;
+    char *adjusted = NULL;
+
+    (void) state;
+    memset(&ctx, 0, sizeof(ctx));
+
+    assert_null(csync_rename_trie_renamed_to(&ctx));
+
+    csync_rename_record(&ctx, "A/B", "X");
+    trie = csync_rename_trie_renamed_to(&ctx);
+    assert_non_null(trie);
+    assert_string_equal(csync_rename_trie_find(trie, "A/B/file", &prefixlen), "X");
+
+    /* the same as the adjusted path */
+    adjusted = csync_rename_adjust_path(&ctx, "A/B/file");
+    assert_string_equal(adjusted, "X/file");
+    SAFE_FREE(adjusted);
+
+    csync_rename_destroy(&ctx);
+    assert_null(csync_rename_trie_renamed_to(&ctx));
+}
+
+int torture_run_tests(void)
+{
+    const UnitTest tests[] = {
+        unit_test_setup_teardown(check_csync_rename_trie_find, setup, teardown),
+        unit_test_setup_teardown(check_csync_rename_trie_find_none, setup, teardown),
+        unit_test(check_csync_rename_trie_renamed_to),
+    };
+
+    return run_tests(tests);
+}
@@ -98,6 +98,51 @@ static void setup_db(void **state)
 
 }
 
+static void setup_db_full(void **state)
+{
+    char *errmsg;
+    int rc = 0;
+    sqlite3 *db = NULL;
+
+    const char *sql = "CREATE TABLE IF NOT EXISTS metadata ("
+        "phash INTEGER(8),"
+        "pathlen INTEGER,"
+        "path VARCHAR(4096),"
+        "inode INTEGER,"
+        "uid INTEGER,"
+        "gid INTEGER,"
+        "mode INTEGER,"
+        "modtime INTEGER(8),"
+        "type INTEGER,"
+        "md5 VARCHAR(32),"
+        "fileid VARCHAR(128),"
+        "remotePerm VARCHAR(128),"
+        "filesize BIGINT,"
+        "ignoredChildrenRemote INT,"
+        "contentChecksum TEXT,"
+        "contentChecksumTypeId INTEGER,"
+        "PRIMARY KEY(phash)"
+        ");";
+
+    const char *sql2 = "INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) VALUES"
+        "(42, 15, 'Its funny stuff', 23, 42, 43, 55, 66, 2, 'etag1', '00000001oc', 'WDNVCK', 1024, 0, 'abc', 1),"
+        "(7, 3, 'dir', 24, 42, 43, 55, 67, 1, 'etag2', '00000002oc', 'RDNVCK', 0, 1, NULL, 0),"
+        "(-5, 8, 'dir/file', 23, 42, 43, 55, 68, 0, NULL, '', '', 12, 0, NULL, 0);";
+
+    setup(state);
+    rc = sqlite3_open( TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = sqlite3_exec( db, sql2, NULL, NULL, &errmsg );
+    assert_int_equal(rc, SQLITE_OK);
+
+    sqlite3_close(db);
+}
+
 static void teardown(void **state) {
     CSYNC *csync = *state;
     int rc = 0;
@@ -157,11 +202,11 @@ static void check_csync_statedb_insert_metadata(void **state)
     assert_int_equal(rc, 0);
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t) + 30 );
+        st = csync_file_stat_new(csync, 29);
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_htable_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -176,11 +221,11 @@ static void check_csync_statedb_write(void **state)
     int i, rc;
 
     for (i = 0; i < 100; i++) {
-        st = c_malloc(sizeof(csync_file_stat_t) + 30);
+        st = csync_file_stat_new(csync, 29);
         snprintf(st->path, 29, "file_%d" , i );
         st->phash = i;
 
-        rc = c_rbtree_insert(csync->local.tree, (void *) st);
+        rc = c_htable_insert(csync->local.tree, st->phash, st);
         assert_int_equal(rc, 0);
     }
 
@@ -210,6 +255,205 @@ static void check_csync_statedb_get_stat_by_inode_not_found(void **state)
     assert_null(tmp);
 }
 
+static void assert_same_stat(csync_file_stat_t *a, csync_file_stat_t *b)
+{
+    assert_non_null(a);
+    assert_non_null(b);
+    assert_true(a->phash == b->phash);
+    assert_int_equal(a->pathlen, b->pathlen);
+    assert_string_equal(a->path, b->path);
+    assert_true(a->inode == b->inode);
+    assert_int_equal(a->mode, b->mode);
+    assert_int_equal(a->modtime, b->modtime);
+    assert_int_equal(a->type, b->type);
+    assert_true(a->size == b->size);
+    assert_int_equal(a->has_ignored_files, b->has_ignored_files);
+    assert_string_equal(a->file_id, b->file_id);
+    assert_string_equal(a->remotePerm, b->remotePerm);
+    assert_int_equal(a->checksumTypeId, b->checksumTypeId);
+    if (a->etag || b->etag) {
+        assert_string_equal(a->etag, b->etag);
+    }
+    if (a->checksum || b->checksum) {
+        assert_string_equal(a->checksum, b->checksum);
+    }
+}
+
+static void check_csync_statedb_snapshot(void **state)
+{
+    CSYNC *csync = *state;
+    csync_file_stat_t *db_st;
+    csync_file_stat_t *snap_st;
+    csync_statedb_snapshot_t *snapshot;
+    uint64_t hashes[] = { 42, 7, (uint64_t) -5 };
+    size_t i;
+    int rc;
+    int query_count = csync->statedb.query_count;
+
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+    assert_non_null(csync->statedb.snapshot);
+    assert_int_equal(csync->statedb.snapshot->count, 3);
+    assert_int_equal(csync->statedb.query_count, query_count + 1);
+
+    for (i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++) {
+        snap_st = csync_statedb_get_stat_by_hash(csync, hashes[i]);
+        /* hide the snapshot to query the db */
+        snapshot = csync->statedb.snapshot;
+        csync->statedb.snapshot = NULL;
+        db_st = csync_statedb_get_stat_by_hash(csync, hashes[i]);
+        csync->statedb.snapshot = snapshot;
+        assert_same_stat(snap_st, db_st);
+        csync_file_stat_free(snap_st);
+        csync_file_stat_free(db_st);
+    }
+    /* only the lookups in the db are counted */
+    assert_int_equal(csync->statedb.query_count, query_count + 1 + 3);
+
+    /* the first row wins for duplicated inodes */
+    snap_st = csync_statedb_get_stat_by_inode(csync, 23);
+    assert_non_null(snap_st);
+    assert_string_equal(snap_st->path, "Its funny stuff");
+    csync_file_stat_free(snap_st);
+
+    snap_st = csync_statedb_get_stat_by_file_id(csync, "00000002oc");
+    assert_non_null(snap_st);
+    assert_string_equal(snap_st->path, "dir");
+    assert_string_equal(snap_st->etag, "etag2");
+    csync_file_stat_free(snap_st);
+
+    assert_null(csync_statedb_get_stat_by_hash(csync, 666));
+    assert_null(csync_statedb_get_stat_by_inode(csync, 666));
+    assert_null(csync_statedb_get_stat_by_file_id(csync, "00000003oc"));
+
+    csync_statedb_free_snapshot(csync);
+    assert_null(csync->statedb.snapshot);
+}
+
+static void check_csync_statedb_get_phash(void **state)
+{
+    CSYNC *csync = *state;
+    uint64_t phash = 0;
+    int rc;
+
+    /* only answered from the snapshot */
+    rc = csync_statedb_get_phash_by_inode(csync, 24, &phash);
+    assert_true(rc < 0);
+
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+
+    rc = csync_statedb_get_phash_by_inode(csync, 24, &phash);
+    assert_int_equal(rc, 1);
+    assert_int_equal(phash, 7);
+
+    /* the first row wins for duplicated inodes */
+    rc = csync_statedb_get_phash_by_inode(csync, 23, &phash);
+    assert_int_equal(rc, 1);
+    assert_int_equal(phash, 42);
+
+    rc = csync_statedb_get_phash_by_file_id(csync, "00000001oc", &phash);
+    assert_int_equal(rc, 1);
+    assert_int_equal(phash, 42);
+
+    assert_int_equal(csync_statedb_get_phash_by_inode(csync, 666, &phash), 0);
+    assert_int_equal(csync_statedb_get_phash_by_inode(csync, 0, &phash), 0);
+    assert_int_equal(csync_statedb_get_phash_by_file_id(csync, "00000003oc", &phash), 0);
+    assert_int_equal(csync_statedb_get_phash_by_file_id(csync, "", &phash), 0);
+
+    csync_statedb_free_snapshot(csync);
+}
+
+static void check_csync_statedb_get_checksums_by_size(void **state)
+{
+    CSYNC *csync = *state;
+    const csync_statedb_checksum_row_t *rows = NULL;
+    sqlite3 *db = NULL;
+    char *errmsg = NULL;
+    int rc;
+
+    const char *sql = "INSERT INTO metadata"
+        "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId) VALUES"
+        "(11, 5, 'file2', 25, 42, 43, 55, 69, 0, 'etag3', '00000004oc', '', 12, 0, 'SHA1:aa', 1),"
+        "(3, 5, 'file3', 26, 42, 43, 55, 70, 0, 'etag4', '00000005oc', '', 12, 0, 'SHA1:bb', 1),"
+        "(5, 5, 'file4', 27, 42, 43, 55, 71, 0, 'etag5', '00000006oc', '', 1024, 0, 'SHA1:cc', 1);";
+
+    rc = sqlite3_open(TESTDB, &db);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_exec(db, sql, NULL, NULL, &errmsg);
+    assert_int_equal(rc, SQLITE_OK);
+    sqlite3_close(db);
+
+    /* only answered from the snapshot */
+    rc = csync_statedb_get_checksums_by_size(csync, 12, &rows);
+    assert_true(rc < 0);
+
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+
+    /* dir/file has the same size but no checksum */
+    rc = csync_statedb_get_checksums_by_size(csync, 12, &rows);
+    assert_int_equal(rc, 2);
+    assert_int_equal(rows[0].phash, 3);
+    assert_string_equal(rows[0].checksum, "SHA1:bb");
+    assert_int_equal(rows[0].checksumTypeId, 1);
+    assert_int_equal(rows[1].phash, 11);
+    assert_string_equal(rows[1].checksum, "SHA1:aa");
+
+    /* the directory of that size is not a candidate */
+    rc = csync_statedb_get_checksums_by_size(csync, 1024, &rows);
+    assert_int_equal(rc, 1);
+    assert_int_equal(rows[0].phash, 5);
+
+    assert_int_equal(csync_statedb_get_checksums_by_size(csync, 13, &rows), 0);
+    assert_int_equal(csync_statedb_get_checksums_by_size(csync, 0, &rows), 0);
+
+    csync_statedb_free_snapshot(csync);
+}
+
+static int superfluous_visitor(uint64_t phash, const char *path, void *userdata)
+{
+    c_strlist_t *found = userdata;
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "%" PRId64 " %s", (int64_t) phash, path);
+    return c_strlist_add(found, buf);
+}
+
+static void check_csync_statedb_walk_superfluous(void **state)
+{
+    CSYNC *csync = *state;
+    c_strlist_t *found = NULL;
+    int present = 1;
+    int rc;
+
+    /* 'Its funny stuff' is still there locally and 'dir' on the server */
+    rc = c_htable_insert(csync->local.tree, 42, &present);
+    assert_int_equal(rc, 0);
+    rc = c_htable_insert(csync->remote.tree, 7, &present);
+    assert_int_equal(rc, 0);
+
+    /* from the journal */
+    found = c_strlist_new(4);
+    rc = csync_statedb_walk_superfluous(csync, superfluous_visitor, found);
+    assert_int_equal(rc, 0);
+    assert_int_equal(found->count, 1);
+    assert_string_equal(found->vector[0], "-5 dir/file");
+    c_strlist_destroy(found);
+
+    /* from the snapshot */
+    rc = csync_statedb_load_snapshot(csync);
+    assert_int_equal(rc, 0);
+    found = c_strlist_new(4);
+    rc = csync_statedb_walk_superfluous(csync, superfluous_visitor, found);
+    assert_int_equal(rc, 0);
+    assert_int_equal(found->count, 1);
+    assert_string_equal(found->vector[0], "-5 dir/file");
+    c_strlist_destroy(found);
+
+    csync_statedb_free_snapshot(csync);
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -219,6 +463,10 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_statedb_write, setup, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_hash_not_found, setup_db, teardown),
         unit_test_setup_teardown(check_csync_statedb_get_stat_by_inode_not_found, setup_db, teardown),
+        unit_test_setup_teardown(check_csync_statedb_snapshot, setup_db_full, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_phash, setup_db_full, teardown),
+        unit_test_setup_teardown(check_csync_statedb_get_checksums_by_size, setup_db_full, teardown),
+        unit_test_setup_teardown(check_csync_statedb_walk_superfluous, setup_db_full, teardown),
     };
 
     return run_tests(tests);
@@ -145,6 +145,55 @@ static void setup_ftw(void **state)
     *state = csync;
 }
 
+static void setup_local_db(void **state)
+{
+    CSYNC *csync;
+    struct stat sb;
+    int rc;
+
+    rc = system("mkdir -p /tmp/check_csync");
+    assert_int_equal(rc, 0);
+    rc = system("mkdir -p /tmp/check_csync1/dir");
+    assert_int_equal(rc, 0);
+    rc = system("touch /tmp/check_csync1/dir/on_disk.txt");
+    assert_int_equal(rc, 0);
+    rc = stat("/tmp/check_csync1/dir", &sb);
+    assert_int_equal(rc, 0);
+    rc = csync_create(&csync, "/tmp/check_csync1", "/tmp/check_csync2");
+    assert_int_equal(rc, 0);
+    rc = csync_init(csync);
+    assert_int_equal(rc, 0);
+
+    /* The db knows the directory with its current inode and mtime, but a different content */
+    sqlite3 *db = NULL;
+    unlink(TESTDB);
+    rc = sqlite3_open_v2(TESTDB, &db, SQLITE_OPEN_CREATE | SQLITE_OPEN_READWRITE, NULL);
+    assert_int_equal(rc, SQLITE_OK);
+    statedb_create_metadata_table(db);
+    char *stmt = sqlite3_mprintf("INSERT INTO metadata"
+                                 "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5) VALUES"
+                                 "(%lld, %d, '%q', %lld, 0, 0, %d, %lld, %d, 'etag1'),"
+                                 "(%lld, %d, '%q', 42, 0, 0, 0, 42, %d, 'etag2');",
+                                 (long long signed int) c_jhash64((uint8_t *) "dir", 3, 0), 3, "dir",
+                                 (long long signed int) sb.st_ino, (int) sb.st_mode,
+                                 (long long signed int) sb.st_mtime, CSYNC_FTW_TYPE_DIR,
+                                 (long long signed int) c_jhash64((uint8_t *) "dir/in_db.txt", 13, 0), 13, "dir/in_db.txt",
+                                 CSYNC_FTW_TYPE_FILE);
+    rc = sqlite3_exec(db, stmt, NULL, NULL, NULL);
+    sqlite3_free(stmt);
+    assert_int_equal(rc, SQLITE_OK);
+    rc = sqlite3_close(db);
+    assert_int_equal(rc, SQLITE_OK);
+
+    rc = csync_statedb_load(csync, TESTDB, &csync->statedb.db);
+    assert_int_equal(rc, 0);
+
+    csync->statedb.file = c_strdup( TESTDB );
+    csync->current = LOCAL_REPLICA;
+    csync->replica = LOCAL_REPLICA;
+    *state = csync;
+}
+
 static void teardown(void **state)
 {
     CSYNC *csync = *state;
@@ -238,6 +287,12 @@ static int failing_fn(CSYNC *ctx,
   return -1;
 }
 
+static csync_file_stat_t *local_tree_find(CSYNC *csync, const char *path)
+{
+    uint64_t h = c_jhash64((uint8_t *) path, strlen(path), 0);
+    return c_htable_find(csync->local.tree, h);
+}
+
 /* detect a new file */
 static void check_csync_detect_update(void **state)
 {
@@ -256,7 +311,7 @@ static void check_csync_detect_update(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = local_tree_find(csync, "file.txt");
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -285,7 +340,7 @@ static void check_csync_detect_update_db_none(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = local_tree_find(csync, "file.txt");
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -312,7 +367,7 @@ static void check_csync_detect_update_db_eval(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = local_tree_find(csync, "file.txt");
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
     /* create a statedb */
@@ -343,7 +398,7 @@ static void check_csync_detect_update_db_rename(void **state)
     /* the instruction should be set to rename */
     /*
      * temporarily broken.
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = local_tree_find(csync, "wurst.txt");
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_RENAME);
 
     st->instruction = CSYNC_INSTRUCTION_UPDATED;
@@ -371,7 +426,7 @@ static void check_csync_detect_update_db_new(void **state)
     assert_int_equal(rc, 0);
 
     /* the instruction should be set to new  */
-    st = c_rbtree_node_data(csync->local.tree->root);
+    st = local_tree_find(csync, "file.txt");
     assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NEW);
 
 
@@ -432,6 +487,60 @@ static void check_csync_ftw_failing_fn(void **state)
     assert_int_equal(rc, -1);
 }
 
+static int local_discovery_hook(void *userdata, const char *path)
+{
+    (void) path;
+    return *(int *) userdata;
+}
+
+static bool local_tree_contains(CSYNC *csync, const char *path)
+{
+    return local_tree_find(csync, path) != NULL;
+}
+
+static void check_csync_ftw_local_from_db(void **state)
+{
+    CSYNC *csync = *state;
+    int needs_discovery = 0;
+    csync_file_stat_t *st;
+    int rc;
+
+    csync->callbacks.checkLocalDiscoveryHook = local_discovery_hook;
+    csync->callbacks.update_callback_userdata = &needs_discovery;
+
+    rc = csync_ftw(csync, "/tmp/check_csync1", csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+    assert_int_equal(csync->local.read_from_db, 0);
+
+    assert_true(local_tree_contains(csync, "dir"));
+    assert_true(local_tree_contains(csync, "dir/in_db.txt"));
+    assert_false(local_tree_contains(csync, "dir/on_disk.txt"));
+
+    /* the restored entries look like what the file system walk gives */
+    st = local_tree_find(csync, "dir/in_db.txt");
+    assert_null(st->etag);
+    assert_int_equal(st->instruction, CSYNC_INSTRUCTION_NONE);
+    st = local_tree_find(csync, "dir");
+    assert_true(st->content_from_db);
+}
+
+static void check_csync_ftw_local_dirty(void **state)
+{
+    CSYNC *csync = *state;
+    int needs_discovery = 1;
+    int rc;
+
+    csync->callbacks.checkLocalDiscoveryHook = local_discovery_hook;
+    csync->callbacks.update_callback_userdata = &needs_discovery;
+
+    rc = csync_ftw(csync, "/tmp/check_csync1", csync_walker, MAX_DEPTH);
+    assert_int_equal(rc, 0);
+
+    assert_true(local_tree_contains(csync, "dir"));
+    assert_true(local_tree_contains(csync, "dir/on_disk.txt"));
+    assert_false(local_tree_contains(csync, "dir/in_db.txt"));
+}
+
 int torture_run_tests(void)
 {
     const UnitTest tests[] = {
@@ -445,6 +554,8 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_csync_ftw, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_empty_uri, setup_ftw, teardown_rm),
         unit_test_setup_teardown(check_csync_ftw_failing_fn, setup_ftw, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_from_db, setup_local_db, teardown_rm),
+        unit_test_setup_teardown(check_csync_ftw_local_dirty, setup_local_db, teardown_rm),
     };
 
     return run_tests(tests);
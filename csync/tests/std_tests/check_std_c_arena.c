@@ -0,0 +1,117 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "std/c_arena.h"
+
+static void setup(void **state)
+{
+  c_arena_t *arena = c_arena_new(256);
+  assert_non_null(arena);
+
+  *state = arena;
+}
+
+static void teardown(void **state)
+{
+  c_arena_free(*state);
+  *state = NULL;
+}
+
+static void check_c_arena_alloc(void **state)
+{
+  c_arena_t *arena = *state;
+  char *p = NULL;
+  char *q = NULL;
+  int i;
+
+  p = c_arena_alloc(arena, 3);
+  assert_non_null(p);
+  assert_int_equal((uintptr_t) p % 8, 0);
+  memcpy(p, "abc", 3);
+
+  q = c_arena_alloc(arena, 5);
+  assert_non_null(q);
+  assert_int_equal((uintptr_t) q % 8, 0);
+  assert_true(q >= p + 3);
+
+  /* fill a couple of blocks, the memory is always cleared */
+  for (i = 0; i < 100; i++) {
+    p = c_arena_alloc(arena, 24);
+    assert_non_null(p);
+    assert_memory_equal(p, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 24);
+    memset(p, 0xff, 24);
+  }
+  assert_true(c_arena_size(arena) >= 100 * 24);
+}
+
+static void check_c_arena_alloc_zero(void **state)
+{
+  c_arena_t *arena = *state;
+
+  assert_null(c_arena_alloc(arena, 0));
+  assert_null(c_arena_alloc(NULL, 8));
+}
+
+static void check_c_arena_alloc_big(void **state)
+{
+  c_arena_t *arena = *state;
+  char *small = NULL;
+  char *big = NULL;
+  char *next = NULL;
+
+  small = c_arena_alloc(arena, 8);
+  assert_non_null(small);
+
+  /* bigger than a block: gets its own */
+  big = c_arena_alloc(arena, 4096);
+  assert_non_null(big);
+  memset(big, 'x', 4096);
+
+  /* the block of the small allocation is still used */
+  next = c_arena_alloc(arena, 8);
+  assert_true(next == small + 8);
+}
+
+static void check_c_arena_strdup(void **state)
+{
+  c_arena_t *arena = *state;
+  char *tdup = NULL;
+
+  tdup = c_arena_strdup(arena, "test");
+  assert_string_equal(tdup, "test");
+
+  assert_null(c_arena_strdup(arena, NULL));
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test_setup_teardown(check_c_arena_alloc, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_alloc_zero, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_alloc_big, setup, teardown),
+      unit_test_setup_teardown(check_c_arena_strdup, setup, teardown),
+  };
+
+  return run_tests(tests);
+}
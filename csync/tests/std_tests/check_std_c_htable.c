@@ -0,0 +1,164 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * Copyright (c) 2016      by ownCloud, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include "torture.h"
+
+#include <errno.h>
+#include <stdint.h>
+
+#include "std/c_htable.h"
+
+typedef struct test_s {
+  uint64_t key;
+  int number;
+} test_t;
+
+static test_t entries[1000];
+
+static void setup(void **state)
+{
+  c_htable_t *table = c_htable_new(0);
+  assert_non_null(table);
+
+  *state = table;
+}
+
+static void setup_filled(void **state)
+{
+  c_htable_t *table = NULL;
+  int i;
+
+  setup(state);
+  table = *state;
+
+  /* sequential keys and keys that only differ in the high bits */
+  for (i = 0; i < 1000; i++) {
+    entries[i].key = (i % 2) ? (uint64_t) i : (uint64_t) i << 40;
+    entries[i].number = 0;
+    assert_int_equal(c_htable_insert(table, entries[i].key, &entries[i]), 0);
+  }
+}
+
+static void teardown(void **state)
+{
+  c_htable_free(*state);
+  *state = NULL;
+}
+
+static int visitor(void *obj, void *data)
+{
+  test_t *a = obj;
+  int *count = data;
+
+  a->number++;
+  (*count)++;
+
+  return 0;
+}
+
+static int stop_visitor(void *obj, void *data)
+{
+  (void) obj;
+  (void) data;
+
+  errno = EINVAL;
+  return -1;
+}
+
+static void check_c_htable_insert_find(void **state)
+{
+  c_htable_t *table = *state;
+  int i;
+
+  assert_int_equal(c_htable_size(table), 1000);
+
+  for (i = 0; i < 1000; i++) {
+    assert_true(c_htable_find(table, entries[i].key) == &entries[i]);
+  }
+  assert_null(c_htable_find(table, 1001));
+  assert_null(c_htable_find(table, (uint64_t) 1001 << 40));
+}
+
+static void check_c_htable_insert_duplicate(void **state)
+{
+  c_htable_t *table = *state;
+  test_t other;
+
+  assert_int_equal(c_htable_insert(table, entries[42].key, &other), 1);
+  assert_int_equal(c_htable_size(table), 1000);
+  assert_true(c_htable_find(table, entries[42].key) == &entries[42]);
+}
+
+static void check_c_htable_insert_null(void **state)
+{
+  c_htable_t *table = *state;
+
+  assert_int_equal(c_htable_insert(table, 1, NULL), -1);
+  assert_int_equal(c_htable_insert(NULL, 1, &entries[0]), -1);
+  assert_int_equal(c_htable_size(table), 0);
+
+  assert_null(c_htable_find(NULL, 1));
+  assert_int_equal(c_htable_size(NULL), 0);
+}
+
+static void check_c_htable_size_hint(void **state)
+{
+  c_htable_t *table = c_htable_new(100000);
+  int i;
+
+  (void) state;
+
+  assert_non_null(table);
+  for (i = 0; i < 1000; i++) {
+    assert_int_equal(c_htable_insert(table, i, &entries[i]), 0);
+  }
+  assert_int_equal(c_htable_size(table), 1000);
+  assert_true(c_htable_find(table, 999) == &entries[999]);
+
+  c_htable_free(table);
+}
+
+static void check_c_htable_walk(void **state)
+{
+  c_htable_t *table = *state;
+  int count = 0;
+  int i;
+
+  assert_int_equal(c_htable_walk(table, &count, visitor), 0);
+  assert_int_equal(count, 1000);
+  for (i = 0; i < 1000; i++) {
+    assert_int_equal(entries[i].number, 1);
+  }
+
+  assert_int_equal(c_htable_walk(table, NULL, stop_visitor), -1);
+  assert_int_equal(c_htable_walk(table, NULL, NULL), -1);
+}
+
+int torture_run_tests(void)
+{
+  const UnitTest tests[] = {
+      unit_test_setup_teardown(check_c_htable_insert_find, setup_filled, teardown),
+      unit_test_setup_teardown(check_c_htable_insert_duplicate, setup_filled, teardown),
+      unit_test_setup_teardown(check_c_htable_insert_null, setup, teardown),
+      unit_test(check_c_htable_size_hint),
+      unit_test_setup_teardown(check_c_htable_walk, setup_filled, teardown),
+  };
+
+  return run_tests(tests);
+}
@@ -29,6 +29,7 @@
 
 #include "csync_private.h"
 #include "vio/csync_vio.h"
+#include "csync_local_walker.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -345,6 +346,32 @@ static void check_readdir_with_content(void **state)
     assert_int_equal(files_cnt, 2); /* Two files in the sub dir */
 }
 
+static void check_readdir_with_walker(void **state)
+{
+    statevar *sv = (statevar*) *state;
+    CSYNC *csync = sv->csync;
+    int files_cnt = 0;
+
+    const char *t1 = "warum/nur/40/Räuber/";
+    create_dirs( t1 );
+
+    create_file( t1, "Räuber Max.txt", "Der Max ist ein schlimmer finger");
+    create_file( t1, "пя́тница.txt", "Am Freitag tanzt der Ürk");
+
+    /* The listings are read ahead by the worker threads, the result must not change */
+    csync->local.walker = csync_local_walker_create(csync, 4);
+    traverse_dir(state, CSYNC_TEST_DIR, &files_cnt);
+    csync_local_walker_destroy(csync->local.walker);
+    csync->local.walker = NULL;
+
+    assert_string_equal( sv->result,
+                         "<DIR> C:/tmp/csync_test/warum"
+                         "<DIR> C:/tmp/csync_test/warum/nur"
+                         "<DIR> C:/tmp/csync_test/warum/nur/40"
+                         "<DIR> C:/tmp/csync_test/warum/nur/40/Räuber");
+    assert_int_equal(files_cnt, 2);
+}
+
 static void check_readdir_longtree(void **state)
 {
     statevar *sv = (statevar*) *state;
@@ -468,6 +495,7 @@ int torture_run_tests(void)
         unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        unit_test_setup_teardown(check_readdir_with_walker, setup_testenv, teardown),
     };
 
     return run_tests(tests);
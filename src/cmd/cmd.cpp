@@ -61,6 +61,7 @@ struct CmdOptions {
     QString unsyncedfolders;
     QString davPath;
     int restartTimes;
+    QString perfReport;
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -161,6 +162,7 @@ void help()
     std::cout << "  --nonshib              Use Non Shibboleth WebDAV authentication" << std::endl;
     std::cout << "  --davpath [path]       Custom themed dav path, overrides --nonshib" << std::endl;
     std::cout << "  --max-sync-retries [n] Retries maximum n times (default to 3)" << std::endl;
+    std::cout << "  --perf-report [file]   Write the performance report of the last sync run as JSON to [file]" << std::endl;
     std::cout << "  -h                     Sync hidden files,do not ignore them" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "" << std::endl;
@@ -234,6 +236,8 @@ void parseOptions( const QStringList& app_args, CmdOptions *options )
             options->davPath = it.next();
         } else if( option == "--max-sync-retries" && !it.peekNext().startsWith("-") ) {
             options->restartTimes = it.next().toInt();
+        } else if( option == "--perf-report" && !it.peekNext().startsWith("-") ) {
+            options->perfReport = it.next();
         } else {
             help();
         }
@@ -493,6 +497,15 @@ restart_sync:
         qWarning() << "Another sync is needed, but not done because restart count is exceeded" << restartCount;
     }
 
+    if (!options.perfReport.isEmpty()) {
+        QFile f(options.perfReport);
+        if (!f.open(QFile::WriteOnly | QFile::Truncate)) {
+            qCritical() << "Could not write the performance report to" << options.perfReport;
+            return EXIT_FAILURE;
+        }
+        f.write(engine.performanceReport().toJson());
+    }
+
     return 0;
 }
 
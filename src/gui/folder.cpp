@@ -68,6 +68,7 @@ Folder::Folder(const FolderDefinition& definition,
       , _forceSyncOnPollTimeout(false)
       , _consecutiveFailingSyncs(0)
       , _consecutiveFollowUpSyncs(0)
+      , _fullLocalDiscoveryNeeded(true)
       , _journal(definition.localPath)
       , _csync_ctx(0)
 {
@@ -420,6 +421,13 @@ void Folder::bubbleUpSyncResult()
             // add new directories or remove gone away dirs to the watcher
             if (item->_isDirectory && item->_instruction == CSYNC_INSTRUCTION_NEW ) {
                 FolderMan::instance()->addMonitorPath( alias(), path()+item->_file );
+                // changes done before it was watched were not reported
+                _localDiscoveryPaths.insert(item->_file);
+            }
+            if (item->_isDirectory && item->_instruction == CSYNC_INSTRUCTION_RENAME ) {
+                // let the watcher report the new name for changes in there
+                FolderMan::instance()->addMonitorPath( alias(), path()+item->_renameTarget );
+                _localDiscoveryPaths.insert(item->_renameTarget);
             }
             if (item->_isDirectory && item->_instruction == CSYNC_INSTRUCTION_REMOVE ) {
                 FolderMan::instance()->removeMonitorPath( alias(), path()+item->_file );
@@ -592,6 +600,19 @@ int Folder::slotWipeErrorBlacklist()
 
 void Folder::slotWatchedPathChanged(const QString& path)
 {
+    // Remember the path for the local discovery of the next sync, even if the
+    // change turns out to be our own.
+    if (path.startsWith(this->path()) && path.length() > this->path().length()) {
+        QString relativePath = path.mid(this->path().length());
+        if (relativePath.endsWith(QLatin1Char('/'))) {
+            relativePath.chop(1);
+        }
+        _localDiscoveryPaths.insert(relativePath);
+    } else {
+        // The root folder itself or a path we can't map: we don't know what changed
+        _fullLocalDiscoveryNeeded = true;
+    }
+
     // When no sync is running or it's in the prepare phase, we can
     // always schedule a new sync.
     if (! _engine || _syncResult.status() == SyncResult::SyncPrepare) {
@@ -742,6 +763,27 @@ bool Folder::isFileExcludedRelative(const QString& relativePath) const
     return isFileExcludedAbsolute(path() + relativePath);
 }
 
+void Folder::setFolderWatcher(FolderWatcher *watcher)
+{
+    _folderWatcher = watcher;
+}
+
+void Folder::slotFolderWatcherError(const QString& error)
+{
+    // The watcher is not reliable anymore, see needsFullLocalDiscovery()
+    qDebug() << Q_FUNC_INFO << alias() << error << "- the next syncs do a full local discovery";
+}
+
+bool Folder::needsFullLocalDiscovery(qint64 fullLocalDiscoveryInterval) const
+{
+    return _fullLocalDiscoveryNeeded
+            || !_folderWatcher || !_folderWatcher->isReliable()
+            || _consecutiveFailingSyncs > 0
+            || fullLocalDiscoveryInterval < 0
+            || !_timeSinceLastFullLocalDiscovery.isValid()
+            || _timeSinceLastFullLocalDiscovery.hasExpired(fullLocalDiscoveryInterval);
+}
+
 void Folder::watcherSlot(QString fn)
 {
     // FIXME: On OS X we could not do this "if" since on OS X the file watcher ignores events for ourselves
@@ -927,6 +969,22 @@ void Folder::startSync(const QStringList &pathList)
     auto newFolderLimit = cfgFile.newBigFolderSizeLimit();
     quint64 limit = newFolderLimit.first ? newFolderLimit.second * 1000 * 1000 : -1; // convert from MB to B
     _engine->setNewBigFolderSizeLimit(limit);
+    _engine->setLocalDiscoveryThreads(cfgFile.localDiscoveryThreads());
+    _engine->setRemoteDiscoveryPrefetch(cfgFile.remoteDiscoveryPrefetch());
+    _engine->setChecksumMoveDetection(cfgFile.checksumMoveDetection());
+
+    // Only read the directories the folder watcher reported changes for from the disk,
+    // unless something went wrong or it is time to check the whole tree again.
+    if (needsFullLocalDiscovery(cfgFile.fullLocalDiscoveryInterval())) {
+        _engine->setLocalDiscoveryOptions(SyncEngine::FullLocalDiscovery);
+        _timeSinceLastFullLocalDiscovery.start();
+        _fullLocalDiscoveryNeeded = false;
+    } else {
+        _engine->setLocalDiscoveryOptions(SyncEngine::IncrementalLocalDiscovery,
+                                          _localDiscoveryPaths + _previousLocalDiscoveryPaths);
+    }
+    _previousLocalDiscoveryPaths = _localDiscoveryPaths;
+    _localDiscoveryPaths.clear();
 
     QMetaObject::invokeMethod(_engine.data(), "startSync", Qt::QueuedConnection);
 
@@ -1109,6 +1167,14 @@ void Folder::slotItemCompleted(const SyncFileItem &item, const PropagatorJob& jo
         _stateLastSyncItemsWithErrorNew.insert(item._file);
     }
 
+    if (item.hasErrorStatus()) {
+        // Not in sync: the next local discovery must look at it again
+        _localDiscoveryPaths.insert(item._file);
+        if (!item._renameTarget.isEmpty()) {
+            _localDiscoveryPaths.insert(item._renameTarget);
+        }
+    }
+
     if (Progress::isWarningKind(item._status)) {
         // Count all error conditions.
         _syncResult.setWarnCount(_syncResult.warnCount()+1);
@@ -38,11 +38,13 @@
 
 class QThread;
 class QSettings;
+class TestFolderMan;
 
 namespace OCC {
 
 class SyncEngine;
 class AccountState;
+class FolderWatcher;
 
 /**
  * @brief The FolderDefinition class
@@ -207,6 +209,9 @@ public:
       */
      bool isFileExcludedRelative(const QString& relativePath) const;
 
+     /// The watcher reporting the changes in this folder, set by the FolderMan
+     void setFolderWatcher(FolderWatcher *watcher);
+
 signals:
     void syncStateChange();
     void syncStarted();
@@ -247,6 +252,12 @@ public slots:
        */
       void slotWatchedPathChanged(const QString& path);
 
+      /**
+       * Triggered by the folder watcher if it failed to watch the folder.
+       * Changes may get lost, so every following sync reads the whole local tree.
+       */
+      void slotFolderWatcherError(const QString& error);
+
 private slots:
     void slotSyncStarted();
     void slotSyncError(const QString& );
@@ -279,6 +290,9 @@ private:
 
     void checkLocalPath();
 
+    /// Whether the next sync has to read the whole local tree, not just the reported changes
+    bool needsFullLocalDiscovery(qint64 fullLocalDiscoveryInterval) const;
+
     void createGuiLog(const QString& filename, SyncFileStatus status, int count,
                        const QString& renameTarget = QString::null );
 
@@ -316,11 +330,23 @@ private:
     // for it. It's displayed as EVAL.
     QSet<QString>   _stateTaintedFolders;
 
+    // Paths (relative to the folder) the folder watcher reported since the last sync
+    // started. With an incremental local discovery only those are read from the disk.
+    QSet<QString>   _localDiscoveryPaths;
+    // The paths reported before the previous sync started. They are read once more since
+    // notifications for them might have been swallowed while that sync was running.
+    QSet<QString>   _previousLocalDiscoveryPaths;
+    bool            _fullLocalDiscoveryNeeded;
+    QPointer<FolderWatcher> _folderWatcher;
+    QElapsedTimer   _timeSinceLastFullLocalDiscovery;
+
     SyncJournalDb _journal;
 
     ClientProxy   _clientProxy;
 
     CSYNC *_csync_ctx;
+
+    friend class ::TestFolderMan;
 };
 
 }
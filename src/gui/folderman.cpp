@@ -139,6 +139,7 @@ void FolderMan::registerFolderMonitor( Folder *folder )
 
     if( !_folderWatchers.contains(folder->alias() ) ) {
         FolderWatcher *fw = new FolderWatcher(folder->path(), folder);
+        folder->setFolderWatcher(fw);
 
         // Connect the pathChanged signal, which comes with the changed path,
         // to the signal mapper which maps to the folder alias. The changed path
@@ -148,6 +149,9 @@ void FolderMan::registerFolderMonitor( Folder *folder )
 
         // This is at the moment only for the behaviour of the SocketApi.
         connect(fw, SIGNAL(pathChanged(QString)), folder, SLOT(watcherSlot(QString)));
+
+        // Without working notifications the folder can't rely on them for the local discovery
+        connect(fw, SIGNAL(error(QString)), folder, SLOT(slotFolderWatcherError(QString)));
     }
 
     // register the folder with the socket API
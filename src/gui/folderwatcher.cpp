@@ -108,6 +108,11 @@ void FolderWatcher::changeDetected( const QStringList& paths )
     }
 }
 
+bool FolderWatcher::isReliable() const
+{
+    return _d->isReliable();
+}
+
 void FolderWatcher::addPath(const QString &path )
 {
     _d->addPath(path);
@@ -68,6 +68,12 @@ public:
     /* Check if the path is ignored. */
     bool pathIsIgnored( const QString& path );
 
+    /**
+     * Whether all the changes in the folder are reported. False if the backend
+     * failed to watch a directory, or cannot tell whether it did.
+     */
+    bool isReliable() const;
+
 signals:
     /** Emitted when one of the watched directories or one
      *  of the contained files is changed. */
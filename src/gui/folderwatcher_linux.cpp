@@ -29,7 +29,8 @@ namespace OCC {
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path)
     : QObject(),
       _parent(p),
-      _folder(path)
+      _folder(path),
+      _failed(false)
 {
     _fd = inotify_init();
     if (_fd != -1) {
@@ -39,7 +40,8 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString& path
         qDebug() << Q_FUNC_INFO << "notify_init() failed: " << strerror(errno);
     }
 
-    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
+    // Queued so that the errors reach the slots connected after the FolderWatcher is created
+    QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Qt::QueuedConnection, Q_ARG(QString, path));
 
 }
 
@@ -83,7 +85,13 @@ void FolderWatcherPrivate::inotifyRegisterPath(const QString& path)
                                    IN_DONT_FOLLOW );
         if( wd > -1 ) {
             _watches.insert(wd, path);
-         }
+        } else if (errno != ENOENT) {
+            // Most likely the inotify watch limit was hit: changes in here are not reported
+            _failed = true;
+            const QString error = QString::fromLocal8Bit(strerror(errno));
+            qDebug() << Q_FUNC_INFO << "Could not watch" << path << ":" << error;
+            emit _parent->error(tr("Could not watch %1: %2").arg(path, error));
+        }
     }
 }
 
@@ -33,13 +33,15 @@ class FolderWatcherPrivate : public QObject
 {
     Q_OBJECT
 public:
-    FolderWatcherPrivate() { }
+    FolderWatcherPrivate() : _fd(-1), _failed(false) { }
     FolderWatcherPrivate(FolderWatcher *p, const QString &path);
     ~FolderWatcherPrivate();
 
     void addPath(const QString &path);
     void removePath(const QString &);
 
+    bool isReliable() const { return _fd != -1 && !_failed; }
+
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
@@ -55,6 +57,7 @@ private:
     QHash <int, QString> _watches;
     QScopedPointer<QSocketNotifier> _socket;
     int _fd;
+    bool _failed; // a directory could not be watched
 };
 
 }
@@ -37,6 +37,9 @@ public:
     void addPath(const QString &) {}
     void removePath(const QString &) {}
 
+    // Events dropped by FSEvents are not reported as errors
+    bool isReliable() const { return false; }
+
     void startWatching();
     void doNotifyParent(const QStringList &);
 
@@ -59,6 +59,9 @@ public:
     void addPath(const QString &) {}
     void removePath(const QString &) {}
 
+    // Overflows and failures of the watcher thread are not reported as errors
+    bool isReliable() const { return false; }
+
 private:
     FolderWatcher *_parent;
     WatcherThread *_thread;
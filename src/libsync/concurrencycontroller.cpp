@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QDebug>
+#include <QtGlobal>
+
+namespace OCC {
+
+// A window is congested when its average latency is that much above the best one...
+static const double congestedLatencyFactor = 2.0;
+// ... unless the requests or the bytes per second went up by that much.
+static const double improvedRateFactor = 1.1;
+// The best latency ages by that much per window, so that a network that got
+// slower for good does not keep the limit at the minimum.
+static const double bestLatencyAging = 1.1;
+
+ConcurrencyController::ConcurrencyController(int minimum, int maximum, int initial)
+    : _minimum(qMax(1, minimum))
+    , _maximum(qMax(_minimum, maximum))
+    , _limit(qBound(_minimum, initial, _maximum))
+    , _windowStart(0)
+    , _windowRequests(0)
+    , _windowBytes(0)
+    , _windowDuration(0)
+    , _windowPeakJobs(0)
+    , _bestLatency(-1)
+    , _lastRequestRate(-1)
+    , _lastByteRate(-1)
+{
+    _clock.start();
+}
+
+void ConcurrencyController::requestFinished(quint64 durationMsec, qint64 bytes, int activeJobs)
+{
+    requestFinished(durationMsec, bytes, activeJobs, _clock.elapsed());
+}
+
+void ConcurrencyController::requestFinished(quint64 durationMsec, qint64 bytes, int activeJobs, qint64 nowMsec)
+{
+    if (_windowRequests == 0) {
+        // don't count the time the propagator was idle or busy with local jobs
+        _windowStart = nowMsec - qint64(durationMsec);
+    }
+    _windowRequests++;
+    _windowBytes += qMax(qint64(0), bytes);
+    _windowDuration += durationMsec;
+    _windowPeakJobs = qMax(_windowPeakJobs, activeJobs);
+
+    if (_windowRequests >= qMax(int(windowMinimum), _limit)) {
+        endWindow(nowMsec);
+    }
+}
+
+void ConcurrencyController::endWindow(qint64 nowMsec)
+{
+    const double elapsedSec = qMax(qint64(1), nowMsec - _windowStart) / 1000.0;
+    const double latency = double(_windowDuration) / _windowRequests;
+    const double requestRate = _windowRequests / elapsedSec;
+    const double byteRate = _windowBytes / elapsedSec;
+
+    const bool improved = _lastRequestRate < 0
+            || requestRate > _lastRequestRate * improvedRateFactor
+            || byteRate > _lastByteRate * improvedRateFactor;
+    const bool congested = _bestLatency >= 0
+            && latency > _bestLatency * congestedLatencyFactor;
+
+    const int oldLimit = _limit;
+    if (congested && !improved) {
+        _limit = qMax(_minimum, _limit / 2);
+    } else if (_windowPeakJobs >= _limit) {
+        // Only grow when the limit was reached, more jobs would not have helped otherwise
+        _limit = qMin(_maximum, _limit + 1);
+    }
+    if (_limit != oldLimit) {
+        qDebug() << "Parallel jobs" << oldLimit << "->" << _limit << "latency" << latency
+                 << "best" << _bestLatency << "requests/s" << requestRate << "bytes/s" << byteRate;
+    }
+
+    _bestLatency = _bestLatency < 0 ? latency : qMin(latency, _bestLatency * bestLatencyAging);
+    _lastRequestRate = requestRate;
+    _lastByteRate = byteRate;
+
+    _windowRequests = 0;
+    _windowBytes = 0;
+    _windowDuration = 0;
+    _windowPeakJobs = 0;
+}
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QElapsedTimer>
+
+namespace OCC {
+
+/**
+ * @brief Decides how many jobs the propagator runs in parallel
+ * @ingroup libsync
+ *
+ * The limit is adapted like a TCP congestion window (AIMD): each window of
+ * finished requests grows it by one, unless the requests got much slower than
+ * in the best window so far without the throughput getting better. Then the
+ * server or the network is overloaded and the limit is halved.
+ *
+ * A window holds as many requests as the limit, but at least windowMinimum.
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    ConcurrencyController(int minimum, int maximum, int initial);
+
+    int limit() const { return _limit; }
+    int minimum() const { return _minimum; }
+    int maximum() const { return _maximum; }
+
+    /** Records a finished request.
+     *
+     * durationMsec is the time the request took and activeJobs the number of
+     * jobs that were running when it finished, including its own.
+     */
+    void requestFinished(quint64 durationMsec, qint64 bytes, int activeJobs);
+
+    /** Same, with the current time in msec given by the caller (for tests) */
+    void requestFinished(quint64 durationMsec, qint64 bytes, int activeJobs, qint64 nowMsec);
+
+    enum { windowMinimum = 4 };
+
+private:
+    void endWindow(qint64 nowMsec);
+
+    int _minimum;
+    int _maximum;
+    int _limit;
+    QElapsedTimer _clock;
+
+    // the current window
+    qint64 _windowStart;
+    int _windowRequests;
+    qint64 _windowBytes;
+    quint64 _windowDuration;
+    int _windowPeakJobs;
+
+    // the previous windows, negative if there was none yet
+    double _bestLatency;
+    double _lastRequestRate;
+    double _lastByteRate;
+};
+
+}
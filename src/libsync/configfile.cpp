@@ -49,6 +49,10 @@ static const char skipUpdateCheckC[] = "skipUpdateCheck";
 static const char updateCheckIntervalC[] = "updateCheckInterval";
 static const char geometryC[] = "geometry";
 static const char timeoutC[] = "timeout";
+static const char localDiscoveryThreadsC[] = "localDiscoveryThreads";
+static const char remoteDiscoveryPrefetchC[] = "remoteDiscoveryPrefetch";
+static const char checksumMoveDetectionC[] = "checksumMoveDetection";
+static const char fullLocalDiscoveryIntervalC[] = "fullLocalDiscoveryInterval";
 static const char transmissionChecksumC[] = "transmissionChecksum";
 
 static const char proxyHostC[] = "Proxy/host";
@@ -122,6 +126,30 @@ int ConfigFile::timeout() const
     return settings.value(QLatin1String(timeoutC), 300).toInt(); // default to 5 min
 }
 
+int ConfigFile::localDiscoveryThreads() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(localDiscoveryThreadsC), 1).toInt();
+}
+
+int ConfigFile::remoteDiscoveryPrefetch() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(remoteDiscoveryPrefetchC), 6).toInt();
+}
+
+bool ConfigFile::checksumMoveDetection() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(checksumMoveDetectionC), true).toBool();
+}
+
+qint64 ConfigFile::fullLocalDiscoveryInterval() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(fullLocalDiscoveryIntervalC), 60 * 60 * 1000).toLongLong(); // default to 1h
+}
+
 QString ConfigFile::transmissionChecksum() const
 {
     QSettings settings(configFile(), QSettings::IniFormat);
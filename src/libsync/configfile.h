@@ -107,6 +107,19 @@ public:
 
     int timeout() const;
 
+    // number of threads reading the local file system during discovery, 1 disables the read-ahead
+    int localDiscoveryThreads() const;
+
+    // number of directory listings requested from the server ahead of the discovery, 0 disables it
+    int remoteDiscoveryPrefetch() const;
+
+    // detect local moves that did not keep the inode by the size and content checksum
+    bool checksumMoveDetection() const;
+
+    // milliseconds between two syncs reading the whole local tree, even though the file
+    // system watcher reported changes in a few directories only. Negative: always.
+    qint64 fullLocalDiscoveryInterval() const;
+
     // send a checksum as a header along with the transmission or not.
     // possible values:
     // empty: no checksum calculated or expected.
@@ -18,6 +18,7 @@
 
 #include <QUrl>
 #include "account.h"
+#include "syncperformancereport.h"
 #include <QFileInfo>
 
 namespace OCC {
@@ -80,10 +81,15 @@ bool DiscoveryJob::checkSelectiveSyncNewFolder(const QString& path)
         return false;
     }
 
-    // Go in the main thread to do a PROPFIND to know the size of this folder
     qint64 result = -1;
 
-    {
+    // The size usually came with the listing of the parent directory
+    auto it = _folderSizes.find(path);
+    if (it != _folderSizes.end()) {
+        result = it.value();
+        _folderSizes.erase(it);
+    } else {
+        // Go in the main thread to do a PROPFIND to know the size of this folder
         QMutexLocker locker(&_vioMutex);
         emit doGetSizeSignal(path, &result);
         _vioWaitCondition.wait(&_vioMutex);
@@ -111,6 +117,39 @@ int DiscoveryJob::checkSelectiveSyncNewFolderCallback(void *data, const char *pa
     return static_cast<DiscoveryJob*>(data)->checkSelectiveSyncNewFolder(QString::fromUtf8(path));
 }
 
+bool DiscoveryJob::checkLocalDiscovery(const QString &path) const
+{
+    if (!_incrementalLocalDiscovery) {
+        return true;
+    }
+
+    // Something changed in this directory or below it. The list is sorted, so if there
+    // is any entry below path, the first entry after path + '/' is one of them.
+    if (std::binary_search(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), path)) {
+        return true;
+    }
+    QString pathSlash = path + QLatin1Char('/');
+    auto it = std::lower_bound(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), pathSlash);
+    if (it != _localDiscoveryPaths.end() && it->startsWith(pathSlash)) {
+        return true;
+    }
+
+    // The directory is below a path that changed (e.g. a moved or re-created directory)
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    while (slash > 0) {
+        if (std::binary_search(_localDiscoveryPaths.begin(), _localDiscoveryPaths.end(), path.left(slash))) {
+            return true;
+        }
+        slash = path.lastIndexOf(QLatin1Char('/'), slash - 1);
+    }
+    return false;
+}
+
+int DiscoveryJob::checkLocalDiscoveryCallback(void *data, const char *path)
+{
+    return static_cast<DiscoveryJob*>(data)->checkLocalDiscovery(QString::fromUtf8(path));
+}
+
 
 void DiscoveryJob::update_job_update_callback (bool local,
                                     const char *dirUrl,
@@ -210,7 +249,8 @@ int get_errno_from_http_errcode( int err, const QString & reason ) {
 
 
 DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent)
-    : QObject(parent), _subPath(path), _account(account), _ignoredFirst(false)
+    : QObject(parent), _subPath(path), _account(account), _ignoredFirst(false),
+      _depthInfinity(false), _deepListing(false), _fetchFolderSizes(false)
 {
 }
 
@@ -222,14 +262,21 @@ void DiscoverySingleDirectoryJob::start()
                         << "getcontentlength" << "getetag" << "http://owncloud.org/ns:id"
                         << "http://owncloud.org/ns:downloadURL" << "http://owncloud.org/ns:dDC"
                         << "http://owncloud.org/ns:permissions");
+    if (_fetchFolderSizes) {
+        lsColJob->setProperties(lsColJob->properties() << "quota-used-bytes");
+    }
+    if (_depthInfinity) {
+        lsColJob->setDepth("infinity");
+    }
 
-    QObject::connect(lsColJob, SIGNAL(directoryListingIterated(QString,QMap<QString,QString>)),
-                     this, SLOT(directoryListingIteratedSlot(QString,QMap<QString,QString>)));
+    QObject::connect(lsColJob, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+                     this, SLOT(directoryListingEntriesSlot(QVector<DavEntry>)));
     QObject::connect(lsColJob, SIGNAL(finishedWithError(QNetworkReply*)), this, SLOT(lsJobFinishedWithErrorSlot(QNetworkReply*)));
     QObject::connect(lsColJob, SIGNAL(finishedWithoutError()), this, SLOT(lsJobFinishedWithoutErrorSlot()));
     lsColJob->start();
 
     _lsColJob = lsColJob;
+    _requestPath = lsColJob->reply()->request().url().path();
 }
 
 void DiscoverySingleDirectoryJob::abort()
@@ -239,71 +286,78 @@ void DiscoverySingleDirectoryJob::abort()
     }
 }
 
-static csync_vio_file_stat_t* propertyMapToFileStat(const QMap<QString,QString> &map)
+static csync_vio_file_stat_t* davEntryToFileStat(const DavEntry &entry)
 {
     csync_vio_file_stat_t* file_stat = csync_vio_file_stat_new();
 
-    for (auto it = map.constBegin(); it != map.constEnd(); ++it) {
-        //qDebug() << it.key() << it.value();
-        QString property = it.key();
-        QString value = it.value();
-        if (property == "resourcetype") {
-            if (value.contains("collection")) {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
-            } else {
-                file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
-            }
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
-        } else if  (property == "getlastmodified") {
-            file_stat->mtime = oc_httpdate_parse(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
-        } else if (property == "getcontentlength") {
-            file_stat->size = value.toLongLong();
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
-        } else if (property == "getetag") {
-            file_stat->etag = csync_normalize_etag(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
-        } else if (property == "id") {
-            csync_vio_file_stat_set_file_id(file_stat, value.toUtf8());
-        } else if (property == "downloadURL") {
-            file_stat->directDownloadUrl = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
-        } else if (property == "dDC") {
-            file_stat->directDownloadCookies = strdup(value.toUtf8());
-            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
-        } else if (property == "permissions") {
-            auto v = value.toUtf8();
-            if (value.isEmpty()) {
-                // special meaning for our code: server returned permissions but are empty
-                // meaning only reading is allowed for this resource
-                file_stat->remotePerm[0] = ' ';
-                // see _csync_detect_update()
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else if (v.length() < int(sizeof(file_stat->remotePerm))) {
-                strcpy(file_stat->remotePerm, v.constData());
-                file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
-            } else {
-                qWarning() << "permissions too large" << v;
-            }
+    if (entry.properties & DavEntry::ResourceType) {
+        if (entry.isCollection) {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_DIRECTORY;
+        } else {
+            file_stat->type = CSYNC_VIO_FILE_TYPE_REGULAR;
+        }
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_TYPE;
+    }
+    if (entry.properties & DavEntry::LastModified) {
+        file_stat->mtime = oc_httpdate_parse(entry.lastModified);
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_MTIME;
+    }
+    if (entry.properties & DavEntry::ContentLength) {
+        file_stat->size = entry.contentLength;
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_SIZE;
+    }
+    if (entry.properties & DavEntry::ETag) {
+        file_stat->etag = csync_normalize_etag(entry.etag.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_ETAG;
+    }
+    if (entry.properties & DavEntry::FileId) {
+        csync_vio_file_stat_set_file_id(file_stat, entry.fileId);
+    }
+    if (entry.properties & DavEntry::DownloadUrl) {
+        file_stat->directDownloadUrl = strdup(entry.downloadUrl.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADURL;
+    }
+    if (entry.properties & DavEntry::DownloadCookies) {
+        file_stat->directDownloadCookies = strdup(entry.downloadCookies.constData());
+        file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_DIRECTDOWNLOADCOOKIES;
+    }
+    if (entry.properties & DavEntry::Permissions) {
+        if (entry.permissions[0] == '\0') {
+            // special meaning for our code: server returned permissions but are empty
+            // meaning only reading is allowed for this resource
+            file_stat->remotePerm[0] = ' ';
+            // see _csync_detect_update()
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
+        } else {
+            strcpy(file_stat->remotePerm, entry.permissions);
+            file_stat->fields |= CSYNC_VIO_FILE_STAT_FIELDS_PERM;
         }
     }
 
     return file_stat;
 }
 
-void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, const QMap<QString,QString> &map)
+void DiscoverySingleDirectoryJob::directoryListingEntriesSlot(const QVector<DavEntry> &entries)
+{
+    foreach (const DavEntry &entry, entries) {
+        directoryListingEntry(entry);
+    }
+}
+
+void DiscoverySingleDirectoryJob::directoryListingEntry(const DavEntry &entry)
 {
-    //qDebug() << Q_FUNC_INFO << _subPath << file << map.count() << map.keys() << _account->davPath() << _lsColJob->reply()->request().url().path();
+    //qDebug() << Q_FUNC_INFO << _subPath << entry.href << entry.properties << _account->davPath() << _lsColJob->reply()->request().url().path();
     if (!_ignoredFirst) {
         // First result is the directory itself. Maybe should have a better check for that? FIXME
         _ignoredFirst = true;
-        if (map.contains("permissions")) {
-            emit firstDirectoryPermissions(map.value("permissions"));
+        if (entry.properties & DavEntry::Permissions) {
+            emit firstDirectoryPermissions(QString::fromUtf8(entry.permissions));
         }
 
     } else {
+        QString file = entry.href;
         // Remove <webDAV-Url>/folder/ from <webDAV-Url>/folder/subfile.txt
-        file.remove(0, _lsColJob->reply()->request().url().path().length());
+        file.remove(0, _requestPath.length());
         // remove trailing slash
         while (file.endsWith('/')) {
             file.chop(1);
@@ -313,8 +367,18 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
             file = file.remove(0, 1);
         }
 
+        // With Depth: infinity, entries below the subdirectories are listed too
+        QString parent;
+        if (_depthInfinity) {
+            int slashPos = file.lastIndexOf(QLatin1Char('/'));
+            if (slashPos > -1) {
+                parent = file.left(slashPos);
+                file = file.mid(slashPos + 1);
+                _deepListing = true;
+            }
+        }
 
-        FileStatPointer file_stat(propertyMapToFileStat(map));
+        FileStatPointer file_stat(davEntryToFileStat(entry));
         file_stat->name = strdup(file.toUtf8());
         if (!file_stat->etag || strlen(file_stat->etag) == 0) {
             qDebug() << "WARNING: etag of" << file_stat->name << "is" << file_stat->etag << " This must not happen.";
@@ -328,16 +392,31 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
         if( fileRef.startsWith(QChar('.')) ) {
             file_stat->flags = CSYNC_VIO_FILE_FLAGS_HIDDEN;
         }
-        //qDebug() << "!!!!" << file_stat << file_stat->name << file_stat->file_id << map.count();
-        _results.append(file_stat);
+        if (file_stat->type == CSYNC_VIO_FILE_TYPE_DIRECTORY) {
+            QString path = parent.isEmpty() ? file : parent + QLatin1Char('/') + file;
+            if (_depthInfinity && !_subdirectoryResults.contains(path)) {
+                // an empty directory still has a listing
+                _subdirectoryResults.insert(path, QList<FileStatPointer>());
+            }
+            if (entry.properties & DavEntry::QuotaUsedBytes) {
+                _folderSizes.insert(_subPath + QLatin1Char('/') + path, entry.quotaUsedBytes);
+            }
+        }
+        if (parent.isEmpty()) {
+            _results.append(file_stat);
+        } else {
+            _subdirectoryResults[parent].append(file_stat);
+            return; // not part of the etag of this directory
+        }
     }
 
     //This works in concerto with the RequestEtagJob and the Folder object to check if the remote folder changed.
-    if (map.contains("getetag")) {
-       _etagConcatenation += map.value("getetag");
+    if (entry.properties & DavEntry::ETag) {
+       QString etag = QString::fromUtf8(entry.etag);
+       _etagConcatenation += etag;
 
        if (_firstEtag.isEmpty()) {
-           _firstEtag = map.value("getetag"); // for directory itself
+           _firstEtag = etag; // for directory itself
        }
     }
 }
@@ -345,12 +424,26 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(QString file, con
 void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
 {
     if (!_ignoredFirst) {
-        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingIteratedSlot
+        // This is a sanity check, if we haven't _ignoredFirst then it means we never received any directoryListingEntry
         // which means somehow the server XML was bogus
         emit finishedWithError(ERRNO_WRONG_CONTENT, QLatin1String("Server error: PROPFIND reply is not XML formatted!"));
         deleteLater();
         return;
     }
+    if (!_folderSizes.isEmpty()) {
+        emit folderSizes(_folderSizes);
+    }
+    if (_depthInfinity) {
+        if (_deepListing) {
+            for (auto it = _subdirectoryResults.constBegin(); it != _subdirectoryResults.constEnd(); ++it) {
+                emit subdirectoryListing(_subPath + QLatin1Char('/') + it.key(), it.value());
+            }
+        } else {
+            // Either the tree is flat, or the server answered with Depth: 1 only. In both
+            // cases only the listing of this directory is known to be complete.
+            qDebug() << Q_FUNC_INFO << "Nothing listed below the subdirectories of" << _subPath;
+        }
+    }
     emit etag(_firstEtag);
     emit etagConcatenation(_etagConcatenation);
     emit finishedWithResult(_results);
@@ -380,21 +473,65 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot(QNetworkReply *r)
     deleteLater();
 }
 
+DiscoveryListingQueue::~DiscoveryListingQueue()
+{
+    qDeleteAll(_listings);
+}
+
+void DiscoveryListingQueue::add(const QString &path, DiscoveryDirectoryResult *result)
+{
+    QMutexLocker locker(&_mutex);
+    delete _listings.take(path);
+    _listings.insert(path, result);
+    _listingAdded.wakeAll();
+}
+
+DiscoveryDirectoryResult *DiscoveryListingQueue::take(const QString &path)
+{
+    QMutexLocker locker(&_mutex);
+    return _listings.take(path);
+}
+
+DiscoveryDirectoryResult *DiscoveryListingQueue::waitAndTake(const QString &path)
+{
+    QMutexLocker locker(&_mutex);
+    while (!_aborted && !_listings.contains(path)) {
+        _listingAdded.wait(&_mutex);
+    }
+    return _listings.take(path);
+}
+
+void DiscoveryListingQueue::abort()
+{
+    QMutexLocker locker(&_mutex);
+    _aborted = true;
+    _listingAdded.wakeAll();
+}
+
 void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &pathPrefix)
 {
     _discoveryJob = discoveryJob;
+    _discoveryJob->_listingQueue = _listingQueue;
+    _csync_ctx = discoveryJob->_csync_ctx;
     _pathPrefix = pathPrefix;
+    // The job has not started yet. Once it has, it may be deleted at any time from its thread.
+    _selectiveSyncBlackList = discoveryJob->_selectiveSyncBlackList;
 
-    connect(discoveryJob, SIGNAL(doOpendirSignal(QString,DiscoveryDirectoryResult*)),
-            this, SLOT(doOpendirSlot(QString,DiscoveryDirectoryResult*)),
+    connect(discoveryJob, SIGNAL(doOpendirSignal(QString)),
+            this, SLOT(doOpendirSlot(QString)),
+            Qt::QueuedConnection);
+    connect(discoveryJob, SIGNAL(listingTaken(QString)),
+            this, SLOT(listingTakenSlot(QString)),
             Qt::QueuedConnection);
     connect(discoveryJob, SIGNAL(doGetSizeSignal(QString,qint64*)),
             this, SLOT(doGetSizeSlot(QString,qint64*)),
             Qt::QueuedConnection);
+    connect(discoveryJob, SIGNAL(finished(int)),
+            this, SLOT(discoveryJobFinishedSlot()),
+            Qt::QueuedConnection);
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+QString DiscoveryMainThread::fullPath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -405,90 +542,244 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+QString DiscoveryMainThread::subPath(const QString &fullPath) const
+{
+    int rootLength = this->fullPath(QString()).length();
+    return fullPath.length() > rootLength ? fullPath.mid(rootLength + 1) : QString();
+}
+
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+// if the listing was not in the queue yet
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath)
+{
+    const QString fullPath = this->fullPath(subPath);
 
-    // emit _discoveryJob->folderDiscovered(false, subPath);
-    _discoveryJob->update_job_update_callback (false, subPath.toUtf8(), _discoveryJob);
+    if (_listed.contains(fullPath)) {
+        return; // arrived in the meantime
+    }
+    if (_jobs.contains(fullPath)) {
+        qDebug() << Q_FUNC_INFO << "Waiting for prefetched listing of" << fullPath;
+        return;
+    }
 
-    // Result gets written in there
-    _currentDiscoveryDirectoryResult = r;
-    _currentDiscoveryDirectoryResult->path = fullPath;
+    // The first directory is the root: list the whole tree at once if wanted
+    bool depthInfinity = _depthInfinity;
+    _depthInfinity = false;
+    startSingleDirectoryJob(fullPath, depthInfinity);
+}
 
+void DiscoveryMainThread::startSingleDirectoryJob(const QString &fullPath, bool depthInfinity)
+{
     // Schedule the DiscoverySingleDirectoryJob
-    _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob, SIGNAL(finishedWithResult(const QList<FileStatPointer> &)),
+    auto job = new DiscoverySingleDirectoryJob(_account, fullPath, this);
+    job->setFetchFolderSizes(_fetchFolderSizes);
+    QObject::connect(job, SIGNAL(folderSizes(QHash<QString,qint64>)),
+                     this, SLOT(folderSizesSlot(QHash<QString,qint64>)));
+    QObject::connect(job, SIGNAL(finishedWithResult(const QList<FileStatPointer> &)),
                      this, SLOT(singleDirectoryJobResultSlot(const QList<FileStatPointer> &)));
-    QObject::connect(_singleDirJob, SIGNAL(finishedWithError(int,QString)),
-                     this, SLOT(singleDirectoryJobFinishedWithErrorSlot(int,QString)));
-    QObject::connect(_singleDirJob, SIGNAL(firstDirectoryPermissions(QString)),
-                     this, SLOT(singleDirectoryJobFirstDirectoryPermissionsSlot(QString)));
-    QObject::connect(_singleDirJob, SIGNAL(etagConcatenation(QString)),
-                     this, SIGNAL(etagConcatenation(QString)));
-    QObject::connect(_singleDirJob, SIGNAL(etag(QString)),
-                     this, SIGNAL(etag(QString)));
-    _singleDirJob->start();
+    if (depthInfinity) {
+        job->setDepthInfinity(true);
+        QObject::connect(job, SIGNAL(finishedWithError(int,QString)),
+                         this, SLOT(depthInfinityJobFinishedWithErrorSlot(int,QString)));
+        QObject::connect(job, SIGNAL(subdirectoryListing(QString,const QList<FileStatPointer> &)),
+                         this, SLOT(subdirectoryListingSlot(QString,const QList<FileStatPointer> &)));
+    } else {
+        QObject::connect(job, SIGNAL(finishedWithError(int,QString)),
+                         this, SLOT(singleDirectoryJobFinishedWithErrorSlot(int,QString)));
+    }
+    if (_jobs.isEmpty() && _listed.isEmpty()) {
+        // The root directory
+        QObject::connect(job, SIGNAL(firstDirectoryPermissions(QString)),
+                         this, SLOT(singleDirectoryJobFirstDirectoryPermissionsSlot(QString)));
+        QObject::connect(job, SIGNAL(etagConcatenation(QString)),
+                         this, SIGNAL(etagConcatenation(QString)));
+        QObject::connect(job, SIGNAL(etag(QString)),
+                         this, SIGNAL(etag(QString)));
+    }
+    _jobs.insert(fullPath, job);
+    _propfindCount++;
+    job->start();
 }
 
+// Hand the listing over to the sync thread, csync takes it when it opens the directory
+void DiscoveryMainThread::addListing(const QString &fullPath, DiscoveryDirectoryResult *result)
+{
+    const QString subPath = this->subPath(fullPath);
+    result->path = fullPath;
+    _listed.insert(fullPath);
+
+    if (result->code == 0) {
+        QStringList changedSubdirectories;
+        foreach (const FileStatPointer &stat, result->list) {
+            if (stat->type != CSYNC_VIO_FILE_TYPE_DIRECTORY || !stat->name) {
+                continue;
+            }
+            const QString name = QString::fromUtf8(stat->name);
+            const QString subdirectory = fullPath + QLatin1Char('/') + name;
+            if (!_folderSizes.isEmpty()) {
+                auto it = _folderSizes.find(subdirectory);
+                if (it != _folderSizes.end()) {
+                    result->folderSizes.insert(name, it.value());
+                    _folderSizes.erase(it);
+                }
+            }
+            if (_prefetchLimit > 0) {
+                QString path = subPath.isEmpty() ? name : subPath + QLatin1Char('/') + name;
+                if (!isInSelectiveSyncBlackList(path) && remoteDirectoryChanged(path, stat)) {
+                    changedSubdirectories.append(subdirectory);
+                }
+            }
+        }
+        if (!changedSubdirectories.isEmpty()) {
+            _changedSubdirectories.insert(fullPath, changedSubdirectories);
+        }
+    }
+
+    _listingQueue->add(subPath, result);
+}
+
+// Same as DiscoveryJob::isInSelectiveSyncBlackList(), but with our own copy of the list
+bool DiscoveryMainThread::isInSelectiveSyncBlackList(const QString &path) const
+{
+    return !_selectiveSyncBlackList.isEmpty() && findPathInList(_selectiveSyncBlackList, path);
+}
 
 void DiscoveryMainThread::singleDirectoryJobResultSlot(const QList<FileStatPointer> & result)
 {
-    if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+    auto job = qobject_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!job) {
+        return;
     }
-    qDebug() << Q_FUNC_INFO << "Have" << result.count() << "results for " << _currentDiscoveryDirectoryResult->path;
+    _jobs.remove(job->path());
+    qDebug() << Q_FUNC_INFO << "Have" << result.count() << "results for " << job->path();
 
+    DiscoveryDirectoryResult *listing = new DiscoveryDirectoryResult;
+    listing->list = result;
+    listing->code = 0;
+    addListing(job->path(), listing);
 
-    _currentDiscoveryDirectoryResult->list = result;
-    _currentDiscoveryDirectoryResult->code = 0;
-    _currentDiscoveryDirectoryResult->listIndex = 0;
-     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
-
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    // csync is still reading the local tree: do not wait for it to take the listing
+    if (!_listingTaken) {
+        queueChangedSubdirectories(job->path());
+    }
+    startPrefetchJobs();
 }
 
 void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
 {
-    if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+    auto job = qobject_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!job) {
+        return;
     }
-    qDebug() << Q_FUNC_INFO << csyncErrnoCode << msg;
+    _jobs.remove(job->path());
+    qDebug() << Q_FUNC_INFO << job->path() << csyncErrnoCode << msg;
 
-     _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
-     _currentDiscoveryDirectoryResult->msg = msg;
-     _currentDiscoveryDirectoryResult = 0; // the sync thread owns it now
+    // The error is only reported if csync actually reads the directory
+    DiscoveryDirectoryResult *listing = new DiscoveryDirectoryResult;
+    listing->code = csyncErrnoCode;
+    listing->msg = msg;
+    addListing(job->path(), listing);
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::depthInfinityJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+{
+    auto job = qobject_cast<DiscoverySingleDirectoryJob *>(sender());
+    if (!job) {
+        return;
+    }
+    _jobs.remove(job->path());
+    // Maybe the server does not allow it, read the tree directory by directory then
+    qDebug() << Q_FUNC_INFO << "Listing the whole tree failed, falling back to single directories:" << csyncErrnoCode << msg;
+    startSingleDirectoryJob(job->path(), false);
+}
+
+void DiscoveryMainThread::subdirectoryListingSlot(const QString &fullPath, const QList<FileStatPointer> &result)
+{
+    DiscoveryDirectoryResult *listing = new DiscoveryDirectoryResult;
+    listing->list = result;
+    listing->code = 0;
+    addListing(fullPath, listing);
+}
+
+void DiscoveryMainThread::folderSizesSlot(const QHash<QString, qint64> &sizes)
+{
+    // Kept until the listing of their parent is handed to csync
+    for (auto it = sizes.constBegin(); it != sizes.constEnd(); ++it) {
+        _folderSizes.insert(it.key(), it.value());
+    }
 }
 
 void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(const QString &p)
 {
-    // Should be thread safe since the sync thread is blocked
-    if (!_discoveryJob->_csync_ctx->remote.root_perms) {
+    // csync does not use them, only the SyncEngine reads them in this thread after the discovery
+    if (!_csync_ctx->remote.root_perms) {
         qDebug() << "Permissions for root dir:" << p;
-        _discoveryJob->_csync_ctx->remote.root_perms = strdup(p.toUtf8());
+        _csync_ctx->remote.root_perms = strdup(p.toUtf8());
     }
 }
 
-void DiscoveryMainThread::doGetSizeSlot(const QString& path, qint64* result)
+// Whether csync is going to read the directory from the server rather than from the
+// journal, see _csync_detect_update()
+bool DiscoveryMainThread::remoteDirectoryChanged(const QString &path, const FileStatPointer &stat) const
 {
-    QString fullPath = _pathPrefix;
-    if (!_pathPrefix.endsWith('/')) {
-        fullPath += '/';
+    auto it = _journalDirectories.constFind(path);
+    if (it == _journalDirectories.constEnd()) {
+        return true;
     }
-    fullPath += path;
-    // remove trailing slash
-    while (fullPath.endsWith('/')) {
-        fullPath.chop(1);
+    return it->_etag != QByteArray(stat->etag)
+        || it->_fileId != QByteArray(stat->file_id)
+        || it->_remotePerm != QByteArray(stat->remotePerm);
+}
+
+// csync is reading the directory now: queue the listings of its changed subdirectories,
+// it will need them next. csync reads depth first, so they go before the rest of the queue.
+void DiscoveryMainThread::listingTakenSlot(const QString &subPath)
+{
+    _listingTaken = true;
+    queueChangedSubdirectories(fullPath(subPath));
+    startPrefetchJobs();
+}
+
+void DiscoveryMainThread::queueChangedSubdirectories(const QString &fullPath)
+{
+    const QStringList subdirectories = _changedSubdirectories.take(fullPath);
+    for (int i = subdirectories.size() - 1; i >= 0; --i) {
+        _prefetchQueue.prepend(subdirectories.at(i));
+    }
+}
+
+void DiscoveryMainThread::startRemoteListing()
+{
+    // The root is always read from the server, see csync_update()
+    doOpendirSlot(QString());
+}
+
+void DiscoveryMainThread::startPrefetchJobs()
+{
+    while (_jobs.size() < _prefetchLimit && !_prefetchQueue.isEmpty()) {
+        QString fullPath = _prefetchQueue.takeFirst();
+        if (_jobs.contains(fullPath) || _listed.contains(fullPath)) {
+            continue;
+        }
+        startSingleDirectoryJob(fullPath, false);
     }
+}
+
+void DiscoveryMainThread::doGetSizeSlot(const QString& path, qint64* result)
+{
+    QString fullPath = this->fullPath(path);
 
     _currentGetSizeResult = result;
 
     // Schedule the DiscoverySingleDirectoryJob
     auto propfindJob = new PropfindJob(_account, fullPath, this);
     propfindJob->setProperties(QList<QByteArray>() << "resourcetype" << "quota-used-bytes");
+    _propfindCount++;
     QObject::connect(propfindJob, SIGNAL(finishedWithError()),
                      this, SLOT(slotGetSizeFinishedWithError()));
     QObject::connect(propfindJob, SIGNAL(result(QVariantMap)),
@@ -526,23 +817,33 @@ void DiscoveryMainThread::slotGetSizeResult(const QVariantMap &map)
 
 
 
-// called from SyncEngine
-void DiscoveryMainThread::abort() {
-    if (_singleDirJob) {
-        _singleDirJob->disconnect(SIGNAL(finishedWithError(int,QString)), this);
-        _singleDirJob->disconnect(SIGNAL(firstDirectoryPermissions(QString)), this);
-        _singleDirJob->disconnect(SIGNAL(finishedWithResult(const QList<FileStatPointer> &)), this);
-        _singleDirJob->abort();
-    }
-    if (_currentDiscoveryDirectoryResult) {
-        if (_discoveryJob->_vioMutex.tryLock()) {
-            _currentDiscoveryDirectoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
-            _currentDiscoveryDirectoryResult->code = EIO;
-            _currentDiscoveryDirectoryResult = 0;
-            _discoveryJob->_vioWaitCondition.wakeAll();
-            _discoveryJob->_vioMutex.unlock();
+void DiscoveryMainThread::abortListingJobs()
+{
+    _prefetchQueue.clear();
+    _changedSubdirectories.clear();
+    foreach (const QPointer<DiscoverySingleDirectoryJob> &job, _jobs) {
+        if (job) {
+            job->disconnect(this);
+            job->abort();
         }
     }
+    _jobs.clear();
+}
+
+// csync has read the remote tree (or failed): the listings still in flight are not going to be used
+void DiscoveryMainThread::discoveryJobFinishedSlot()
+{
+    if (!_jobs.isEmpty() || !_prefetchQueue.isEmpty()) {
+        qDebug() << Q_FUNC_INFO << "Aborting" << _jobs.size() << "unused listings";
+    }
+    abortListingJobs();
+    _discoveryJob = 0;
+}
+
+// called from SyncEngine
+void DiscoveryMainThread::abort() {
+    abortListingJobs();
+    _listingQueue->abort();
     if (_currentGetSizeResult) {
         _currentGetSizeResult = 0;
         QMutexLocker locker(&_discoveryJob->_vioMutex);
@@ -555,20 +856,30 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
 {
     DiscoveryJob *discoveryJob = static_cast<DiscoveryJob*>(userdata);
     if (discoveryJob) {
-        qDebug() << discoveryJob << url << "Calling into main thread...";
-
-        QScopedPointer<DiscoveryDirectoryResult> directoryResult(new DiscoveryDirectoryResult());
-        directoryResult->code = EIO;
-
-        discoveryJob->_vioMutex.lock();
-        const QString qurl = QString::fromUtf8(url);
-        emit discoveryJob->doOpendirSignal(qurl, directoryResult.data());
-        discoveryJob->_vioWaitCondition.wait(&discoveryJob->_vioMutex, ULONG_MAX); // FIXME timeout?
-        discoveryJob->_vioMutex.unlock();
-
-        qDebug() << discoveryJob << url << "...Returned from main thread";
+        QString path = QString::fromUtf8(url);
+        while (path.endsWith('/')) {
+            path.chop(1);
+        }
+        if (path.isEmpty() && discoveryJob->_performanceReport) {
+            // csync is done with the local tree and opens the remote root
+            discoveryJob->_performanceReport->endPhase(SyncPerformanceReport::LocalDiscovery);
+        }
+        update_job_update_callback(false, url, discoveryJob);
+
+        // The listing is usually there already, otherwise ask the main thread for it
+        QScopedPointer<DiscoveryDirectoryResult> directoryResult(discoveryJob->_listingQueue->take(path));
+        if (!directoryResult) {
+            qDebug() << discoveryJob << url << "Waiting for the listing...";
+            emit discoveryJob->doOpendirSignal(path);
+            directoryResult.reset(discoveryJob->_listingQueue->waitAndTake(path));
+            qDebug() << discoveryJob << url << "...Got the listing";
+        }
+        if (!directoryResult) {
+            directoryResult.reset(new DiscoveryDirectoryResult);
+            directoryResult->msg = tr("Aborted by the user"); // Actually also created somewhere else by sync engine
+            directoryResult->code = EIO;
+        }
 
-        // Upon awakening from the _vioWaitCondition, iterator should be a valid iterator.
         if (directoryResult->code != 0) {
             qDebug() << directoryResult->code << "when opening" << url << "msg=" << directoryResult->msg;
             errno = directoryResult->code;
@@ -576,6 +887,18 @@ csync_vio_handle_t* DiscoveryJob::remote_vio_opendir_hook (const char *url,
             discoveryJob->_csync_ctx->error_string = qstrdup( directoryResult->msg.toUtf8().constData() );
             return NULL;
         }
+        emit discoveryJob->listingTaken(path);
+
+        // For checkSelectiveSyncNewFolder() of the subdirectories
+        if (!directoryResult->folderSizes.isEmpty()) {
+            QString prefix = path;
+            if (!prefix.isEmpty()) {
+                prefix += QLatin1Char('/');
+            }
+            for (auto it = directoryResult->folderSizes.constBegin(); it != directoryResult->folderSizes.constEnd(); ++it) {
+                discoveryJob->_folderSizes.insert(prefix + it.key(), it.value());
+            }
+        }
 
         return directoryResult.take();
     }
@@ -610,12 +933,13 @@ void DiscoveryJob::remote_vio_closedir_hook (csync_vio_handle_t *dhandle,  void
 }
 
 void DiscoveryJob::start() {
-    _selectiveSyncBlackList.sort();
     _selectiveSyncWhiteList.sort();
+    _localDiscoveryPaths.sort();
     _csync_ctx->callbacks.update_callback_userdata = this;
     _csync_ctx->callbacks.update_callback = update_job_update_callback;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = isInSelectiveSyncBlackListCallback;
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = checkSelectiveSyncNewFolderCallback;
+    _csync_ctx->callbacks.checkLocalDiscoveryHook = _incrementalLocalDiscovery ? checkLocalDiscoveryCallback : 0;
 
     _csync_ctx->callbacks.remote_opendir_hook = remote_vio_opendir_hook;
     _csync_ctx->callbacks.remote_readdir_hook = remote_vio_readdir_hook;
@@ -627,9 +951,13 @@ void DiscoveryJob::start() {
     csync_set_log_userdata(_log_userdata);
     _lastUpdateProgressCallbackCall.invalidate();
     int ret = csync_update(_csync_ctx);
+    if (_performanceReport) {
+        _performanceReport->endPhase(SyncPerformanceReport::RemoteDiscovery);
+    }
 
     _csync_ctx->callbacks.checkSelectiveSyncNewFolderHook = 0;
     _csync_ctx->callbacks.checkSelectiveSyncBlackListHook = 0;
+    _csync_ctx->callbacks.checkLocalDiscoveryHook = 0;
     _csync_ctx->callbacks.update_callback = 0;
     _csync_ctx->callbacks.update_callback_userdata = 0;
 
@@ -19,14 +19,21 @@
 #include <QStringList>
 #include <csync.h>
 #include <QMap>
+#include <QHash>
 #include "networkjobs.h"
+#include "syncjournaldb.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QLinkedList>
+#include <QSet>
+#include <QSharedPointer>
+
+class TestDiscoveryPhase;
 
 namespace OCC {
 
 class Account;
+class SyncPerformanceReport;
 
 /**
  * The Discovery Phase was once called "update" phase in csync terms.
@@ -66,10 +73,44 @@ struct DiscoveryDirectoryResult {
     QString msg;
     int code;
     QList<FileStatPointer> list;
+    QHash<QString, qint64> folderSizes; // of the subdirectories in list by name, if the server sent them
     int listIndex;
     DiscoveryDirectoryResult() : code(EIO), listIndex(0) { }
 };
 
+/**
+ * @brief Remote directory listings on their way from the main thread to the sync thread
+ *
+ * The main thread adds the listings as the network jobs finish, in any order, and
+ * csync takes them when it opens the directories. Only a listing that has not
+ * arrived yet makes the sync thread wait.
+ *
+ * @ingroup libsync
+ */
+class DiscoveryListingQueue {
+public:
+    DiscoveryListingQueue() : _aborted(false) { }
+    ~DiscoveryListingQueue();
+
+    /** Add the listing of path, relative to the sync root. Takes the ownership of result. */
+    void add(const QString &path, DiscoveryDirectoryResult *result);
+
+    /** Take the listing of path if it is there, or return 0 */
+    DiscoveryDirectoryResult *take(const QString &path);
+
+    /** Wait until the listing of path is there and take it. Returns 0 if aborted. */
+    DiscoveryDirectoryResult *waitAndTake(const QString &path);
+
+    /** Wake up the sync thread, waiting for a listing is over */
+    void abort();
+
+private:
+    QMutex _mutex;
+    QWaitCondition _listingAdded;
+    QHash<QString, DiscoveryDirectoryResult *> _listings;
+    bool _aborted;
+};
+
 /**
  * @brief The DiscoverySingleDirectoryJob class
  *
@@ -83,6 +124,21 @@ public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = 0);
     void start();
     void abort();
+    QString path() const { return _subPath; }
+
+    /**
+     * List the whole tree below the directory with one Depth: infinity request.
+     * The listings of the subdirectories are emitted with subdirectoryListing()
+     * before finishedWithResult(), but only if the server listed more than the
+     * first level.
+     */
+    void setDepthInfinity(bool depthInfinity) { _depthInfinity = depthInfinity; }
+
+    /**
+     * Also request the size of the subdirectories. They are emitted with folderSizes()
+     * before finishedWithResult().
+     */
+    void setFetchFolderSizes(bool fetch) { _fetchFolderSizes = fetch; }
     // This is not actually a network job, it is just a job
 signals:
     void firstDirectoryPermissions(const QString &);
@@ -90,18 +146,30 @@ signals:
     void etag(const QString &);
     void finishedWithResult(const QList<FileStatPointer> &);
     void finishedWithError(int csyncErrnoCode, const QString &msg);
+    void subdirectoryListing(const QString &fullPath, const QList<FileStatPointer> &);
+    void folderSizes(const QHash<QString, qint64> &sizes);
 private slots:
-    void directoryListingIteratedSlot(QString, const QMap<QString,QString>&);
+    void directoryListingEntriesSlot(const QVector<DavEntry> &entries);
     void lsJobFinishedWithoutErrorSlot();
     void lsJobFinishedWithErrorSlot(QNetworkReply*);
 private:
+    void directoryListingEntry(const DavEntry &entry);
+
     QList<FileStatPointer> _results;
     QString _subPath;
+    QString _requestPath; // the path of the PROPFIND url, the hrefs start with it
     QString _etagConcatenation;
     QString _firstEtag;
     AccountPtr _account;
     bool _ignoredFirst;
+    bool _depthInfinity;
+    bool _deepListing; // there were entries below the subdirectories
+    bool _fetchFolderSizes;
+    QHash<QString, qint64> _folderSizes; // quota-used-bytes by full path
+    QMap<QString, QList<FileStatPointer> > _subdirectoryResults; // by path relative to _subPath
     QPointer<LsColJob> _lsColJob;
+
+    friend class ::TestDiscoveryPhase;
 };
 
 // Lives in main thread. Deleted by the SyncEngine
@@ -109,30 +177,100 @@ class DiscoveryJob;
 class DiscoveryMainThread : public QObject {
     Q_OBJECT
 
-    QPointer<DiscoveryJob> _discoveryJob;
-    QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
+    // Lives in the sync thread, only used to wake it up when it waits for doGetSizeSlot()
+    DiscoveryJob *_discoveryJob;
+    CSYNC *_csync_ctx;
+    QSharedPointer<DiscoveryListingQueue> _listingQueue;
     QString _pathPrefix; // remote path
     AccountPtr _account;
-    DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
     qint64 *_currentGetSizeResult;
 
+    // The listings are requested when csync asks for them, or before for the changed
+    // subdirectories of the directories csync has read. All by full remote path.
+    bool _depthInfinity; // list the whole tree with the first request
+    QHash<QString, SyncJournalDb::DirectoryInfo> _journalDirectories; // by path relative to the sync root
+    int _prefetchLimit; // maximum number of listings in flight, 0 disables the prefetching
+    QLinkedList<QString> _prefetchQueue; // in the order csync is expected to read them
+    QHash<QString, QPointer<DiscoverySingleDirectoryJob> > _jobs; // in flight
+    QSet<QString> _listed; // given to the sync thread
+    QHash<QString, QStringList> _changedSubdirectories; // of the listings csync has not taken yet
+    bool _listingTaken; // csync has started reading the remote tree
+    int _propfindCount;
+    QStringList _selectiveSyncBlackList; // sorted, a copy of the one of the DiscoveryJob
+
+    // Sizes of the directories from the listings, for the new big folder check. By full path.
+    bool _fetchFolderSizes;
+    QHash<QString, qint64> _folderSizes;
+
+    QString fullPath(const QString &subPath) const;
+    QString subPath(const QString &fullPath) const;
+    void addListing(const QString &fullPath, DiscoveryDirectoryResult *result);
+    bool isInSelectiveSyncBlackList(const QString &path) const;
+    bool remoteDirectoryChanged(const QString &path, const FileStatPointer &stat) const;
+    void queueChangedSubdirectories(const QString &fullPath);
+    void startPrefetchJobs();
+    void startSingleDirectoryJob(const QString &fullPath, bool depthInfinity);
+    void abortListingJobs();
+
 public:
-    DiscoveryMainThread(AccountPtr account) : QObject(), _account(account),
-        _currentDiscoveryDirectoryResult(0), _currentGetSizeResult(0)
+    DiscoveryMainThread(AccountPtr account, int prefetchLimit = 0)
+        : QObject(), _discoveryJob(0), _csync_ctx(0),
+        _listingQueue(new DiscoveryListingQueue), _account(account),
+        _currentGetSizeResult(0),
+        _depthInfinity(false), _prefetchLimit(prefetchLimit),
+        _listingTaken(false), _propfindCount(0), _fetchFolderSizes(false)
     { }
     void abort();
 
+    /**
+     * Get the whole remote tree with a single Depth: infinity PROPFIND instead of one
+     * request per directory. Worth it if most directories have to be read anyway, like
+     * in the first sync. Falls back to single directories if the server refuses.
+     */
+    void setDepthInfinity(bool depthInfinity) { _depthInfinity = depthInfinity; }
+
+    /**
+     * Get the size of the subdirectories with the listings, so the check of new folders
+     * does not need a request for each of them.
+     */
+    void setFetchFolderSizes(bool fetch) { _fetchFolderSizes = fetch; }
+
+    /**
+     * The directories of the journal, to know which subdirectories csync is going to read
+     * from the server and should be prefetched. Without them, all of them are.
+     */
+    void setJournalDirectories(const QHash<QString, SyncJournalDb::DirectoryInfo> &directories)
+        { _journalDirectories = directories; }
+
+    /**
+     * Start listing the remote tree before csync asks for it, so that the requests run
+     * while the sync thread reads the local tree. Until csync takes the first listing,
+     * the changed subdirectories are prefetched as soon as their parent arrives.
+     * Call after setupHooks(). The prefetching stops when the DiscoveryJob finishes.
+     */
+    void startRemoteListing();
+
+    /** Number of PROPFIND requests sent so far */
+    int propfindCount() const { return _propfindCount; }
 
 public slots:
     // From DiscoveryJob:
-    void doOpendirSlot(const QString &url, DiscoveryDirectoryResult* );
+    void doOpendirSlot(const QString &path);
+    void listingTakenSlot(const QString &path);
     void doGetSizeSlot(const QString &path ,qint64 *result);
+    void discoveryJobFinishedSlot();
 
     // From Job:
     void singleDirectoryJobResultSlot(const QList<FileStatPointer> &);
     void singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
     void singleDirectoryJobFirstDirectoryPermissionsSlot(const QString&);
 
+    // From the Depth: infinity job:
+    void depthInfinityJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
+    void subdirectoryListingSlot(const QString &fullPath, const QList<FileStatPointer> &);
+
+    void folderSizesSlot(const QHash<QString, qint64> &sizes);
+
     void slotGetSizeFinishedWithError();
     void slotGetSizeResult(const QVariantMap&);
 signals:
@@ -167,6 +305,13 @@ class DiscoveryJob : public QObject {
     bool checkSelectiveSyncNewFolder(const QString &path);
     static int checkSelectiveSyncNewFolderCallback(void*, const char*);
 
+    /**
+     * return true if the local directory has to be read from the file system,
+     * false if its content may be restored from the journal
+     */
+    bool checkLocalDiscovery(const QString &path) const;
+    static int checkLocalDiscoveryCallback(void*, const char*);
+
     // Just for progress
     static void update_job_update_callback (bool local,
                                             const char *dirname,
@@ -181,11 +326,16 @@ class DiscoveryJob : public QObject {
                                                                   void *userdata);
     QMutex _vioMutex;
     QWaitCondition _vioWaitCondition;
+    QSharedPointer<DiscoveryListingQueue> _listingQueue; // set by DiscoveryMainThread::setupHooks()
+
+    // Sizes of the directories that came with the listings, by path. Only used in the sync thread.
+    QHash<QString, qint64> _folderSizes;
 
 
 public:
     explicit DiscoveryJob(CSYNC *ctx, QObject* parent = 0)
-            : QObject(parent), _csync_ctx(ctx), _newBigFolderSizeLimit(-1) {
+            : QObject(parent), _csync_ctx(ctx), _newBigFolderSizeLimit(-1), _incrementalLocalDiscovery(false)
+            , _performanceReport(0) {
         // We need to forward the log property as csync uses thread local
         // and updates run in another thread
         _log_callback = csync_get_log_callback();
@@ -196,13 +346,21 @@ public:
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
     qint64 _newBigFolderSizeLimit;
+    /* If set, only the local directories on the way to and below _localDiscoveryPaths are read from disk */
+    bool _incrementalLocalDiscovery;
+    QStringList _localDiscoveryPaths;
+    // Gets the end of the discovery phases, timed in the sync thread. The SyncEngine
+    // doesn't touch the report until finished() is emitted.
+    SyncPerformanceReport *_performanceReport;
     Q_INVOKABLE void start();
 signals:
     void finished(int result);
     void folderDiscovered(bool local, QString folderUrl);
 
-    // After the discovery job has been woken up again (_vioWaitCondition)
-    void doOpendirSignal(QString url, DiscoveryDirectoryResult*);
+    // The listing of the directory is needed, csync waits for it in _listingQueue
+    void doOpendirSignal(const QString &path);
+    // csync took the listing of the directory from _listingQueue and is reading it
+    void listingTaken(const QString &path);
     void doGetSizeSignal(const QString &path, qint64 *result);
 
     // A new folder was discovered and was not synced because of the confirmation feature
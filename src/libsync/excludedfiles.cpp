@@ -13,6 +13,7 @@
 
 #include "excludedfiles.h"
 
+#include <QDebug>
 #include <QFileInfo>
 #include <QReadLocker>
 #include <QWriteLocker>
@@ -27,12 +28,14 @@ using namespace OCC;
 
 ExcludedFiles::ExcludedFiles()
     : _excludes(NULL)
+    , _cache(csync_exclude_cache_new())
 {
 }
 
 ExcludedFiles::~ExcludedFiles()
 {
-    c_strlist_destroy(_excludes);
+    csync_exclude_cache_free(_cache);
+    csync_exclude_matcher_free(_excludes);
 }
 
 ExcludedFiles& ExcludedFiles::instance()
@@ -50,12 +53,24 @@ void ExcludedFiles::addExcludeFilePath(const QString& path)
 void ExcludedFiles::reloadExcludes()
 {
     QWriteLocker locker(&_mutex);
-    c_strlist_destroy(_excludes);
+    csync_exclude_matcher_free(_excludes);
     _excludes = NULL;
 
+    // the cached results are only valid for the old patterns
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    csync_exclude_cache_stats(_cache, &hits, &misses);
+    qDebug() << "Exclude cache hits:" << hits + _cacheHits.fetchAndAddRelaxed(0) << "misses:" << misses;
+    csync_exclude_cache_clear(_cache);
+
+    c_strlist_t* list = NULL;
     foreach (const QString& file, _excludeFiles) {
-        csync_exclude_load(file.toUtf8(), &_excludes);
+        csync_exclude_load(file.toUtf8(), &list);
+    }
+    if (csync_exclude_compile(list, &_excludes) < 0) {
+        qWarning() << "Could not compile the exclude patterns";
     }
+    c_strlist_destroy(list);
 }
 
 CSYNC_EXCLUDE_TYPE ExcludedFiles::isExcluded(
@@ -75,6 +90,32 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::isExcluded(
     if (fi.isDir()) {
         type = CSYNC_FTW_TYPE_DIR;
     }
-    QReadLocker lock(&_mutex);
-    return csync_excluded_no_ctx(_excludes, relativePath.toUtf8(), type);
+    const QByteArray path = relativePath.toUtf8();
+
+    // Usually the directory of the path is cached already and the lookup
+    // only needs to read the cache: don't serialize the discovery threads.
+    {
+        QReadLocker lock(&_mutex);
+        CSYNC_EXCLUDE_TYPE match = CSYNC_NOT_EXCLUDED;
+        int rc = csync_excluded_no_ctx_cache_lookup(_excludes, _cache, path, type, &match);
+        if (rc >= 0) {
+            if (rc > 0) {
+                _cacheHits.fetchAndAddRelaxed(1);
+            }
+            return match;
+        }
+    }
+
+    QWriteLocker lock(&_mutex);
+    return csync_excluded_no_ctx_cached(_excludes, _cache, path, type);
+}
+
+void ExcludedFiles::cacheStats(quint64* hits, quint64* misses) const
+{
+    QReadLocker locker(&_mutex);
+    uint64_t h = 0;
+    uint64_t m = 0;
+    csync_exclude_cache_stats(_cache, &h, &m);
+    *hits = h + _cacheHits.fetchAndAddRelaxed(0);
+    *misses = m;
 }
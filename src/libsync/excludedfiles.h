@@ -15,6 +15,7 @@
 
 #include "owncloudlib.h"
 
+#include <QAtomicInt>
 #include <QObject>
 #include <QReadWriteLock>
 #include <QStringList>
@@ -56,6 +57,12 @@ public:
             const QString& relativePath,
             bool excludeHidden) const;
 
+    /**
+     * How often the result for a leading directory of a checked path was
+     * cached already (hits) and how often it had to be computed (misses).
+     */
+    void cacheStats(quint64* hits, quint64* misses) const;
+
 public slots:
     /**
      * Reloads the exclude patterns from the registered paths.
@@ -66,7 +73,9 @@ private:
     ExcludedFiles();
     ~ExcludedFiles();
 
-    c_strlist_t* _excludes;
+    csync_exclude_matcher_t* _excludes;
+    csync_exclude_cache_t* _cache; // results for directories, only written with _mutex locked for writing
+    mutable QAtomicInt _cacheHits; // the hits of lookups with _mutex locked for reading
     QStringList _excludeFiles;
     mutable QReadWriteLock _mutex;
 };
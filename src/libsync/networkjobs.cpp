@@ -126,142 +126,303 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader) {
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
-        }
 
-    } while (!reader.atEnd());
-    return result;
+LsColXMLParser::LsColXMLParser()
+    : _emitPropertyMaps(true)
+    , _currentProperty(DavEntry::NoProperty)
+    , _propertyDepth(0)
+    , _currentPropsHaveHttp200(false)
+    , _insidePropstat(false)
+    , _insideProp(false)
+    , _insideMultiStatus(false)
+    , _readingHref(false)
+    , _readingStatus(false)
+    , _failed(false)
+{
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
 }
 
+bool LsColXMLParser::parse( const QByteArray& xml, QHash<QString, qint64> *sizes, const QString& expectedPath)
+{
+    return addData(xml, sizes, expectedPath) && finish();
+}
+
+// The properties of DavEntry, by their name in any namespace
+static DavEntry::Property davEntryProperty(const QStringRef &name)
+{
+    if (name == QLatin1String("resourcetype")) {
+        return DavEntry::ResourceType;
+    } else if (name == QLatin1String("getlastmodified")) {
+        return DavEntry::LastModified;
+    } else if (name == QLatin1String("getcontentlength")) {
+        return DavEntry::ContentLength;
+    } else if (name == QLatin1String("getetag")) {
+        return DavEntry::ETag;
+    } else if (name == QLatin1String("id")) {
+        return DavEntry::FileId;
+    } else if (name == QLatin1String("downloadURL")) {
+        return DavEntry::DownloadUrl;
+    } else if (name == QLatin1String("dDC")) {
+        return DavEntry::DownloadCookies;
+    } else if (name == QLatin1String("permissions")) {
+        return DavEntry::Permissions;
+    } else if (name == QLatin1String("quota-used-bytes")) {
+        return DavEntry::QuotaUsedBytes;
+    }
+    return DavEntry::NoProperty;
+}
+
+// Copy value as utf8 and zero terminated into buf, truncated to size - 1 bytes.
+// Returns false if it had to be truncated.
+static bool copyToBuffer(const QString &value, char *buf, int size)
+{
+    const int len = qMin(value.size(), size - 1);
+    const QChar *chars = value.constData();
+    for (int i = 0; i < len; ++i) {
+        if (chars[i].unicode() >= 0x80) {
+            // rare, take the slow path
+            QByteArray utf8 = value.toUtf8();
+            const int utf8Len = qMin(utf8.size(), size - 1);
+            memcpy(buf, utf8.constData(), utf8Len);
+            buf[utf8Len] = '\0';
+            return utf8Len == utf8.size();
+        }
+        buf[i] = char(chars[i].unicode());
+    }
+    buf[len] = '\0';
+    return len == value.size();
+}
 
-LsColXMLParser::LsColXMLParser()
+void LsColXMLParser::propertyFinished(const QString &name, QHash<QString, qint64> *sizes)
 {
+    const QString &content = _currentPropertyContent;
+
+    if (name == QLatin1String("resourcetype") && content.contains("collection")) {
+        _folders.append(_currentHref);
+    } else if (name == QLatin1String("quota-used-bytes")) {
+        bool ok = false;
+        auto s = content.toLongLong(&ok);
+        if (ok && sizes) {
+            sizes->insert(_currentHref, s);
+        }
+    }
+
+    bool ok = true;
+    switch (_currentProperty) {
+    case DavEntry::ResourceType:
+        _propstatEntry.isCollection = content.contains("collection");
+        break;
+    case DavEntry::LastModified:
+        copyToBuffer(content, _propstatEntry.lastModified, sizeof(_propstatEntry.lastModified));
+        break;
+    case DavEntry::ContentLength:
+        _propstatEntry.contentLength = content.toLongLong();
+        break;
+    case DavEntry::ETag:
+        _propstatEntry.etag = content.toUtf8();
+        break;
+    case DavEntry::FileId:
+        copyToBuffer(content, _propstatEntry.fileId, sizeof(_propstatEntry.fileId));
+        break;
+    case DavEntry::DownloadUrl:
+        _propstatEntry.downloadUrl = content.toUtf8();
+        break;
+    case DavEntry::DownloadCookies:
+        _propstatEntry.downloadCookies = content.toUtf8();
+        break;
+    case DavEntry::Permissions:
+        ok = copyToBuffer(content, _propstatEntry.permissions, sizeof(_propstatEntry.permissions));
+        if (!ok) {
+            qWarning() << "permissions too large" << content;
+        }
+        break;
+    case DavEntry::QuotaUsedBytes:
+        _propstatEntry.quotaUsedBytes = content.toLongLong(&ok);
+        break;
+    case DavEntry::NoProperty:
+        ok = false;
+        break;
+    }
+    if (ok) {
+        _propstatEntry.properties |= _currentProperty;
+    }
 
+    if (_emitPropertyMaps) {
+        _currentTmpProperties.insert(name, content);
+    }
 }
 
-bool LsColXMLParser::parse( const QByteArray& xml, QHash<QString, qint64> *sizes, const QString& expectedPath)
+void LsColXMLParser::flushEntries()
+{
+    if (!_entries.isEmpty()) {
+        emit directoryListingEntries(_entries);
+        _entries.clear();
+    }
+}
+
+bool LsColXMLParser::addData(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString &expectedPath)
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
-        // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
-            if (name == QLatin1String("href")) {
+    if (_failed) {
+        return false;
+    }
+    _emitPropertyMaps = receivers(SIGNAL(directoryListingIterated(QString,QMap<QString,QString>))) > 0;
+
+    // Parse DAV response. The data may end anywhere, so the state is kept in
+    // members and no element is read ahead of the tokens that have arrived.
+    _reader.addData(xml);
+
+    while (!_reader.atEnd()) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+        if (type == QXmlStreamReader::Invalid) {
+            break; // an error, or the end of the data so far
+        }
+        QStringRef name = _reader.name();
+
+        if (type == QXmlStreamReader::StartElement) {
+            if (_propertyDepth > 0) {
+                // supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
+                _propertyDepth++;
+                _currentPropertyContent += QLatin1Char('<');
+                _currentPropertyContent += name;
+                _currentPropertyContent += QLatin1Char('>');
+                continue;
+            }
+            // Start elements with DAV:
+            if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                if (name == QLatin1String("href")) {
+                    _readingHref = true;
+                    _currentText.truncate(0);
+                    continue;
+                } else if (name == QLatin1String("response")) {
+                } else if (name == QLatin1String("propstat")) {
+                    _insidePropstat = true;
+                } else if (name == QLatin1String("status") && _insidePropstat) {
+                    _readingStatus = true;
+                    _currentText.truncate(0);
+                    continue;
+                } else if (name == QLatin1String("prop")) {
+                    _insideProp = true;
+                    continue;
+                } else if (name == QLatin1String("multistatus")) {
+                    _insideMultiStatus = true;
+                    continue;
+                }
+            }
+            if (_insidePropstat && _insideProp) {
+                // All those elements are properties
+                _propertyDepth = 1;
+                _currentProperty = davEntryProperty(name);
+                _currentPropertyContent.truncate(0);
+            }
+        } else if (type == QXmlStreamReader::Characters || type == QXmlStreamReader::EntityReference) {
+            if (_propertyDepth > 0) {
+                if (type == QXmlStreamReader::Characters) {
+                    _currentPropertyContent += _reader.text();
+                }
+            } else if (_readingHref || _readingStatus) {
+                _currentText += _reader.text();
+            }
+        } else if (type == QXmlStreamReader::EndElement) {
+            if (_propertyDepth > 0) {
+                if (--_propertyDepth > 0) {
+                    _currentPropertyContent += QLatin1String("</");
+                    _currentPropertyContent += name;
+                    _currentPropertyContent += QLatin1Char('>');
+                    continue;
+                }
+                propertyFinished(name.toString(), sizes);
+            } else if (_readingHref) {
+                _readingHref = false;
                 // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
                 // but the result will have URL encoding..
-                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(reader.readElementText().toUtf8()));
+                QString hrefString = QString::fromUtf8(QByteArray::fromPercentEncoding(_currentText.toUtf8()));
                 if (!hrefString.startsWith(expectedPath)) {
                     qDebug() << "Invalid href" << hrefString << "expected starting with" << expectedPath;
+                    _failed = true;
+                    flushEntries();
                     return false;
                 }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
-            } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
-                } else {
-                    currentPropsHaveHttp200 = false;
-                }
-            } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
-            } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
-            }
-        }
-
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
-            // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("quota-used-bytes")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && sizes) {
-                    sizes->insert(currentHref, s);
-                }
-            }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
-        }
-
-        // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
+                _currentHref = hrefString;
+            } else if (_readingStatus) {
+                _readingStatus = false;
+                _currentPropsHaveHttp200 = _currentText.startsWith("HTTP/1.1 200");
+            } else if (_reader.namespaceUri() == QLatin1String("DAV:")) {
+                // End elements with DAV:
+                if (name == QLatin1String("response")) {
+                    if (_currentHref.endsWith('/')) {
+                        _currentHref.chop(1);
+                    }
+                    if (_emitPropertyMaps) {
+                        emit directoryListingIterated(_currentHref, _currentHttp200Properties);
                     }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString,QString>(currentTmpProperties);
+                    _currentEntry.href = _currentHref;
+                    _entries.append(_currentEntry);
+                    _currentEntry = DavEntry();
+                    _currentHref.clear();
+                    _currentHttp200Properties.clear();
+                } else if (name == QLatin1String("propstat")) {
+                    _insidePropstat = false;
+                    if (_currentPropsHaveHttp200) {
+                        _currentEntry = _propstatEntry;
+                        if (_emitPropertyMaps) {
+                            _currentHttp200Properties = QMap<QString,QString>(_currentTmpProperties);
+                        }
                     }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
+                    _propstatEntry = DavEntry();
+                    _currentTmpProperties.clear();
+                    _currentPropsHaveHttp200 = false;
+                } else if (name == QLatin1String("prop")) {
+                    _insideProp = false;
                 }
             }
         }
     }
 
-    if (reader.hasError()) {
+    // The entries of this part of the response
+    flushEntries();
+
+    if (_reader.hasError() && _reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
         // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qDebug() << "ERROR" << reader.errorString() << xml;
+        qDebug() << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber();
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool LsColXMLParser::finish()
+{
+    if (_failed) {
+        return false;
+    }
+    if (_reader.hasError()) {
+        // the response ended in the middle of the document
+        qDebug() << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber();
         return false;
-    } else if (!insideMultiStatus) {
-        qDebug() << "ERROR no WebDAV response?" << xml;
+    } else if (!_insideMultiStatus) {
+        qDebug() << "ERROR no WebDAV response?";
         return false;
     } else {
-        emit directoryListingSubfolders(folders);
+        emit directoryListingSubfolders(_folders);
         emit finishedWithoutError();
     }
     return true;
-
 }
 
 /*********************************************************************************************/
 
 LsColJob::LsColJob(AccountPtr account, const QString &path, QObject *parent)
     : AbstractNetworkJob(account, path, parent)
+    , _depth("1")
 {
+    connect( &_parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+             this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
+    connect( &_parser, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+             this, SIGNAL(directoryListingEntries(QVector<DavEntry>)) );
+    connect( &_parser, SIGNAL(finishedWithError(QNetworkReply *)),
+             this, SIGNAL(finishedWithError(QNetworkReply *)) );
+    connect( &_parser, SIGNAL(finishedWithoutError()),
+             this, SIGNAL(finishedWithoutError()) );
 }
 
 void LsColJob::setProperties(QList<QByteArray> properties)
@@ -297,7 +458,7 @@ void LsColJob::start()
     }
 
     QNetworkRequest req;
-    req.setRawHeader("Depth", "1");
+    req.setRawHeader("Depth", _depth);
     QByteArray xml("<?xml version=\"1.0\" ?>\n"
                    "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
                    "  <d:prop>\n"
@@ -311,29 +472,40 @@ void LsColJob::start()
     buf->setParent(reply);
     setReply(reply);
     setupConnections(reply);
+    connect(reply, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+
+    // Building the property maps is expensive, only do it if someone wants them
+    if (receivers(SIGNAL(directoryListingIterated(QString,QMap<QString,QString>))) > 0) {
+        connect( &_parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+    }
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+bool LsColJob::isListingReply() const
 {
     QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
     int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
-                 this, SIGNAL(directoryListingSubfolders(const QStringList&)) );
-        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
-                 this, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)) );
-        connect( &parser, SIGNAL(finishedWithError(QNetworkReply *)),
-                 this, SIGNAL(finishedWithError(QNetworkReply *)) );
-        connect( &parser, SIGNAL(finishedWithoutError()),
-                 this, SIGNAL(finishedWithoutError()) );
+    return httpCode == 207 && contentType.contains("application/xml; charset=utf-8");
+}
 
-        QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if( !parser.parse( reply()->readAll(), &_sizes, expectedPath ) ) {
+// Parse the listing while it arrives, so it never has to be kept in memory as a whole
+void LsColJob::slotReadyRead()
+{
+    if (sender() != reply() || !isListingReply()) {
+        return; // e.g. the body of a redirect, or of an error
+    }
+    QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
+    _parser.addData(reply()->readAll(), &_sizes, expectedPath);
+}
+
+bool LsColJob::finished()
+{
+    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (isListingReply()) {
+        // Most of the response went through slotReadyRead() already
+        QString expectedPath = reply()->request().url().path();
+        if( !_parser.addData( reply()->readAll(), &_sizes, expectedPath ) || !_parser.finish() ) {
             // XML parse error
             emit finishedWithError(reply());
         }
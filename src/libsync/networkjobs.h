@@ -18,6 +18,11 @@
 
 #include "abstractnetworkjob.h"
 
+#include <csync.h>
+
+#include <QVector>
+#include <QXmlStreamReader>
+
 class QUrl;
 
 namespace OCC {
@@ -39,6 +44,48 @@ private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
 };
 
+/**
+ * @brief One entry of a PROPFIND response, with the properties used for syncing
+ *
+ * The values are the ones the server sent with status 200, unconverted. The
+ * short ones are kept in place, so an entry only allocates for its href and etag.
+ *
+ * @ingroup libsync
+ */
+struct OWNCLOUDSYNC_EXPORT DavEntry {
+    enum Property {
+        NoProperty = 0,
+        ResourceType = 0x1,
+        LastModified = 0x2,
+        ContentLength = 0x4,
+        ETag = 0x8,
+        FileId = 0x10,
+        DownloadUrl = 0x20,
+        DownloadCookies = 0x40,
+        Permissions = 0x80,
+        QuotaUsedBytes = 0x100
+    };
+
+    DavEntry() : properties(0), isCollection(false), contentLength(0), quotaUsedBytes(0)
+    {
+        fileId[0] = '\0';
+        permissions[0] = '\0';
+        lastModified[0] = '\0';
+    }
+
+    QString href; // without trailing slash
+    int properties; // the Property values that were sent
+    bool isCollection;
+    qint64 contentLength;
+    qint64 quotaUsedBytes; // the size of a collection
+    QByteArray etag;
+    QByteArray downloadUrl;
+    QByteArray downloadCookies;
+    char fileId[FILE_ID_BUF_SIZE + 1]; // truncated like csync_vio_file_stat_set_file_id() does
+    char permissions[REMOTE_PERM_BUF_SIZE + 1]; // permissions that do not fit are left out
+    char lastModified[64]; // the http date, truncated
+};
+
 /**
  * @brief The LsColJob class
  * @ingroup libsync
@@ -48,14 +95,58 @@ class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject {
 public:
     explicit LsColXMLParser();
 
+    /**
+     * Parses a complete PROPFIND response, same as addData() followed by finish().
+     */
     bool parse(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString& expectedPath);
 
+    /**
+     * Parses the next part of a PROPFIND response. It can be called with any piece
+     * of the response as it arrives. The entries that are complete are emitted with
+     * directoryListingEntries(), and each with directoryListingIterated() if that is
+     * connected.
+     *
+     * Returns false if the response is invalid, the rest of it is ignored then.
+     */
+    bool addData(const QByteArray &xml, QHash<QString, qint64> *sizes, const QString& expectedPath);
+
+    /**
+     * To be called after the whole response was passed to addData(). Emits
+     * directoryListingSubfolders() and finishedWithoutError() if it was valid.
+     */
+    bool finish();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
+    void directoryListingEntries(const QVector<DavEntry> &entries);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
+private:
+    void propertyFinished(const QString &name, QHash<QString, qint64> *sizes);
+    void flushEntries();
+
+    QXmlStreamReader _reader;
+    QStringList _folders;
+    QString _currentHref;
+    bool _emitPropertyMaps; // directoryListingIterated() is connected
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    DavEntry _propstatEntry; // the properties of the current propstat
+    DavEntry _currentEntry;
+    QVector<DavEntry> _entries; // not emitted yet
+    QString _currentText; // of the href or status being read
+    QString _currentPropertyContent;
+    DavEntry::Property _currentProperty;
+    int _propertyDepth; // > 0 while reading the value of a property
+    bool _currentPropsHaveHttp200;
+    bool _insidePropstat;
+    bool _insideProp;
+    bool _insideMultiStatus;
+    bool _readingHref;
+    bool _readingStatus;
+    bool _failed;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob {
@@ -76,17 +167,29 @@ public:
     void setProperties(QList<QByteArray> properties);
     QList<QByteArray> properties() const;
 
+    /**
+     * The Depth header of the request, "1" (the default) lists the direct children
+     * only, "infinity" the whole tree. Servers may refuse or ignore "infinity".
+     */
+    void setDepth(const QByteArray &depth) { _depth = depth; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString,QString> &properties);
+    void directoryListingEntries(const QVector<DavEntry> &entries);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
 private slots:
     virtual bool finished() Q_DECL_OVERRIDE;
+    void slotReadyRead();
 
 private:
+    bool isListingReply() const;
+
     QList<QByteArray> _properties;
+    QByteArray _depth;
+    LsColXMLParser _parser; // fed while the response arrives
 };
 
 /**
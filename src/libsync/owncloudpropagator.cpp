@@ -71,20 +71,32 @@ qint64 freeSpaceLimit()
 OwncloudPropagator::~OwncloudPropagator()
 {}
 
-/* The maximum number of active jobs in parallel  */
-int OwncloudPropagator::maximumActiveJob()
+int OwncloudPropagator::maximumParallelJobs()
 {
     static int max = qgetenv("OWNCLOUD_MAX_PARALLEL").toUInt();
     if (!max) {
-        max = 3; //default
+        // QNetworkAccessManager does not open more than 6 connections per host,
+        // further requests would only wait in its queue.
+        max = 6;
     }
+    return max;
+}
 
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0 || _uploadLimit.fetchAndAddAcquire(0) != 0) {
-        // disable parallelism when there is a network limit.
-        return 1;
-    }
+/* The maximum number of active jobs in parallel  */
+int OwncloudPropagator::maximumActiveJob()
+{
+    // Bandwidth limits don't disable the parallelism: the BandwidthManager shares the
+    // budget between the running transfers, and as they get slower without the
+    // throughput going up, the controller reduces the number of jobs by itself.
+    return _concurrency.limit();
+}
 
-    return max;
+void OwncloudPropagator::requestFinished(quint64 durationMsec, qint64 bytes)
+{
+    if (_abortRequested.fetchAndAddRelaxed(0)) {
+        return;
+    }
+    _concurrency.requestFinished(durationMsec, bytes, _activeJobs + 1);
 }
 
 /** Updates, creates or removes a blacklist entry for the given item.
@@ -521,20 +533,28 @@ PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 {
     // If any of the non-finished sub jobs is not parallel, we have to wait
 
-    // FIXME!  we should probably cache this result
-
     if (_firstJob && _firstJob->_state != Finished) {
         if (_firstJob->parallelism() != FullParallelism)
             return WaitForFinished;
     }
 
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
-        if (_subJobs.at(i)->_state != Finished && _subJobs.at(i)->parallelism() != FullParallelism) {
+    foreach (PropagatorJob *job, _runningJobs) {
+        if (job->_state != Finished && job->parallelism() != FullParallelism) {
             return WaitForFinished;
         }
     }
-    return FullParallelism;
+
+    if (_blockingJobs < 0) {
+        // The parallelism of a job does not change before it is started, so
+        // count them once and then only when they are started.
+        _blockingJobs = 0;
+        for (int i = _nextJob; i < _subJobs.count(); ++i) {
+            if (_subJobs.at(i)->parallelism() != FullParallelism) {
+                _blockingJobs++;
+            }
+        }
+    }
+    return _blockingJobs > 0 ? WaitForFinished : FullParallelism;
 }
 
 
@@ -562,23 +582,40 @@ bool PropagateDirectory::scheduleNextJob()
     }
 
     bool stopAtDirectory = false;
-    // FIXME: use the cached value of finished job
-    for (int i = 0; i < _subJobs.count(); ++i) {
-        if (_subJobs.at(i)->_state == Finished) {
+    for (int i = 0; ; ++i) {
+        if (i == _runningJobs.count()) {
+            // All the running jobs were visited, the next one may start
+            if (_nextJob >= _subJobs.count()) {
+                return false;
+            }
+            PropagatorJob *next = _subJobs.at(_nextJob);
+            if (stopAtDirectory && qobject_cast<PropagateDirectory*>(next)) {
+                return false;
+            }
+            if (_blockingJobs > 0 && next->parallelism() != FullParallelism) {
+                _blockingJobs--;
+            }
+            _nextJob++;
+            _runningJobs.append(next);
+        }
+        PropagatorJob *job = _runningJobs.at(i);
+
+        if (job->_state == Finished) {
+            // slotSubJobFinished was not called yet
             continue;
         }
 
-        if (stopAtDirectory && qobject_cast<PropagateDirectory*>(_subJobs.at(i))) {
+        if (stopAtDirectory && qobject_cast<PropagateDirectory*>(job)) {
             return false;
         }
 
-        if (possiblyRunNextJob(_subJobs.at(i))) {
+        if (possiblyRunNextJob(job)) {
             return true;
         }
 
-        Q_ASSERT(_subJobs.at(i)->_state == Running);
+        Q_ASSERT(job->_state == Running);
 
-        auto paral = _subJobs.at(i)->parallelism();
+        auto paral = job->parallelism();
         if (paral == WaitForFinished) {
             return false;
         }
@@ -586,7 +623,6 @@ bool PropagateDirectory::scheduleNextJob()
             stopAtDirectory = true;
         }
     }
-    return false;
 }
 
 void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
@@ -601,6 +637,11 @@ void PropagateDirectory::slotSubJobFinished(SyncFileItem::Status status)
     } else if (status == SyncFileItem::NormalError || status == SyncFileItem::SoftError) {
         _hasError = status;
     }
+    // not removeOne(): QVector has it only since Qt 5.4
+    int idx = _runningJobs.indexOf(qobject_cast<PropagatorJob *>(sender()));
+    if (idx >= 0) {
+        _runningJobs.remove(idx);
+    }
     _runningNow--;
     _jobsFinished++;
 
@@ -644,8 +685,9 @@ void PropagateDirectory::finalize()
 
 qint64 PropagateDirectory::committedDiskSpace() const
 {
+    // Jobs that are not running don't commit any disk space
     qint64 needed = 0;
-    foreach (PropagatorJob* job, _subJobs) {
+    foreach (PropagatorJob* job, _runningJobs) {
         needed += job->committedDiskSpace();
     }
     return needed;
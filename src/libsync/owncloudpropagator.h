@@ -28,6 +28,7 @@
 #include "syncfileitem.h"
 #include "syncjournaldb.h"
 #include "bandwidthmanager.h"
+#include "concurrencycontroller.h"
 #include "accountfwd.h"
 
 namespace OCC {
@@ -190,6 +191,7 @@ public:
     explicit PropagateDirectory(OwncloudPropagator *propagator, const SyncFileItemPtr &item = SyncFileItemPtr(new SyncFileItem))
         : PropagatorJob(propagator)
         , _firstJob(0), _item(item),  _jobsFinished(0), _runningNow(0), _hasError(SyncFileItem::NoStatus)
+        , _nextJob(0), _blockingJobs(-1)
     { }
 
     virtual ~PropagateDirectory() {
@@ -198,6 +200,7 @@ public:
 
     void append(PropagatorJob *subJob) {
         _subJobs.append(subJob);
+        _blockingJobs = -1;
     }
 
     virtual bool scheduleNextJob() Q_DECL_OVERRIDE;
@@ -231,6 +234,14 @@ private slots:
     }
 
     void slotSubJobFinished(SyncFileItem::Status status);
+
+private:
+    /* The sub jobs are started in order. scheduleNextJob() and parallelism() only look
+     * at the started ones that did not finish yet, so that they don't get slower with
+     * every job that finished in a big directory. */
+    int _nextJob; // index in _subJobs of the first job that was not started yet
+    QVector<PropagatorJob *> _runningJobs; // started and not finished, in the order of _subJobs
+    int _blockingJobs; // jobs from _nextJob on without FullParallelism, -1 if not counted yet
 };
 
 
@@ -277,6 +288,7 @@ public:
             , _activeJobs(0)
             , _anotherSyncNeeded(false)
             , _account(account)
+            , _concurrency(1, maximumParallelJobs(), 3)
     { }
 
     ~OwncloudPropagator();
@@ -295,9 +307,15 @@ public:
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
-    /* The maximum number of active jobs in parallel  */
+    /* The maximum number of active jobs in parallel, adapted by _concurrency */
     int maximumActiveJob();
 
+    /** Reports a network request of a job to the concurrency controller.
+     *
+     * Called when the request finished, after the job left _activeJobs.
+     */
+    void requestFinished(quint64 durationMsec, qint64 bytes);
+
     bool isInSharedDirectory(const QString& file);
     bool localFileNameClash(const QString& relfile);
     QString getFilePath(const QString& tmp_file_name) const;
@@ -359,6 +377,10 @@ private:
 
     AccountPtr _account;
 
+    /** The upper bound of maximumActiveJob() */
+    static int maximumParallelJobs();
+    ConcurrencyController _concurrency;
+
     /** Stores the time since a job touched a file. */
     QHash<QString, QElapsedTimer> _touchedFiles;
     mutable QMutex _touchedFilesMutex;
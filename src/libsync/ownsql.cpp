@@ -167,10 +167,16 @@ sqlite3* SqlDatabase::sqliteDb()
     return _db;
 }
 
+int SqlDatabase::queryCount() const
+{
+    return _queryCount.fetchAndAddRelaxed(0); // load() is Qt 5 only
+}
+
 /* =========================================================================================== */
 
 SqlQuery::SqlQuery( SqlDatabase& db )
-    :_db(db.sqliteDb()),
+    :_database(&db),
+      _db(db.sqliteDb()),
       _stmt(0), _errId(0)
 {
 
@@ -184,7 +190,8 @@ SqlQuery::~SqlQuery()
 }
 
 SqlQuery::SqlQuery(const QString& sql, SqlDatabase& db)
-    :_db(db.sqliteDb()),
+    :_database(&db),
+      _db(db.sqliteDb()),
       _stmt(0), _errId(0)
 {
     prepare(sql);
@@ -230,6 +237,8 @@ bool SqlQuery::isPragma()
 
 bool SqlQuery::exec()
 {
+    _database->_queryCount.fetchAndAddRelaxed(1);
+
     // Don't do anything for selects, that is how we use the lib :-|
     if(_stmt && !isSelect() && !isPragma() ) {
         int rc, n = 0;
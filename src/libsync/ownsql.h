@@ -18,6 +18,7 @@
 
 #include <QObject>
 #include <QVariant>
+#include <QAtomicInt>
 
 #include "owncloudlib.h"
 
@@ -42,13 +43,18 @@ public:
     QString error() const;
     sqlite3* sqliteDb();
 
+    /// Number of statements run with SqlQuery::exec() on this database
+    int queryCount() const;
+
 private:
+    friend class SqlQuery;
     bool openHelper( const QString& filename, int sqliteFlags );
     bool checkDb();
 
     sqlite3 *_db;
     QString _error; // last error string
     int _errId;
+    mutable QAtomicInt _queryCount;
 
 };
 
@@ -86,6 +92,7 @@ public:
     void finish();
 
 private:
+    SqlDatabase *_database;
     sqlite3 *_db;
     sqlite3_stmt *_stmt;
     QString _error;
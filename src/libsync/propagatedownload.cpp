@@ -422,6 +422,7 @@ void PropagateDownloadFileQNAM::slotGetFinished()
 
     GETFileJob *job = qobject_cast<GETFileJob *>(sender());
     Q_ASSERT(job);
+    _propagator->requestFinished(job->duration(), job->currentDownloadPosition() - job->resumeStart());
 
     qDebug() << Q_FUNC_INFO << job->reply()->request().url() << "FINISHED WITH STATUS"
              << job->reply()->error()
@@ -79,6 +79,7 @@ void PropagateRemoteDelete::slotDeleteJobFinished()
     _propagator->_activeJobs--;
 
     Q_ASSERT(_job);
+    _propagator->requestFinished(_job->duration(), 0);
 
     qDebug() << Q_FUNC_INFO << _job->reply()->request().url() << "FINISHED WITH STATUS"
         << _job->reply()->error()
@@ -46,6 +46,7 @@ void PropagateRemoteMkdir::slotMkcolJobFinished()
     _propagator->_activeJobs--;
 
     Q_ASSERT(_job);
+    _propagator->requestFinished(_job->duration(), 0);
 
     qDebug() << Q_FUNC_INFO << _job->reply()->request().url() << "FINISHED WITH STATUS"
         << _job->reply()->error()
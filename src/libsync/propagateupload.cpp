@@ -593,6 +593,7 @@ void PropagateUploadFileQNAM::slotPutFinished()
              << job->reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
 
     _propagator->_activeJobs--;
+    _propagator->requestFinished(job->duration(), job->size());
 
     if (_finished) {
         // We have sent the finished signal already. We don't need to handle any remaining jobs
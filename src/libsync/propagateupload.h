@@ -99,6 +99,9 @@ public:
 
     int _chunk;
 
+    /** The number of bytes that are sent */
+    qint64 size() const { return _device->size(); }
+
     virtual void start() Q_DECL_OVERRIDE;
 
     virtual bool finished() Q_DECL_OVERRIDE {
@@ -22,6 +22,7 @@
 #include "creds/abstractcredentials.h"
 #include "syncfilestatus.h"
 #include "csync_private.h"
+#include "csync_statedb.h"
 #include "filesystem.h"
 
 #ifdef Q_OS_WIN
@@ -31,6 +32,7 @@
 #endif
 
 #include <climits>
+#include <algorithm>
 #include <assert.h>
 
 #include <QCoreApplication>
@@ -66,11 +68,17 @@ SyncEngine::SyncEngine(AccountPtr account, CSYNC *ctx, const QString& localPath,
   , _remotePath(remotePath)
   , _journal(journal)
   , _progressInfo(new ProgressInfo)
+  , _journalQueryCountAtStart(0)
+  , _renamedFolders(csync_rename_trie_new())
   , _hasNoneFiles(false)
   , _hasRemoveFile(false)
   , _uploadLimit(0)
   , _downloadLimit(0)
   , _newBigFolderSizeLimit(-1)
+  , _localDiscoveryThreads(1)
+  , _remoteDiscoveryPrefetch(6)
+  , _checksumMoveDetection(true)
+  , _localDiscoveryStyle(FullLocalDiscovery)
   , _checksum_hook(journal)
   , _anotherSyncNeeded(false)
 {
@@ -85,6 +93,7 @@ SyncEngine::~SyncEngine()
 {
     _thread.quit();
     _thread.wait();
+    csync_rename_trie_free(_renamedFolders);
 }
 
 //Convert an error code from csync to a user readable string.
@@ -297,6 +306,22 @@ int SyncEngine::treewalkRemote( TREE_WALK_FILE* file, void *data )
     return static_cast<SyncEngine*>(data)->treewalkFile( file, true );
 }
 
+int SyncEngine::superfluousRecordVisitor( uint64_t phash, const char *path, void *data )
+{
+    SyncEngine *engine = static_cast<SyncEngine*>(data);
+
+    if( !engine->_temporarilyUnavailablePaths.isEmpty() ) {
+        const QString file = QString::fromUtf8(path);
+        foreach( const QString &prefix, engine->_temporarilyUnavailablePaths ) {
+            if( file.startsWith(prefix) ) {
+                return 0;
+            }
+        }
+    }
+    engine->_superfluousPhashes.append(phash);
+    return 0;
+}
+
 int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 {
     if( ! file ) return -1;
@@ -323,10 +348,23 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         }
     }
 
-    // Gets a default-constructed SyncFileItemPtr or the one from the first walk (=local walk)
-    SyncFileItemPtr item = _syncItemMap.value(key);
-    if (!item)
-        item = SyncFileItemPtr(new SyncFileItem);
+    // Unchanged files do not get an item, only record what the permission checks
+    // need to know about them. (See the NONE case below.)
+    if (instruction == CSYNC_INSTRUCTION_NONE && !file->should_update_metadata
+            && file->error_status == CSYNC_STATUS_OK && renameTarget.isEmpty()
+            && !_syncItemIndex.contains(key)) {
+        if (remote && file->remotePerm && file->remotePerm[0]) {
+            _remotePerms[fileUtf8] = file->remotePerm;
+        }
+        if (file->type != CSYNC_FTW_TYPE_DIR && file->other.instruction == CSYNC_INSTRUCTION_NONE) {
+            _hasNoneFiles = true;
+        }
+        return 0;
+    }
+
+    // Gets a new SyncFileItemPtr or the one from the first walk (=local walk)
+    int itemIndex = _syncItemIndex.value(key, -1);
+    SyncFileItemPtr item = itemIndex >= 0 ? _syncedItems.at(itemIndex) : SyncFileItemPtr(new SyncFileItem);
 
     if (item->_file.isEmpty() || instruction == CSYNC_INSTRUCTION_RENAME) {
         item->_file = fileUtf8;
@@ -381,13 +419,6 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         item->_contentChecksumType = _journal->getChecksumType(file->checksumTypeId);
     }
 
-    // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item->_file);
-    if (!renameTarget.isEmpty()) {
-        // Yes, this records both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
-    }
-
     if (remote && file->remotePerm && file->remotePerm[0]) {
         _remotePerms[item->_file] = file->remotePerm;
     }
@@ -506,7 +537,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
             item->_should_update_metadata = false;
 
             // Technically we're done with this item. See localMetadataUpdate hack below.
-            _syncItemMap.remove(key);
+            removeSyncItem(key);
         }
         // Any files that are instruction NONE?
         if (!item->_isDirectory && file->other.instruction == CSYNC_INSTRUCTION_NONE) {
@@ -520,7 +551,7 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
             if (localMetadataUpdate) {
                 // Hack, we want a local metadata update to happen, but only if the
                 // remote tree doesn't ask us to do some kind of propagation.
-                _syncItemMap.insert(key, item);
+                addSyncItem(key, item);
             }
             return re;
         }
@@ -530,7 +561,8 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
         dir = !remote ? SyncFileItem::Down : SyncFileItem::Up;
         item->_renameTarget = renameTarget;
         if (item->_isDirectory)
-            _renamedFolders.insert(item->_file, item->_renameTarget);
+            csync_rename_trie_insert(_renamedFolders, item->_file.toUtf8().constData(),
+                                     item->_renameTarget.toUtf8().constData());
         break;
     case CSYNC_INSTRUCTION_REMOVE:
         _hasRemoveFile = true;
@@ -566,8 +598,9 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
 
     _needsUpdate = true;
 
-    item->log._etag          = file->etag;
-    item->log._fileId        = file->file_id;
+    // share the data with the copies in the item when they are equal
+    item->log._etag          = item->_etag == file->etag ? item->_etag : QByteArray(file->etag);
+    item->log._fileId        = item->_fileId == file->file_id ? item->_fileId : QByteArray(file->file_id);
     item->log._instruction   = file->instruction;
     item->log._modtime       = file->modtime;
     item->log._size          = file->size;
@@ -578,12 +611,41 @@ int SyncEngine::treewalkFile( TREE_WALK_FILE *file, bool remote )
     item->log._other_modtime     = file->other.modtime;
     item->log._other_size        = file->other.size;
 
-    _syncItemMap.insert(key, item);
+    addSyncItem(key, item);
 
     emit syncItemDiscovered(*item);
     return re;
 }
 
+void SyncEngine::addSyncItem(const QString &key, const SyncFileItemPtr &item)
+{
+    if (!_syncItemIndex.contains(key)) {
+        _syncItemIndex.insert(key, _syncedItems.size());
+        _syncedItems.append(item);
+    }
+}
+
+void SyncEngine::removeSyncItem(const QString &key)
+{
+    // Leaves a null entry, they are dropped once the walk is done
+    auto it = _syncItemIndex.find(key);
+    if (it != _syncItemIndex.end()) {
+        _syncedItems[*it].clear();
+        _syncItemIndex.erase(it);
+    }
+}
+
+// Counts the files of a csync tree that get an item in the tree walk
+static int countSyncItemsVisitor(void *obj, void *data)
+{
+    const csync_file_stat_t *st = static_cast<const csync_file_stat_t *>(obj);
+    if (st->instruction != CSYNC_INSTRUCTION_NONE || st->should_update_metadata
+            || st->error_status != CSYNC_STATUS_OK) {
+        ++*static_cast<int *>(data);
+    }
+    return 0;
+}
+
 void SyncEngine::handleSyncError(CSYNC *ctx, const char *state) {
     CSYNC_STATUS err = csync_get_status( ctx );
     const char *errMsg = csync_get_status_string( ctx );
@@ -661,7 +723,8 @@ void SyncEngine::startSync()
     }
 
     _syncedItems.clear();
-    _syncItemMap.clear();
+    _syncItemIndex.clear();
+    _pendingPaths.clear();
     _needsUpdate = false;
 
     csync_resume(_csync_ctx);
@@ -695,6 +758,14 @@ void SyncEngine::startSync()
     // thereby speeding up the initial discovery significantly.
     _csync_ctx->db_is_empty = (fileRecordCount == 0);
 
+    int envLocalDiscoveryThreads = qgetenv("OWNCLOUD_LOCAL_DISCOVERY_THREADS").toInt();
+    _csync_ctx->local_discovery_threads = envLocalDiscoveryThreads > 0 ? envLocalDiscoveryThreads : _localDiscoveryThreads;
+    _csync_ctx->checksum_move_detection = _checksumMoveDetection;
+
+    // csync only uses the threads for trees that are big enough
+    static int envReconcileThreads = qgetenv("OWNCLOUD_RECONCILE_THREADS").toInt();
+    _csync_ctx->reconcile_threads = envReconcileThreads > 0 ? envReconcileThreads : QThread::idealThreadCount();
+
     auto selectiveSyncBlackList = _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncBlackList);
     bool usingSelectiveSync = (!selectiveSyncBlackList.isEmpty());
     qDebug() << (usingSelectiveSync ? "====Using Selective Sync" : "====NOT Using Selective Sync");
@@ -706,10 +777,29 @@ void SyncEngine::startSync()
     _csync_ctx->callbacks.checksum_userdata = &_checksum_hook;
 
     _stopWatch.start();
+    _performanceReport.start();
+    _journalQueryCountAtStart = _journal->queryCount();
+    _csync_ctx->statedb.query_count = 0;
 
     qDebug() << "#### Discovery start #################################################### >>";
 
-    _discoveryMainThread = new DiscoveryMainThread(account());
+    static QByteArray envRemoteDiscoveryPrefetch = qgetenv("OWNCLOUD_REMOTE_DISCOVERY_PREFETCH");
+    int remoteDiscoveryPrefetch = envRemoteDiscoveryPrefetch.isEmpty() ? _remoteDiscoveryPrefetch
+                                                                      : envRemoteDiscoveryPrefetch.toInt();
+    _discoveryMainThread = new DiscoveryMainThread(account(), remoteDiscoveryPrefetch);
+    if (remoteDiscoveryPrefetch > 0) {
+        // One query now rather than one per directory in this thread while the listings arrive
+        _discoveryMainThread->setJournalDirectories(_journal->getDirectoryInfos());
+    }
+
+    // Without a journal every directory has to be listed: get the whole tree at once.
+    // OWNCLOUD_DISCOVERY_DEPTH_INFINITY=1 does it for every sync, 0 never.
+    static QByteArray envDepthInfinity = qgetenv("OWNCLOUD_DISCOVERY_DEPTH_INFINITY");
+    bool depthInfinity = envDepthInfinity.isEmpty() ? _csync_ctx->db_is_empty : envDepthInfinity.toInt() > 0;
+    qDebug() << (depthInfinity ? "====Listing the remote tree with Depth: infinity" : "====Listing remote directories one by one");
+    _discoveryMainThread->setDepthInfinity(depthInfinity);
+    // The sizes are only needed to check new folders against the limit
+    _discoveryMainThread->setFetchFolderSizes(_newBigFolderSizeLimit >= 0);
     _discoveryMainThread->setParent(this);
     connect(this, SIGNAL(finished(bool)), _discoveryMainThread, SLOT(deleteLater()));
     qDebug() << "=====Server" << account()->serverVersion()
@@ -721,10 +811,18 @@ void SyncEngine::startSync()
     }
 
     DiscoveryJob *discoveryJob = new DiscoveryJob(_csync_ctx);
+    // Sorted here, the remote listing reads it from this thread before the job starts
+    selectiveSyncBlackList.sort();
     discoveryJob->_selectiveSyncBlackList = selectiveSyncBlackList;
     discoveryJob->_selectiveSyncWhiteList =
         _journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncWhiteList);
     discoveryJob->_newBigFolderSizeLimit = _newBigFolderSizeLimit;
+    discoveryJob->_performanceReport = &_performanceReport;
+    if (_localDiscoveryStyle == IncrementalLocalDiscovery) {
+        qDebug() << "====Incremental local discovery," << _localDiscoveryPaths.size() << "changed paths";
+        discoveryJob->_incrementalLocalDiscovery = true;
+        discoveryJob->_localDiscoveryPaths = _localDiscoveryPaths.toList();
+    }
     discoveryJob->moveToThread(&_thread);
     connect(discoveryJob, SIGNAL(finished(int)), this, SLOT(slotDiscoveryJobFinished(int)));
     connect(discoveryJob, SIGNAL(folderDiscovered(bool,QString)),
@@ -739,6 +837,9 @@ void SyncEngine::startSync()
     qDebug() << Q_FUNC_INFO << _remotePath << _remoteUrl;
     _discoveryMainThread->setupHooks( discoveryJob, _remotePath);
 
+    // The remote listings are requested while the sync thread reads the local tree
+    _discoveryMainThread->startRemoteListing();
+
     // Starts the update in a seperate thread
     QMetaObject::invokeMethod(discoveryJob, "start", Qt::QueuedConnection);
 }
@@ -779,13 +880,22 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     }
 
     qDebug() << "<<#### Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Reconcile Finished"));
+    _performanceReport._localTreeSize = c_htable_size(_csync_ctx->local.tree);
+    _performanceReport._remoteTreeSize = c_htable_size(_csync_ctx->remote.tree);
+    _performanceReport.endPhase(SyncPerformanceReport::Reconcile);
 
     _hasNoneFiles = false;
     _hasRemoveFile = false;
     bool walkOk = true;
-    _seenFiles.clear();
     _temporarilyUnavailablePaths.clear();
 
+    // Both walks append to _syncedItems, a file changed on both sides is counted twice
+    int syncItemCount = 0;
+    c_htable_walk(_csync_ctx->local.tree, &syncItemCount, countSyncItemsVisitor);
+    c_htable_walk(_csync_ctx->remote.tree, &syncItemCount, countSyncItemsVisitor);
+    _syncedItems.clear();
+    _syncedItems.reserve(syncItemCount);
+
     if( csync_walk_local_tree(_csync_ctx, &treewalkLocal, 0) < 0 ) {
         qDebug() << "Error in local treewalk.";
         walkOk = false;
@@ -799,12 +909,19 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
         qDebug() << "Permissions of the root folder: " << _remotePerms[QLatin1String("")];
     }
 
+    // The journal entries of the files that are in neither tree are removed after the sync
+    _superfluousPhashes.clear();
+    if( csync_statedb_walk_superfluous(_csync_ctx, &superfluousRecordVisitor, this) < 0 ) {
+        qDebug() << "Error while looking for superfluous journal entries.";
+    }
+
     // Re-init the csync context to free memory
     csync_commit(_csync_ctx);
 
-    // The map was used for merging trees, convert it to a list:
-    _syncedItems = _syncItemMap.values().toVector();
-    _syncItemMap.clear(); // free memory
+    // The index was used for merging trees, drop it and the items that were removed from it
+    _syncItemIndex.clear();
+    _syncedItems.erase(std::remove(_syncedItems.begin(), _syncedItems.end(), SyncFileItemPtr()),
+                       _syncedItems.end());
 
     // Adjust the paths for the renames.
     for (SyncFileItemVector::iterator it = _syncedItems.begin();
@@ -818,6 +935,12 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     // make sure everything is allowed
     checkForPermission();
 
+    _pendingPaths.clear();
+    foreach (const SyncFileItemPtr &item, _syncedItems) {
+        ++_pendingPaths[item->_file];
+        ++_performanceReport._itemsPerInstruction[QLatin1String(csync_instruction_str(item->_instruction))];
+    }
+
     // To announce the beginning of the sync
     emit aboutToPropagate(_syncedItems);
     // it's important to do this before ProgressInfo::start(), to announce start of new sync
@@ -870,6 +993,7 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     if (_needsUpdate)
         emit(started());
 
+    _performanceReport.endPhase(SyncPerformanceReport::Treewalk);
     _propagator->start(_syncedItems);
 
     qDebug() << "<<#### Post-Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Post-Reconcile Finished"));
@@ -914,6 +1038,19 @@ void SyncEngine::slotItemCompleted(const SyncFileItem &item, const PropagatorJob
 
     _progressInfo->setProgressComplete(item);
 
+    if (item._status == SyncFileItem::Success && ProgressInfo::isSizeDependent(item)) {
+        if (item._direction == SyncFileItem::Up) {
+            _performanceReport._bytesUploaded += item._size;
+        } else if (item._direction == SyncFileItem::Down) {
+            _performanceReport._bytesDownloaded += item._size;
+        }
+    }
+
+    auto pending = _pendingPaths.find(item._file);
+    if (pending != _pendingPaths.end() && --*pending <= 0) {
+        _pendingPaths.erase(pending);
+    }
+
     if (item._status == SyncFileItem::FatalError) {
         emit csyncError(item._errorString);
     }
@@ -925,13 +1062,23 @@ void SyncEngine::slotItemCompleted(const SyncFileItem &item, const PropagatorJob
 void SyncEngine::slotFinished()
 {
     _anotherSyncNeeded = _anotherSyncNeeded || _propagator->_anotherSyncNeeded;
+    _performanceReport.endPhase(SyncPerformanceReport::Propagation);
 
     // emit the treewalk results.
-    if( ! _journal->postSyncCleanup( _seenFiles, _temporarilyUnavailablePaths ) ) {
+    if( ! _journal->postSyncCleanup( _superfluousPhashes ) ) {
         qDebug() << "Cleaning of synced ";
     }
 
     _journal->commit("All Finished.", false);
+
+    _performanceReport.endPhase(SyncPerformanceReport::JournalCleanup);
+    if (_discoveryMainThread) {
+        _performanceReport._propfinds = _discoveryMainThread->propfindCount();
+    }
+    _performanceReport._journalQueries = _journal->queryCount() - _journalQueryCountAtStart
+            + _csync_ctx->statedb.query_count;
+    _performanceReport.write(_journal->databaseFilePath());
+
     emit treeWalkResult(_syncedItems);
     finalize(true); // FIXME: should it be true if there was errors?
 }
@@ -942,6 +1089,8 @@ void SyncEngine::finalize(bool success)
     _thread.wait();
 
     csync_commit(_csync_ctx);
+    _pendingPaths.clear();
+    _superfluousPhashes.clear();
 
     qDebug() << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished"));
     _stopWatch.stop();
@@ -963,14 +1112,16 @@ void SyncEngine::slotProgress(const SyncFileItem& item, quint64 current)
 /* Given a path on the remote, give the path as it is when the rename is done */
 QString SyncEngine::adjustRenamedPath(const QString& original)
 {
-    int slashPos = original.size();
-    while ((slashPos = original.lastIndexOf('/' , slashPos - 1)) > 0) {
-        QHash< QString, QString >::const_iterator it = _renamedFolders.constFind(original.left(slashPos));
-        if (it != _renamedFolders.constEnd()) {
-            return *it + original.mid(slashPos);
-        }
+    if (csync_rename_trie_is_empty(_renamedFolders)) {
+        return original;
     }
-    return original;
+    QByteArray path = original.toUtf8();
+    size_t prefixLen = 0;
+    const char *target = csync_rename_trie_find(_renamedFolders, path.constData(), &prefixLen);
+    if (!target) {
+        return original;
+    }
+    return QString::fromUtf8(target) + QString::fromUtf8(path.constData() + prefixLen, path.size() - prefixLen);
 }
 
 /**
@@ -1220,15 +1371,13 @@ bool SyncEngine::estimateState(QString fn, csync_ftw_type_e t, SyncFileStatus* s
         pat.append(QLatin1Char('/'));
     }
 
-    Q_FOREACH(const SyncFileItemPtr &item, _syncedItems) {
-        //qDebug() << Q_FUNC_INFO << fn << item._file << fn.startsWith(item._file) << item._file.startsWith(fn);
-
-        if (item->_file.startsWith(pat) ||
-                item->_file == fn /* the same directory or file */) {
-            qDebug() << Q_FUNC_INFO << "Setting" << fn << " to STATUS_EVAL";
-            s->set(SyncFileStatus::STATUS_EVAL);
-            return true;
-        }
+    // The paths starting with pat follow the first one that is not less than pat
+    QMap<QString, int>::const_iterator it = _pendingPaths.lowerBound(pat);
+    if ((it != _pendingPaths.constEnd() && it.key().startsWith(pat))
+            || _pendingPaths.contains(fn) /* the same directory or file */) {
+        qDebug() << Q_FUNC_INFO << "Setting" << fn << " to STATUS_EVAL";
+        s->set(SyncFileStatus::STATUS_EVAL);
+        return true;
     }
     return false;
 }
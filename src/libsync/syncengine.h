@@ -30,6 +30,7 @@
 
 // when do we go away with this private/public separation?
 #include <csync_private.h>
+#include <csync_rename.h>
 
 #include "syncfileitem.h"
 #include "progressdispatcher.h"
@@ -38,6 +39,7 @@
 #include "accountfwd.h"
 #include "discoveryphase.h"
 #include "checksums.h"
+#include "syncperformancereport.h"
 
 class QProcess;
 
@@ -73,8 +75,34 @@ public:
      */
     void setNewBigFolderSizeLimit(qint64 limit) { _newBigFolderSizeLimit = limit; }
 
+    /* Set how many threads csync uses to read the local tree. 1 means no read-ahead threads. */
+    void setLocalDiscoveryThreads(int threads) { _localDiscoveryThreads = threads; }
+
+    /* Set how many remote directory listings may be requested before csync needs them. 0 disables it. */
+    void setRemoteDiscoveryPrefetch(int jobs) { _remoteDiscoveryPrefetch = jobs; }
+
+    /* Set whether new local files are matched by size and checksum with the files that
+     * disappeared locally, to move them on the server instead of uploading them again. */
+    void setChecksumMoveDetection(bool enabled) { _checksumMoveDetection = enabled; }
+
+    enum LocalDiscoveryStyle {
+        FullLocalDiscovery, ///< read the whole local tree (the default)
+        IncrementalLocalDiscovery ///< only read the given paths, see setLocalDiscoveryOptions()
+    };
+
+    /* Control which local directories are read from the file system during the next syncs.
+     * With IncrementalLocalDiscovery only the given paths (relative to the local folder), the
+     * directories leading to them and everything below them are read, the content of the other
+     * directories is restored from the journal if their inode and mtime did not change.
+     */
+    void setLocalDiscoveryOptions(LocalDiscoveryStyle style, const QSet<QString> &paths = QSet<QString>())
+        { _localDiscoveryStyle = style; _localDiscoveryPaths = paths; }
+
     Utility::StopWatch &stopWatch() { return _stopWatch; }
 
+    /** Timings and counters of the current or last sync, also written next to the journal */
+    const SyncPerformanceReport &performanceReport() const { return _performanceReport; }
+
     /* Return true if we detected that another sync is needed to complete the sync */
     bool isAnotherSyncNeeded() { return _anotherSyncNeeded; }
 
@@ -138,6 +166,7 @@ private:
 
     static int treewalkLocal( TREE_WALK_FILE*, void *);
     static int treewalkRemote( TREE_WALK_FILE*, void *);
+    static int superfluousRecordVisitor( uint64_t phash, const char *path, void *data );
     int treewalkFile( TREE_WALK_FILE*, bool );
     bool checkErrorBlacklisting( SyncFileItem &item );
 
@@ -156,13 +185,20 @@ private:
 
     static bool _syncRunning; //true when one sync is running somewhere (for debugging)
 
-    // Must only be acessed during update and reconcile
-    QMap<QString, SyncFileItemPtr> _syncItemMap;
-
-    // should be called _syncItems (present tense). It's the items from the _syncItemMap but
-    // sorted and re-adjusted based on permissions.
+    // should be called _syncItems (present tense). It's the items from the tree walk,
+    // sorted and re-adjusted based on permissions once the walk is done.
     SyncFileItemVector _syncedItems;
 
+    // Position of the items in _syncedItems, only used during the tree walk to merge the
+    // remote tree into the items of the local tree.
+    QHash<QString, int> _syncItemIndex;
+    void addSyncItem(const QString &key, const SyncFileItemPtr &item);
+    void removeSyncItem(const QString &key);
+
+    // The paths of the items that are not completed yet, with how many items have them.
+    // Sorted, so that estimateState() finds the items below a directory with one lookup.
+    QMap<QString, int> _pendingPaths;
+
     AccountPtr _account;
     CSYNC *_csync_ctx;
     bool _needsUpdate;
@@ -175,9 +211,9 @@ private:
     QSharedPointer <OwncloudPropagator> _propagator;
     QString _lastDeleted; // if the last item was a path and it has been deleted
 
-    // After a sync, only the syncdb entries whose filenames appear in this
-    // set will be kept. See _temporarilyUnavailablePaths.
-    QSet<QString> _seenFiles;
+    // Path hashes of the syncdb entries of the files that are in neither
+    // tree, they are removed after the sync. See _temporarilyUnavailablePaths.
+    QVector<qint64> _superfluousPhashes;
 
     // Some paths might be temporarily unavailable on the server, for
     // example due to 503 Storage not available. Deleting information
@@ -195,8 +231,11 @@ private:
 
     Utility::StopWatch _stopWatch;
 
-    // maps the origin and the target of the folders that have been renamed
-    QHash<QString, QString> _renamedFolders;
+    SyncPerformanceReport _performanceReport;
+    int _journalQueryCountAtStart;
+
+    // maps the origin and the target of the folders that have been renamed (in UTF-8)
+    csync_rename_trie_t *_renamedFolders;
     QString adjustRenamedPath(const QString &original);
 
     /**
@@ -213,6 +252,11 @@ private:
     int _downloadLimit;
     /* maximum size a folder can have without asking for confirmation: -1 means infinite */
     qint64 _newBigFolderSizeLimit;
+    int _localDiscoveryThreads;
+    int _remoteDiscoveryPrefetch;
+    bool _checksumMoveDetection;
+    LocalDiscoveryStyle _localDiscoveryStyle;
+    QSet<QString> _localDiscoveryPaths;
 
     // hash containing the permissions on the remote directory
     QHash<QString, QByteArray> _remotePerms;
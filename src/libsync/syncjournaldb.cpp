@@ -21,6 +21,7 @@
 
 #include "syncjournaldb.h"
 #include "syncjournalfilerecord.h"
+#include "syncfileitem.h"
 #include "utility.h"
 #include "version.h"
 #include "filesystem.h"
@@ -805,8 +806,7 @@ SyncJournalFileRecord SyncJournalDb::getFileRecord( const QString& filename )
     return rec;
 }
 
-bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
-                                    const QSet<QString>& prefixesToKeep)
+bool SyncJournalDb::postSyncCleanup(const QVector<qint64>& superfluousPhashes)
 {
     QMutexLocker locker(&_mutex);
 
@@ -814,43 +814,19 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
         return false;
     }
 
-    SqlQuery query(_db);
-    query.prepare("SELECT phash, path FROM metadata order by path");
-
-    if (!query.exec()) {
-        QString err = query.error();
-        qDebug() << "Error creating prepared statement: " << query.lastQuery() << ", Error:" << err;;
-        return false;
-    }
-
-    QStringList superfluousItems;
-
-    while(query.next()) {
-        const QString file = query.stringValue(1);
-        bool keep = filepathsToKeep.contains(file);
-        if( !keep ) {
-            foreach( const QString & prefix, prefixesToKeep ) {
-                if( file.startsWith(prefix) ) {
-                    keep = true;
-                    break;
-                }
+    if( !superfluousPhashes.isEmpty() ) {
+        qDebug() << "Sync Journal cleanup: removing" << superfluousPhashes.count() << "entries";
+        foreach( qint64 phash, superfluousPhashes ) {
+            _deleteFileRecordPhash->reset();
+            _deleteFileRecordPhash->bindValue( 1, phash );
+            if( !_deleteFileRecordPhash->exec() ) {
+                qDebug() << "Error removing superfluous journal entries: " << _deleteFileRecordPhash->lastQuery()
+                         << ", Error:" << _deleteFileRecordPhash->error();
+                _deleteFileRecordPhash->reset();
+                return false;
             }
         }
-        if( !keep ) {
-            superfluousItems.append(query.stringValue(0));
-        }
-    }
-
-    if( superfluousItems.count() )  {
-        QString sql = "DELETE FROM metadata WHERE phash in ("+ superfluousItems.join(",")+")";
-        qDebug() << "Sync Journal cleanup: " << sql;
-        SqlQuery delQuery(_db);
-        delQuery.prepare(sql);
-        if( !delQuery.exec() ) {
-            QString err = delQuery.error();
-            qDebug() << "Error removing superfluous journal entries: " << delQuery.lastQuery() << ", Error:" << err;;
-            return false;
-        }
+        _deleteFileRecordPhash->reset();
     }
 
     // Incorporate results back into main DB
@@ -859,6 +835,11 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString>& filepathsToKeep,
     return true;
 }
 
+int SyncJournalDb::queryCount()
+{
+    return _db.queryCount();
+}
+
 int SyncJournalDb::getFileRecordCount()
 {
     QMutexLocker locker(&_mutex);
@@ -1356,6 +1337,37 @@ QVector< SyncJournalDb::PollInfo > SyncJournalDb::getPollInfos()
     return res;
 }
 
+QHash<QString, SyncJournalDb::DirectoryInfo> SyncJournalDb::getDirectoryInfos()
+{
+    QMutexLocker locker(&_mutex);
+
+    QHash<QString, DirectoryInfo> res;
+
+    if( !checkConnect() )
+        return res;
+
+    SqlQuery query(_db);
+    query.prepare("SELECT path, md5, fileid, remotePerm FROM metadata WHERE type == ?1");
+    query.bindValue(1, int(SyncFileItem::Directory));
+
+    if (!query.exec()) {
+        QString err = query.error();
+        qDebug() << "Database error :" << query.lastQuery() << ", Error:" << err;
+        return res;
+    }
+
+    while( query.next() ) {
+        DirectoryInfo info;
+        info._etag = query.baValue(1);
+        info._fileId = query.baValue(2);
+        info._remotePerm = query.baValue(3);
+        res.insert(query.stringValue(0), info);
+    }
+
+    query.finish();
+    return res;
+}
+
 void SyncJournalDb::setPollInfo(const SyncJournalDb::PollInfo& info)
 {
     QMutexLocker locker(&_mutex);
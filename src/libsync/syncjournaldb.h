@@ -18,6 +18,7 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QVector>
 
 #include "utility.h"
 #include "ownsql.h"
@@ -83,6 +84,12 @@ public:
         time_t _modtime;
     };
 
+    struct DirectoryInfo {
+        QByteArray _etag;
+        QByteArray _fileId;
+        QByteArray _remotePerm;
+    };
+
     DownloadInfo getDownloadInfo(const QString &file);
     void setDownloadInfo(const QString &file, const DownloadInfo &i);
     QVector<DownloadInfo> getAndDeleteStaleDownloadInfos(const QSet<QString>& keep);
@@ -99,6 +106,9 @@ public:
     void setPollInfo(const PollInfo &);
     QVector<PollInfo> getPollInfos();
 
+    /// The etag, file id and permissions of all the directories, by path
+    QHash<QString, DirectoryInfo> getDirectoryInfos();
+
     enum SelectiveSyncListType {
         /** The black list is the list of folders that are unselected in the selective sync dialog.
          * For the sync engine, those folders are considered as if they were not there, so the local
@@ -130,8 +140,14 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
-    bool postSyncCleanup(const QSet<QString>& filepathsToKeep,
-                         const QSet<QString>& prefixesToKeep);
+    /**
+     * Removes the entries of the files that are gone on both sides. They are
+     * found by the discovery, see csync_statedb_walk_superfluous().
+     */
+    bool postSyncCleanup(const QVector<qint64>& superfluousPhashes);
+
+    /// Number of statements run on the journal so far, see SqlDatabase::queryCount()
+    int queryCount();
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "syncperformancereport.h"
+#include "filesystem.h"
+
+#include "json.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QVariantMap>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+namespace OCC {
+
+static const char *phaseNames[SyncPerformanceReport::PhaseCount] = {
+    "localDiscovery",
+    "remoteDiscovery",
+    "reconcile",
+    "treewalk",
+    "propagation",
+    "journalCleanup"
+};
+
+SyncPerformanceReport::SyncPerformanceReport()
+{
+    start();
+}
+
+void SyncPerformanceReport::start()
+{
+    _propfinds = 0;
+    _journalQueries = 0;
+    _bytesUploaded = 0;
+    _bytesDownloaded = 0;
+    _localTreeSize = 0;
+    _remoteTreeSize = 0;
+    _itemsPerInstruction.clear();
+
+    for (int i = 0; i < PhaseCount; ++i) {
+        _phases[i].wallMsec = 0;
+        _phases[i].cpuMsec = 0;
+    }
+    _startTime = QDateTime::currentDateTimeUtc();
+    _start = now();
+    _lastPhaseEnd = _start;
+}
+
+void SyncPerformanceReport::endPhase(Phase phase)
+{
+    Times end = now();
+    _phases[phase].wallMsec += end.wallMsec - _lastPhaseEnd.wallMsec;
+    _phases[phase].cpuMsec += end.cpuMsec - _lastPhaseEnd.cpuMsec;
+    _lastPhaseEnd = end;
+}
+
+SyncPerformanceReport::Times SyncPerformanceReport::now()
+{
+    Times times;
+    QElapsedTimer timer;
+    timer.start();
+    times.wallMsec = timer.msecsSinceReference();
+    times.cpuMsec = 0;
+
+#ifdef Q_OS_WIN
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        ULARGE_INTEGER kernel, user;
+        kernel.LowPart = kernelTime.dwLowDateTime;
+        kernel.HighPart = kernelTime.dwHighDateTime;
+        user.LowPart = userTime.dwLowDateTime;
+        user.HighPart = userTime.dwHighDateTime;
+        // in units of 100 nanoseconds
+        times.cpuMsec = (kernel.QuadPart + user.QuadPart) / 10000;
+    }
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        times.cpuMsec = qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000
+                + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+    }
+#endif
+    return times;
+}
+
+QByteArray SyncPerformanceReport::toJson() const
+{
+    QVariantMap phases;
+    for (int i = 0; i < PhaseCount; ++i) {
+        QVariantMap phase;
+        phase.insert(QLatin1String("wallMsec"), _phases[i].wallMsec);
+        phase.insert(QLatin1String("cpuMsec"), _phases[i].cpuMsec);
+        phases.insert(QLatin1String(phaseNames[i]), phase);
+    }
+
+    QVariantMap items;
+    for (auto it = _itemsPerInstruction.constBegin(); it != _itemsPerInstruction.constEnd(); ++it) {
+        items.insert(it.key(), it.value());
+    }
+
+    QVariantMap report;
+    report.insert(QLatin1String("version"), 1);
+    report.insert(QLatin1String("startTime"), _startTime.toString(Qt::ISODate));
+    report.insert(QLatin1String("wallMsec"), _lastPhaseEnd.wallMsec - _start.wallMsec);
+    report.insert(QLatin1String("cpuMsec"), _lastPhaseEnd.cpuMsec - _start.cpuMsec);
+    report.insert(QLatin1String("phases"), phases);
+    report.insert(QLatin1String("propfinds"), _propfinds);
+    report.insert(QLatin1String("journalQueries"), _journalQueries);
+    report.insert(QLatin1String("bytesUploaded"), _bytesUploaded);
+    report.insert(QLatin1String("bytesDownloaded"), _bytesDownloaded);
+    report.insert(QLatin1String("localTreeSize"), _localTreeSize);
+    report.insert(QLatin1String("remoteTreeSize"), _remoteTreeSize);
+    report.insert(QLatin1String("itemsPerInstruction"), items);
+
+    return QtJson::serialize(report);
+}
+
+QString SyncPerformanceReport::fileName(const QString &journalPath)
+{
+    // Starts with the journal name, so it is excluded from the sync like the journal
+    return journalPath + QLatin1String(".perf.json");
+}
+
+bool SyncPerformanceReport::write(const QString &journalPath) const
+{
+    const QString name = fileName(journalPath);
+    QFile file(name);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Could not write the performance report" << name << file.errorString();
+        return false;
+    }
+    file.write(toJson());
+    file.close();
+    FileSystem::setFileHidden(name, true);
+    return true;
+}
+
+}
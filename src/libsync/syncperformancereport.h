@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) by ownCloud, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QMap>
+#include <QString>
+
+namespace OCC {
+
+/**
+ * @brief Timings and counters of one sync run
+ * @ingroup libsync
+ *
+ * The SyncEngine fills it while it syncs and writes it as JSON next to the
+ * journal once the sync is done, see fileName(). owncloudcmd --perf-report
+ * hands it out.
+ *
+ * The phases follow each other: endPhase() books the wall clock and CPU time
+ * since the end of the previous phase, or since start(). The CPU time is the
+ * one of the whole process, so it includes the worker threads.
+ */
+class OWNCLOUDSYNC_EXPORT SyncPerformanceReport
+{
+public:
+    enum Phase {
+        LocalDiscovery,
+        RemoteDiscovery,
+        Reconcile,
+        Treewalk,
+        Propagation,
+        JournalCleanup,
+        PhaseCount
+    };
+
+    SyncPerformanceReport();
+
+    /** Forgets the previous sync and starts the first phase now */
+    void start();
+    void endPhase(Phase phase);
+
+    int _propfinds; // requests of the remote discovery
+    int _journalQueries; // SqlDatabase::queryCount() of libsync plus the statements of the csync statedb
+    qint64 _bytesUploaded; // of the files that were synced successfully
+    qint64 _bytesDownloaded;
+    qint64 _localTreeSize; // entries of the csync trees after the reconcile
+    qint64 _remoteTreeSize;
+    QMap<QString, int> _itemsPerInstruction; // by csync_instruction_str()
+
+    QByteArray toJson() const;
+
+    /** Writes the report next to the journal at journalPath */
+    bool write(const QString &journalPath) const;
+    static QString fileName(const QString &journalPath);
+
+private:
+    struct Times {
+        qint64 wallMsec;
+        qint64 cpuMsec;
+    };
+    static Times now();
+
+    QDateTime _startTime;
+    Times _start;
+    Times _lastPhaseEnd;
+    Times _phases[PhaseCount];
+};
+
+}
@@ -0,0 +1,88 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTCONCURRENCYCONTROLLER_H
+#define MIRALL_TESTCONCURRENCYCONTROLLER_H
+
+#include <QtTest>
+
+#include "concurrencycontroller.h"
+
+using namespace OCC;
+
+class TestConcurrencyController : public QObject
+{
+    Q_OBJECT
+
+    // Finishes one window of requests that each took latency msec and
+    // sent bytes, with all jobs of the limit running, starting at *now.
+    static void runWindow(ConcurrencyController &c, qint64 *now, quint64 latency, qint64 bytes) {
+        int requests = qMax(int(ConcurrencyController::windowMinimum), c.limit());
+        for (int i = 0; i < requests; ++i) {
+            *now += latency / c.limit() + 1;
+            c.requestFinished(latency, bytes, c.limit(), *now);
+        }
+    }
+
+private slots:
+    void testBounds() {
+        ConcurrencyController c(0, 4, 10);
+        QCOMPARE(c.minimum(), 1);
+        QCOMPARE(c.maximum(), 4);
+        QCOMPARE(c.limit(), 4);
+
+        ConcurrencyController single(1, 1, 3);
+        QCOMPARE(single.limit(), 1);
+    }
+
+    void testAdditiveIncrease() {
+        ConcurrencyController c(1, 6, 2);
+        qint64 now = 0;
+        for (int i = 0; i < 10; ++i) {
+            runWindow(c, &now, 100, 1000);
+        }
+        // the latency did not get worse, so it grows up to the maximum
+        QCOMPARE(c.limit(), 6);
+    }
+
+    void testNoIncreaseWhenIdle() {
+        ConcurrencyController c(1, 6, 3);
+        qint64 now = 0;
+        for (int i = 0; i < 10; ++i) {
+            now += 100;
+            c.requestFinished(100, 1000, 1, now);
+        }
+        // there was never more than one job, more would not have helped
+        QCOMPARE(c.limit(), 3);
+    }
+
+    void testMultiplicativeDecrease() {
+        ConcurrencyController c(1, 20, 8);
+        qint64 now = 0;
+        runWindow(c, &now, 100, 1000);
+        QCOMPARE(c.limit(), 9);
+
+        // three times slower with the same throughput: congested
+        for (int i = 0; i < 9; ++i) {
+            now += 300;
+            c.requestFinished(300, 1000, 9, now);
+        }
+        QCOMPARE(c.limit(), 4);
+    }
+
+    void testSlowerButMoreThroughput() {
+        ConcurrencyController c(1, 20, 4);
+        qint64 now = 0;
+        runWindow(c, &now, 100, 1000);
+        QCOMPARE(c.limit(), 5);
+
+        // bigger files: slower requests, but many more bytes per second
+        runWindow(c, &now, 300, 100000);
+        QCOMPARE(c.limit(), 6);
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#pragma once
+
+#include <QtTest>
+
+#include "discoveryphase.h"
+#include "networkjobs.h"
+
+using namespace OCC;
+
+static QByteArray davResponse(const QByteArray &path, bool isCollection, const QByteArray &etag)
+{
+    return "<d:response>"
+           "<d:href>/oc/remote.php/webdav/" + path + (isCollection ? "/" : "") + "</d:href>"
+           "<d:propstat>"
+           "<d:prop>"
+           "<d:getetag>\"" + etag + "\"</d:getetag>"
+           + (isCollection ? "<d:resourcetype><d:collection/></d:resourcetype>" : "<d:resourcetype/>") +
+           "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+           "</d:prop>"
+           "<d:status>HTTP/1.1 200 OK</d:status>"
+           "</d:propstat>"
+           "</d:response>";
+}
+
+static QByteArray davMultiStatus(const QByteArray &responses)
+{
+    return "<?xml version='1.0' encoding='utf-8'?>"
+           "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+           + responses +
+           "</d:multistatus>";
+}
+
+static QStringList fileNames(const QList<FileStatPointer> &list)
+{
+    QStringList names;
+    foreach (const FileStatPointer &stat, list) {
+        names.append(QString::fromUtf8(stat->name));
+    }
+    return names;
+}
+
+class TestDiscoveryPhase : public QObject
+{
+    Q_OBJECT
+
+private:
+    QVector<DavEntry> _entries;
+    QStringList _results;
+    QMap<QString, QStringList> _subdirectoryResults;
+    QString _etag;
+    QString _etagConcatenation;
+
+    // Lists the directory "A" like the PROPFIND of the job had returned xml
+    void runListing(DiscoverySingleDirectoryJob *job, const QByteArray &xml)
+    {
+        LsColXMLParser parser;
+        connect(&parser, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+                this, SLOT(slotDirectoryListingEntries(QVector<DavEntry>)));
+        QHash<QString, qint64> sizes;
+        QVERIFY(parser.parse(xml, &sizes, "/oc/remote.php/webdav/A"));
+
+        connect(job, SIGNAL(finishedWithResult(QList<FileStatPointer>)),
+                this, SLOT(slotFinishedWithResult(QList<FileStatPointer>)));
+        connect(job, SIGNAL(subdirectoryListing(QString,QList<FileStatPointer>)),
+                this, SLOT(slotSubdirectoryListing(QString,QList<FileStatPointer>)));
+        connect(job, SIGNAL(etag(QString)), this, SLOT(slotEtag(QString)));
+        connect(job, SIGNAL(etagConcatenation(QString)), this, SLOT(slotEtagConcatenation(QString)));
+
+        job->_requestPath = QLatin1String("/oc/remote.php/webdav/A");
+        job->directoryListingEntriesSlot(_entries);
+        job->lsJobFinishedWithoutErrorSlot();
+    }
+
+public slots:
+    void slotDirectoryListingEntries(const QVector<DavEntry> &entries)
+    {
+        _entries += entries;
+    }
+
+    void slotFinishedWithResult(const QList<FileStatPointer> &result)
+    {
+        _results = fileNames(result);
+    }
+
+    void slotSubdirectoryListing(const QString &fullPath, const QList<FileStatPointer> &result)
+    {
+        QVERIFY(!_subdirectoryResults.contains(fullPath));
+        _subdirectoryResults.insert(fullPath, fileNames(result));
+    }
+
+    void slotEtag(const QString &etag)
+    {
+        _etag = etag;
+    }
+
+    void slotEtagConcatenation(const QString &etagConcatenation)
+    {
+        _etagConcatenation = etagConcatenation;
+    }
+
+private slots:
+    void init()
+    {
+        _entries.clear();
+        _results.clear();
+        _subdirectoryResults.clear();
+        _etag.clear();
+        _etagConcatenation.clear();
+    }
+
+    void testDepthInfinity()
+    {
+        const QByteArray xml = davMultiStatus(
+            davResponse("A", true, "a")
+            + davResponse("A/B", true, "b")
+            + davResponse("A/B/C", true, "c")
+            + davResponse("A/B/C/f3", false, "f3")
+            + davResponse("A/B/f2", false, "f2")
+            + davResponse("A/E", true, "e")
+            + davResponse("A/f1", false, "f1"));
+
+        QObject parent;
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(AccountPtr(), "A", &parent);
+        job->setDepthInfinity(true);
+        runListing(job, xml);
+
+        // only the first level is the result of the directory itself
+        QCOMPARE(_results, QStringList() << "B" << "E" << "f1");
+
+        // every subdirectory gets its listing, also the empty ones
+        QCOMPARE(QStringList(_subdirectoryResults.keys()), QStringList() << "A/B" << "A/B/C" << "A/E");
+        QCOMPARE(_subdirectoryResults.value("A/B"), QStringList() << "C" << "f2");
+        QCOMPARE(_subdirectoryResults.value("A/B/C"), QStringList() << "f3");
+        QCOMPARE(_subdirectoryResults.value("A/E"), QStringList());
+
+        // the entries below the subdirectories are not part of the etags
+        QCOMPARE(_etag, QString("\"a\""));
+        QCOMPARE(_etagConcatenation, QString("\"a\"\"b\"\"e\"\"f1\""));
+    }
+
+    void testDepthInfinityAnsweredWithDepthOne()
+    {
+        const QByteArray xml = davMultiStatus(
+            davResponse("A", true, "a")
+            + davResponse("A/B", true, "b")
+            + davResponse("A/E", true, "e")
+            + davResponse("A/f1", false, "f1"));
+
+        QObject parent;
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(AccountPtr(), "A", &parent);
+        job->setDepthInfinity(true);
+        runListing(job, xml);
+
+        // the subdirectories are not known to be empty: they are listed one by one later
+        QCOMPARE(_results, QStringList() << "B" << "E" << "f1");
+        QVERIFY(_subdirectoryResults.isEmpty());
+
+        // the same etags as with the deep listing
+        QCOMPARE(_etag, QString("\"a\""));
+        QCOMPARE(_etagConcatenation, QString("\"a\"\"b\"\"e\"\"f1\""));
+    }
+
+    void testDepthOne()
+    {
+        const QByteArray xml = davMultiStatus(
+            davResponse("A", true, "a")
+            + davResponse("A/B", true, "b")
+            + davResponse("A/f1", false, "f1"));
+
+        QObject parent;
+        DiscoverySingleDirectoryJob *job = new DiscoverySingleDirectoryJob(AccountPtr(), "A", &parent);
+        runListing(job, xml);
+
+        QCOMPARE(_results, QStringList() << "B" << "f1");
+        QVERIFY(_subdirectoryResults.isEmpty());
+        QCOMPARE(_etagConcatenation, QString("\"a\"\"b\"\"f1\""));
+    }
+};
@@ -112,6 +112,44 @@ private slots:
         // Should not have the rights
         QVERIFY(!folderman->checkPathValidityForNewFolder("/").isNull());
         QVERIFY(!folderman->checkPathValidityForNewFolder("/usr/bin/somefolder").isNull());
+#else
+        QSKIP("Test not supported with Qt4", SkipSingle);
+#endif
+    }
+
+    void testFullLocalDiscoveryAfterWatcherError()
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 1, 0)
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        QVERIFY(QDir(dir.path()).mkpath("watched/sub"));
+        {
+            QFile f(dir.path() + "/watched/file.txt");
+            f.open(QFile::WriteOnly);
+            f.write("hello");
+        }
+
+        FolderMan *folderman = FolderMan::instance();
+        Folder *folder = folderman->addFolder(0, folderDefinition(dir.path() + "/watched"));
+        QVERIFY(folder);
+        // The watcher adds the directories from the event loop
+        QCoreApplication::processEvents();
+
+        // As if the first sync had read the whole tree
+        folder->_fullLocalDiscoveryNeeded = false;
+        folder->_timeSinceLastFullLocalDiscovery.start();
+        const qint64 interval = 60 * 60 * 1000;
+
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+        // Those watchers can't tell whether they missed changes
+        QVERIFY(folder->needsFullLocalDiscovery(interval));
+#else
+        QVERIFY(!folder->needsFullLocalDiscovery(interval));
+
+        // A file can't be watched as a directory: fails like a directory over the inotify limit
+        folderman->addMonitorPath(folder->alias(), dir.path() + "/watched/file.txt");
+        QVERIFY(folder->needsFullLocalDiscovery(interval));
+#endif
 #else
         QSKIP("Test not supported with Qt4", SkipSingle);
 #endif
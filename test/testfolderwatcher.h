@@ -70,6 +70,9 @@ private slots:
         _watcher = new FolderWatcher(_root);
         QObject::connect(_watcher, SIGNAL(pathChanged(QString)), this, SLOT(slotFolderChanged(QString)));
         _timer.singleShot(5000, this, SLOT(slotEnd()));
+
+        // Some backends add the directories from the event loop
+        _loop.processEvents();
     }
 
     void init()
@@ -85,6 +88,25 @@ private slots:
         QCOMPARE(_receivedNotifications, _requiredNotifications);
     }
 
+    void testReliable() {
+#if defined(Q_OS_WIN) || defined(Q_OS_MAC)
+        QVERIFY(!_watcher->isReliable());
+#else
+        QVERIFY(_watcher->isReliable());
+#endif
+    }
+
+    void testErrorWhileStarting() {
+        // The root can't be watched: the error must reach the slots connected after the constructor
+        FolderWatcher watcher(_root + "/a1/random.bin");
+        QSignalSpy errorSpy(&watcher, SIGNAL(error(QString)));
+        _loop.processEvents();
+#if !defined(Q_OS_WIN) && !defined(Q_OS_MAC)
+        QCOMPARE(errorSpy.count(), 1);
+#endif
+        QVERIFY(!watcher.isReliable());
+    }
+
     void testACreate() { // create a new file
         QString file(_root + "/foo.txt");
         QString cmd;
@@ -18,11 +18,42 @@ namespace OCC {
 QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous);
 }
 
+class FakePropagatorJob : public PropagatorJob
+{
+    Q_OBJECT
+public:
+    explicit FakePropagatorJob(JobParallelism parallelism = FullParallelism)
+        : PropagatorJob(0), _parallelism(parallelism) {}
+
+    JobParallelism parallelism() Q_DECL_OVERRIDE { return _parallelism; }
+
+    bool scheduleNextJob() Q_DECL_OVERRIDE {
+        if (_state != NotYetStarted) {
+            return false;
+        }
+        _state = Running;
+        return true;
+    }
+
+    void finish() {
+        _state = Finished;
+        emit finished(SyncFileItem::Success);
+    }
+
+private:
+    JobParallelism _parallelism;
+};
+
 class TestOwncloudPropagator : public QObject
 {
     Q_OBJECT
 
 private slots:
+    void initTestCase()
+    {
+        qRegisterMetaType<SyncFileItem::Status>("SyncFileItem::Status");
+    }
+
     void testUpdateErrorFromSession()
     {
 //        OwncloudPropagator propagator( NULL, QLatin1String("test1"), QLatin1String("test2"), new ProgressDatabase);
@@ -79,6 +110,78 @@ private slots:
             QCOMPARE(parseEtag(test.first), QByteArray(test.second));
         }
     }
+
+    void testDirectoryScheduling()
+    {
+        PropagateDirectory dir(0);
+        QSignalSpy finishedSpy(&dir, SIGNAL(finished(SyncFileItem::Status)));
+        QList<FakePropagatorJob *> jobs;
+        for (int i = 0; i < 6; ++i) {
+            jobs.append(new FakePropagatorJob(i == 2 ? PropagatorJob::WaitForFinished
+                                                     : PropagatorJob::FullParallelism));
+            dir.append(jobs.last());
+        }
+        QCOMPARE(dir.parallelism(), PropagatorJob::WaitForFinished);
+
+        // the job that waits for finished stops the scheduling once it runs
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(!dir.scheduleNextJob());
+        QCOMPARE(jobs[2]->_state, PropagatorJob::Running);
+        QCOMPARE(jobs[3]->_state, PropagatorJob::NotYetStarted);
+
+        // jobs that finish out of order don't matter
+        jobs[1]->finish();
+        QCoreApplication::processEvents();
+        QVERIFY(!dir.scheduleNextJob());
+        QCOMPARE(dir.parallelism(), PropagatorJob::WaitForFinished);
+
+        jobs[2]->finish();
+        QCoreApplication::processEvents();
+        QCOMPARE(dir.parallelism(), PropagatorJob::FullParallelism);
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(!dir.scheduleNextJob());
+
+        foreach (FakePropagatorJob *job, jobs) {
+            if (job->_state == PropagatorJob::Running) {
+                job->finish();
+            }
+        }
+        QCoreApplication::processEvents();
+        QCOMPARE(finishedSpy.count(), 1);
+        QCOMPARE(dir._state, PropagatorJob::Finished);
+    }
+
+    void testSubDirectoryScheduling()
+    {
+        // a directory within a directory that contains a move: the move may run
+        // in parallel with its siblings, but not with the jobs of the parent directory
+        PropagateDirectory dir(0);
+        PropagateDirectory *subDir = new PropagateDirectory(0);
+        FakePropagatorJob *move = new FakePropagatorJob(PropagatorJob::WaitForFinishedInParentDirectory);
+        FakePropagatorJob *sibling = new FakePropagatorJob;
+        FakePropagatorJob *after = new FakePropagatorJob;
+        subDir->append(move);
+        subDir->append(sibling);
+        dir.append(subDir);
+        dir.append(after);
+        QCOMPARE(dir.parallelism(), PropagatorJob::WaitForFinished);
+
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(dir.scheduleNextJob());
+        QVERIFY(!dir.scheduleNextJob());
+        QCOMPARE(move->_state, PropagatorJob::Running);
+        QCOMPARE(sibling->_state, PropagatorJob::Running);
+        QCOMPARE(after->_state, PropagatorJob::NotYetStarted);
+
+        move->finish();
+        QCoreApplication::processEvents();
+        QVERIFY(dir.scheduleNextJob());
+        QCOMPARE(after->_state, PropagatorJob::Running);
+    }
 };
 
 #endif
@@ -148,6 +148,18 @@ private slots:
         }
     }
 
+    void testQueryCount() {
+        int count = _db.queryCount();
+        SqlQuery q(_db);
+        q.prepare("SELECT * FROM addresses WHERE id=?1");
+        for (int id = 1; id <= 3; ++id) {
+            q.reset();
+            q.bindValue(1, id);
+            q.exec();
+        }
+        QCOMPARE(_db.queryCount(), count + 3);
+    }
+
 private:
     SqlDatabase _db;
 };
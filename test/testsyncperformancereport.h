@@ -0,0 +1,66 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *       support, and with no warranty, express or implied, as to its usefulness for
+ *          any purpose.
+ *          */
+
+#ifndef MIRALL_TESTSYNCPERFORMANCEREPORT_H
+#define MIRALL_TESTSYNCPERFORMANCEREPORT_H
+
+#include <QtTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "syncperformancereport.h"
+
+using namespace OCC;
+
+class TestSyncPerformanceReport : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testJson() {
+        SyncPerformanceReport report;
+        report.start();
+        report.endPhase(SyncPerformanceReport::LocalDiscovery);
+        QTest::qSleep(20);
+        report.endPhase(SyncPerformanceReport::RemoteDiscovery);
+        report._propfinds = 7;
+        report._bytesUploaded = 5000000000LL;
+        report._itemsPerInstruction[QLatin1String("INSTRUCTION_NEW")] = 3;
+
+        QJsonObject json = QJsonDocument::fromJson(report.toJson()).object();
+        QCOMPARE(json.value("propfinds").toInt(), 7);
+        QCOMPARE(json.value("bytesUploaded").toDouble(), 5000000000.0);
+        QCOMPARE(json.value("itemsPerInstruction").toObject().value("INSTRUCTION_NEW").toInt(), 3);
+
+        QJsonObject phases = json.value("phases").toObject();
+        QCOMPARE(phases.size(), int(SyncPerformanceReport::PhaseCount));
+        QVERIFY(phases.value("remoteDiscovery").toObject().value("wallMsec").toInt() >= 20);
+        QCOMPARE(phases.value("propagation").toObject().value("wallMsec").toInt(), 0);
+        QVERIFY(json.value("wallMsec").toInt() >= 20);
+
+        // start() forgets the previous sync
+        report.start();
+        json = QJsonDocument::fromJson(report.toJson()).object();
+        QCOMPARE(json.value("propfinds").toInt(), 0);
+        QVERIFY(json.value("itemsPerInstruction").toObject().isEmpty());
+    }
+
+    void testWrite() {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString journalPath = dir.path() + QLatin1String("/.csync_journal.db");
+
+        SyncPerformanceReport report;
+        report._journalQueries = 42;
+        QVERIFY(report.write(journalPath));
+
+        QFile file(SyncPerformanceReport::fileName(journalPath));
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QCOMPARE(QJsonDocument::fromJson(file.readAll()).object().value("journalQueries").toInt(), 42);
+    }
+};
+
+#endif
@@ -21,6 +21,8 @@ private:
   bool _success;
   QStringList _subdirs;
   QStringList _items;
+  QVector<DavEntry> _entries;
+  int _entryBatches;
 
 public slots:
   void slotDirectoryListingSubFolders(const QStringList& list)
@@ -35,6 +37,12 @@ public slots:
     _items.append(item);
   }
 
+  void slotDirectoryListingEntries(const QVector<DavEntry>& entries)
+  {
+    _entries += entries;
+    _entryBatches++;
+  }
+
   void slotFinishedSuccessfully()
   {
       _success = true;
@@ -46,6 +54,8 @@ private slots:
       _success = false;
       _subdirs.clear();
       _items.clear();
+      _entries.clear();
+      _entryBatches = 0;
     }
 
     void cleanup() {
@@ -442,6 +452,236 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    void testParserChunked() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "<d:quota-used-bytes>121780</d:quota-used-bytes>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/%C3%A4.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SLOT(slotDirectoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        // the response arrives in pieces that end anywhere, entries are emitted as they are complete
+        QHash <QString, qint64> sizes;
+        const QString expectedPath = "/oc/remote.php/webdav/sharefolder";
+        int firstEntryEnd = testXml.indexOf("</d:response>") + 13;
+        QVERIFY(parser.addData(testXml.left(firstEntryEnd - 1), &sizes, expectedPath));
+        QVERIFY(_items.isEmpty());
+        for (int i = firstEntryEnd - 1; i < testXml.size(); i += 3) {
+            QVERIFY(parser.addData(testXml.mid(i, 3), &sizes, expectedPath));
+            if (i == firstEntryEnd - 1) {
+                QCOMPARE(_items.size(), 1);
+            }
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+
+        QCOMPARE(sizes.value(expectedPath + "/"), qint64(121780));
+        QCOMPARE(_items, QStringList() << expectedPath << QString::fromUtf8("/oc/remote.php/webdav/sharefolder/ä.pdf"));
+        QCOMPARE(_subdirs, QStringList() << expectedPath + "/");
+    }
+
+    void testParserTruncated() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>";
+
+        LsColXMLParser parser;
+
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        // waiting for more data is fine, but not if the response is over
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.addData( testXml, &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QVERIFY(!parser.finish());
+        QVERIFY(!_success);
+    }
+
+    void testParserEntries() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<d:getcontentlength/>"
+              "<oc:downloadURL/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 404 Not Found</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions></oc:permissions>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        connect( &parser, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+                 this, SLOT(slotDirectoryListingEntries(QVector<DavEntry>)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        // the first response in one part, the second in another
+        QHash <QString, qint64> sizes;
+        int split = testXml.indexOf("<d:response>", 200);
+        QVERIFY(parser.addData( testXml.left(split), &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QCOMPARE(_entries.size(), 1);
+        QVERIFY(parser.addData( testXml.mid(split), &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QVERIFY(parser.finish());
+        QVERIFY(_success);
+        QCOMPARE(_entryBatches, 2);
+        QCOMPARE(_entries.size(), 2);
+
+        const DavEntry &dir = _entries.at(0);
+        QCOMPARE(dir.href, QString("/oc/remote.php/webdav/sharefolder"));
+        QVERIFY(dir.isCollection);
+        QCOMPARE(QByteArray(dir.fileId), QByteArray("00004213ocobzus5kn6s"));
+        QCOMPARE(QByteArray(dir.permissions), QByteArray("RDNVCK"));
+        QCOMPARE(dir.etag, QByteArray("\"5527beb0400b0\""));
+        QCOMPARE(QByteArray(dir.lastModified), QByteArray("Fri, 06 Feb 2015 13:49:55 GMT"));
+        // the properties of the 404 propstat are not there
+        QVERIFY(!(dir.properties & DavEntry::ContentLength));
+        QVERIFY(!(dir.properties & DavEntry::DownloadUrl));
+
+        const DavEntry &file = _entries.at(1);
+        QCOMPARE(file.href, QString("/oc/remote.php/webdav/sharefolder/quitte.pdf"));
+        QVERIFY(file.properties & DavEntry::ResourceType);
+        QVERIFY(!file.isCollection);
+        QVERIFY(file.properties & DavEntry::ContentLength);
+        QCOMPARE(file.contentLength, qint64(121780));
+        // empty permissions are sent, and mean read only
+        QVERIFY(file.properties & DavEntry::Permissions);
+        QCOMPARE(file.permissions[0], '\0');
+    }
+
+    void testParserEntriesTooLong() {
+        const QByteArray longId(60, 'x');
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/quitte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>" + longId + "</oc:id>"
+              "<oc:permissions>RDNVWRDNVWRDNVWRDNVW</oc:permissions>"
+              "<d:resourcetype/>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+
+        connect( &parser, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+                 this, SLOT(slotDirectoryListingEntries(QVector<DavEntry>)) );
+
+        QHash <QString, qint64> sizes;
+        QVERIFY(parser.parse( testXml, &sizes, "/oc/remote.php/webdav/sharefolder" ));
+        QCOMPARE(_entries.size(), 1);
+
+        // too long ids are truncated like csync does
+        const DavEntry &file = _entries.at(0);
+        QVERIFY(file.properties & DavEntry::FileId);
+        QCOMPARE(QByteArray(file.fileId), longId.left(FILE_ID_BUF_SIZE));
+        // too long permissions are left out
+        QVERIFY(!(file.properties & DavEntry::Permissions));
+    }
+
+    void testParserEntriesBenchmark() {
+        QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">";
+        for (int i = 0; i < 10000; ++i) {
+            QByteArray n = QByteArray::number(i);
+            testXml += "<d:response>"
+                  "<d:href>/oc/remote.php/webdav/big/file" + n + ".txt</d:href>"
+                  "<d:propstat>"
+                  "<d:prop>"
+                  "<oc:id>" + n + "ocobzus5kn6s</oc:id>"
+                  "<oc:permissions>RDNVW</oc:permissions>"
+                  "<d:getetag>\"" + n + "2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+                  "<d:resourcetype/>"
+                  "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+                  "<d:getcontentlength>" + n + "</d:getcontentlength>"
+                  "</d:prop>"
+                  "<d:status>HTTP/1.1 200 OK</d:status>"
+                  "</d:propstat>"
+                  "</d:response>";
+        }
+        testXml += "</d:multistatus>";
+
+        QBENCHMARK {
+            LsColXMLParser parser;
+            connect( &parser, SIGNAL(directoryListingEntries(QVector<DavEntry>)),
+                     this, SLOT(slotDirectoryListingEntries(QVector<DavEntry>)) );
+            QHash <QString, qint64> sizes;
+            _entries.clear();
+            QVERIFY(parser.parse( testXml, &sizes, "/oc/remote.php/webdav/big" ));
+            QCOMPARE(_entries.size(), 10000);
+        }
+    }
+
 };
 
 #endif